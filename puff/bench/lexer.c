@@ -0,0 +1,93 @@
+#include "lexer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define RUNS 5
+
+// functions in the style of the examples, with varied names and literals,
+// until the source reaches `size` bytes.
+static char* generate_source(size_t size)
+{
+    char* source = malloc(size + 512);
+    size_t len = 0;
+
+    for (int i = 0; len < size; i++) {
+        len += sprintf(source + len,
+            "fun compute_%d(count: int, scale: double): double {\n"
+            "    let total: double = 0.0\n"
+            "    let i: int = 0\n"
+            "\n"
+            "    while (i < count) {\n"
+            "        if (i %% %d == 0 && i != %d) {\n"
+            "            set total = total + todouble(i) * scale / %d.25\n"
+            "        } else {\n"
+            "            set total = total - 1.5\n"
+            "        }\n"
+            "\n"
+            "        set i = i + 1\n"
+            "    }\n"
+            "\n"
+            "    return total\n"
+            "}\n"
+            "\n",
+            i, i % 7 + 2, i, i);
+    }
+
+    source[len] = '\0';
+    return source;
+}
+
+static double seconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    size_t megabytes = argc > 1 ? (size_t)atoi(argv[1]) : 32;
+    char* source = generate_source(megabytes << 20);
+    size_t size = strlen(source);
+
+    double best = 0.0;
+    double best_stream = 0.0;
+    long tokens = 0;
+
+    for (int run = 0; run < RUNS; run++) {
+        double start = seconds();
+
+        lexer_init(source);
+        tokens = 0;
+
+        while (get_token().kind != TOK_EOF)
+            tokens++;
+
+        double elapsed = seconds() - start;
+
+        if (run == 0 || elapsed < best)
+            best = elapsed;
+
+        // the same source into a token stream, as --pretokenize does.
+        token_stream_t stream;
+
+        start = seconds();
+        token_stream_lex(&stream, source);
+        elapsed = seconds() - start;
+
+        token_stream_free(&stream);
+
+        if (run == 0 || elapsed < best_stream)
+            best_stream = elapsed;
+    }
+
+    printf("%zu bytes, %ld tokens\n", size, tokens);
+    printf("get_token: %.1f MB/s, %.1f Mtokens/s\n", size / best / (1 << 20), tokens / best / 1e6);
+    printf("token_stream_lex: %.1f MB/s, %.1f Mtokens/s\n", size / best_stream / (1 << 20), tokens / best_stream / 1e6);
+
+    free(source);
+}
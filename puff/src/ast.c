@@ -2,9 +2,73 @@
 
 #include <assert.h>
 #include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+// nodes are carved out of chunks of this size, bigger requests get a chunk of
+// their own.
+#define AST_CHUNK_SIZE (64 * 1024)
+
+struct ast_chunk_t {
+    ast_chunk_t* next;
+    size_t used;
+    size_t cap;
+    max_align_t data[];
+};
+
+static ast_arena_t* arena = NULL;
+
+void ast_arena_init(ast_arena_t* arena)
+{
+    *arena = (ast_arena_t) { 0 };
+}
+
+void ast_arena_free(ast_arena_t* arena)
+{
+    while (arena->chunks) {
+        ast_chunk_t* next = arena->chunks->next;
+        free(arena->chunks);
+        arena->chunks = next;
+    }
+
+    ast_arena_init(arena);
+}
+
+void ast_set_arena(ast_arena_t* current)
+{
+    arena = current;
+}
+
+static void* ast_alloc(size_t size)
+{
+    assert(arena && "NO AST ARENA");
+
+    size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+
+    ast_chunk_t* chunk = arena->chunks;
+
+    if (!chunk || chunk->used + size > chunk->cap) {
+        size_t cap = size > AST_CHUNK_SIZE ? size : AST_CHUNK_SIZE;
+
+        chunk = malloc(sizeof(ast_chunk_t) + cap);
+        chunk->used = 0;
+        chunk->cap = cap;
+        chunk->next = arena->chunks;
+
+        arena->chunks = chunk;
+        arena->chunks_len++;
+    }
+
+    void* node = (char*)chunk->data + chunk->used;
+    chunk->used += size;
+
+    arena->nodes++;
+    arena->bytes += size;
+
+    return node;
+}
+
 static expr_t expr_header_make(expr_kind_t kind)
 {
     return (expr_t) { .kind = kind };
@@ -12,7 +76,7 @@ static expr_t expr_header_make(expr_kind_t kind)
 
 expr_t* expr_ident_make(token_t ident)
 {
-    expr_ident_t* expr = malloc(sizeof(*expr));
+    expr_ident_t* expr = ast_alloc(sizeof(*expr));
     expr->__header = expr_header_make(EXPR_IDENTIFIER);
     expr->ident = ident;
 
@@ -21,17 +85,23 @@ expr_t* expr_ident_make(token_t ident)
 
 expr_t* expr_num_make(expr_num_kind_t kind, token_t number)
 {
-    expr_num_t* expr = malloc(sizeof(*expr));
+    expr_num_t* expr = ast_alloc(sizeof(*expr));
     expr->__header = expr_header_make(EXPR_NUMBER);
     expr->kind = kind;
     expr->number = number;
 
+    if (kind == EXPR_NUM_INT) {
+        expr->value.i = strtoll(number.start, NULL, 10);
+    } else {
+        expr->value.d = strtod(number.start, NULL);
+    }
+
     return (expr_t*)expr;
 }
 
 expr_t* expr_unary_make(char op, expr_t* operand)
 {
-    expr_unary_t* expr = malloc(sizeof(*expr));
+    expr_unary_t* expr = ast_alloc(sizeof(*expr));
     expr->__header = expr_header_make(EXPR_UNARY);
     expr->op = op;
     expr->operand = operand;
@@ -41,7 +111,7 @@ expr_t* expr_unary_make(char op, expr_t* operand)
 
 expr_t* expr_binary_make(expr_t* lhs, char op, expr_t* rhs)
 {
-    expr_binary_t* expr = malloc(sizeof(*expr));
+    expr_binary_t* expr = ast_alloc(sizeof(*expr));
     expr->__header = expr_header_make(EXPR_BINARY);
     expr->lhs = lhs;
     expr->op = op;
@@ -52,7 +122,7 @@ expr_t* expr_binary_make(expr_t* lhs, char op, expr_t* rhs)
 
 expr_t* expr_funcall_make(token_t name)
 {
-    expr_funcall_t* expr = malloc(sizeof(*expr));
+    expr_funcall_t* expr = ast_alloc(sizeof(*expr));
     expr->__header = expr_header_make(EXPR_FUNCALL);
     expr->name = name;
     expr->args_len = 0;
@@ -70,37 +140,24 @@ void expr_funcall_push_arg(expr_funcall_t* funcall, expr_t* arg)
     funcall->args[funcall->args_len++] = arg;
 }
 
-void expr_free(expr_t* expr)
+expr_t* expr_newarray_make(token_t type, expr_t* len)
 {
-    if (!expr)
-        return;
-
-    switch (expr->kind) {
-    case EXPR_IDENTIFIER:
-    case EXPR_NUMBER:
-        free(expr);
-        break;
-    case EXPR_UNARY: {
-        expr_unary_t* e = (expr_unary_t*)expr;
-        expr_free(e->operand);
-        free(e);
-    } break;
-    case EXPR_BINARY: {
-        expr_binary_t* e = (expr_binary_t*)expr;
-        expr_free(e->lhs);
-        expr_free(e->rhs);
-        free(e);
-    } break;
-    case EXPR_FUNCALL: {
-        expr_funcall_t* e = (expr_funcall_t*)expr;
-
-        for (int i = 0; i < e->args_len; i++) {
-            expr_free(e->args[i]);
-        }
-
-        free(e);
-    } break;
-    }
+    expr_newarray_t* expr = ast_alloc(sizeof(*expr));
+    expr->__header = expr_header_make(EXPR_NEWARRAY);
+    expr->type = type;
+    expr->len = len;
+
+    return (expr_t*)expr;
+}
+
+expr_t* expr_index_make(expr_t* array, expr_t* index)
+{
+    expr_index_t* expr = ast_alloc(sizeof(*expr));
+    expr->__header = expr_header_make(EXPR_INDEX);
+    expr->array = array;
+    expr->index = index;
+
+    return (expr_t*)expr;
 }
 
 static stmt_t stmt_header_make(stmt_kind_t kind)
@@ -110,7 +167,7 @@ static stmt_t stmt_header_make(stmt_kind_t kind)
 
 stmt_t* stmt_vardecl_make(token_t ident, token_t type, expr_t* expr)
 {
-    stmt_vardecl_t* stmt = malloc(sizeof(*stmt));
+    stmt_vardecl_t* stmt = ast_alloc(sizeof(*stmt));
     stmt->__header = stmt_header_make(STMT_VARDECL);
     stmt->ident = ident;
     stmt->type = type;
@@ -121,7 +178,7 @@ stmt_t* stmt_vardecl_make(token_t ident, token_t type, expr_t* expr)
 
 stmt_t* stmt_expr_make(expr_t* expr)
 {
-    stmt_expr_t* stmt = malloc(sizeof(*stmt));
+    stmt_expr_t* stmt = ast_alloc(sizeof(*stmt));
     stmt->__header = stmt_header_make(STMT_EXPR);
     stmt->expr = expr;
 
@@ -130,18 +187,19 @@ stmt_t* stmt_expr_make(expr_t* expr)
 
 stmt_t* stmt_return_make(expr_t* expr)
 {
-    stmt_return_t* stmt = malloc(sizeof(*stmt));
+    stmt_return_t* stmt = ast_alloc(sizeof(*stmt));
     stmt->__header = stmt_header_make(STMT_RETURN);
     stmt->expr = expr;
 
     return (stmt_t*)stmt;
 }
 
-stmt_t* stmt_varassign_make(token_t ident, expr_t* expr)
+stmt_t* stmt_varassign_make(token_t ident, expr_t* index, expr_t* expr)
 {
-    stmt_varassign_t* stmt = malloc(sizeof(*stmt));
+    stmt_varassign_t* stmt = ast_alloc(sizeof(*stmt));
     stmt->__header = stmt_header_make(STMT_VARASSIGN);
     stmt->ident = ident;
+    stmt->index = index;
     stmt->expr = expr;
 
     return (stmt_t*)stmt;
@@ -149,65 +207,64 @@ stmt_t* stmt_varassign_make(token_t ident, expr_t* expr)
 
 block_t* block_make(stmt_t* stmt)
 {
-    block_t* block = malloc(sizeof(*block));
+    block_t* block = ast_alloc(sizeof(*block));
     block->stmt = stmt;
     block->next = NULL;
 
     return block;
 }
 
-void block_free(block_t* block)
-{
-    if (!block)
-        return;
-
-    block_free(block->next);
-    stmt_free(block->stmt);
-    free(block);
-}
-
-stmt_t* stmt_if_make(expr_t* condition, block_t* true, block_t* false)
+stmt_t* stmt_if_make(expr_t* condition, block_t* true, block_t* false, int site)
 {
-    stmt_if_t* stmt = malloc(sizeof(*stmt));
+    stmt_if_t* stmt = ast_alloc(sizeof(*stmt));
     stmt->__header = stmt_header_make(STMT_IF);
     stmt->condition = condition;
     stmt->true = true;
     stmt->false = false;
+    stmt->site = site;
 
     return (stmt_t*)stmt;
 }
 
-void stmt_free(stmt_t* stmt)
+match_arm_t* match_arm_make()
 {
-    switch (stmt->kind) {
-        case STMT_VARDECL: {
-            stmt_vardecl_t* s = (stmt_vardecl_t*)stmt;
-            expr_free(s->expr);
-            free(s);
-        } break;
-        case STMT_EXPR: {
-            stmt_expr_t* s = (stmt_expr_t*)stmt;
-            expr_free(s->expr);
-            free(s);
-        } break;
-        case STMT_RETURN: {
-            stmt_return_t* s = (stmt_return_t*)stmt;
-            expr_free(s->expr);
-            free(s);
-        } break;
-        case STMT_VARASSIGN: {
-            stmt_varassign_t* s = (stmt_varassign_t*)stmt;
-            expr_free(s->expr);
-            free(s);
-        } break;
-        case STMT_IF: {
-            stmt_if_t* s = (stmt_if_t*)stmt;
-            expr_free(s->condition);
-            block_free(s->true);
-            block_free(s->false);
-            free(s);
-        } break;
+    match_arm_t* arm = ast_alloc(sizeof(*arm));
+    arm->values_len = 0;
+    arm->body = NULL;
+    arm->next = NULL;
+
+    return arm;
+}
+
+void match_arm_push_value(match_arm_t* arm, expr_t* value)
+{
+    if (arm->values_len >= 10) {
+        fprintf(stderr, "ERROR: case values exceeded limit\n");
+        exit(1);
     }
+
+    arm->values[arm->values_len++] = value;
+}
+
+stmt_t* stmt_match_make(expr_t* subject, match_arm_t* arms, block_t* otherwise)
+{
+    stmt_match_t* stmt = ast_alloc(sizeof(*stmt));
+    stmt->__header = stmt_header_make(STMT_MATCH);
+    stmt->subject = subject;
+    stmt->arms = arms;
+    stmt->otherwise = otherwise;
+
+    return (stmt_t*)stmt;
+}
+
+stmt_t* stmt_while_make(expr_t* condition, block_t* body)
+{
+    stmt_while_t* stmt = ast_alloc(sizeof(*stmt));
+    stmt->__header = stmt_header_make(STMT_WHILE);
+    stmt->condition = condition;
+    stmt->body = body;
+
+    return (stmt_t*)stmt;
 }
 
 static topdecl_t topdecl_make_header(topdecl_kind_t kind)
@@ -217,11 +274,16 @@ static topdecl_t topdecl_make_header(topdecl_kind_t kind)
 
 topdecl_t* topdecl_fun_make(token_t name)
 {
-    topdecl_fun_t* fun = malloc(sizeof(*fun));
+    topdecl_fun_t* fun = ast_alloc(sizeof(*fun));
     fun->__header = topdecl_make_header(TOPDECL_FUN);
     fun->name = name;
     fun->args_len = 0;
     fun->funbody = NULL;
+    fun->memo = 0;
+    fun->is_inline = 0;
+    fun->is_extern = 0;
+    fun->ifs_len = 0;
+    fun->reachable = 0;
 
     return (topdecl_t*)fun;
 }
@@ -236,32 +298,12 @@ void topdecl_fun_push_arg(topdecl_fun_t* fun, parameter_t arg)
     fun->args[fun->args_len++] = arg;
 }
 
-void topdecl_free(topdecl_t* topdecl)
-{
-    switch (topdecl->kind) {
-        case TOPDECL_FUN: {
-            topdecl_fun_t* f = (topdecl_fun_t*)topdecl;
-            block_free(f->funbody);
-            free(f);
-        } break;
-    }
-}
-
 program_t* program_make(topdecl_t* topdecl)
 {
-    program_t* program = malloc(sizeof(*program));
+    program_t* program = ast_alloc(sizeof(*program));
     program->topdecl = topdecl;
     program->next = NULL;
 
     return program;
 }
 
-void program_free(program_t* program)
-{
-    if (!program)
-        return;
-
-    program_free(program->next);
-    topdecl_free(program->topdecl);
-    free(program);
-}
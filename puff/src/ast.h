@@ -1,13 +1,35 @@
 #pragma once
 
+#include <stdint.h>
+
 #include "token.h"
 
+typedef struct ast_chunk_t ast_chunk_t;
+
+// nodes made by the *_make functions are bump allocated from the current
+// arena and only released all together.
+typedef struct {
+    ast_chunk_t* chunks; // most recent first
+
+    int64_t nodes; // allocations served
+    int64_t chunks_len; // allocations made for them
+    int64_t bytes;
+} ast_arena_t;
+
+void ast_arena_init(ast_arena_t* arena);
+void ast_arena_free(ast_arena_t* arena);
+
+// the arena must outlive the nodes made from now on.
+void ast_set_arena(ast_arena_t* arena);
+
 typedef enum {
     EXPR_IDENTIFIER,
     EXPR_NUMBER,
     EXPR_UNARY,
     EXPR_BINARY,
     EXPR_FUNCALL,
+    EXPR_NEWARRAY,
+    EXPR_INDEX,
 } expr_kind_t;
 
 typedef struct {
@@ -30,6 +52,11 @@ typedef struct {
     expr_t __header;
     expr_num_kind_t kind;
     token_t number;
+    // parsed from `number`, a negated literal is folded into it.
+    union {
+        int32_t i;
+        double d;
+    } value;
 } expr_num_t;
 
 expr_t* expr_num_make(expr_num_kind_t kind, token_t number);
@@ -42,6 +69,8 @@ typedef struct {
 
 expr_t* expr_unary_make(char op, expr_t* expr);
 
+// operators are stored as their character, except '=' for ==, '!' for !=,
+// 'l' for <=, 'g' for >=, 'L' for <<, 'R' for >>, 'A' for && and 'O' for ||.
 typedef struct {
     expr_t __header;
     expr_t* lhs;
@@ -61,7 +90,21 @@ typedef struct {
 expr_t* expr_funcall_make(token_t name);
 void expr_funcall_push_arg(expr_funcall_t* funcall, expr_t* arg);
 
-void expr_free(expr_t* expr);
+typedef struct {
+    expr_t __header;
+    token_t type; // element type
+    expr_t* len;
+} expr_newarray_t;
+
+expr_t* expr_newarray_make(token_t type, expr_t* len);
+
+typedef struct {
+    expr_t __header;
+    expr_t* array;
+    expr_t* index;
+} expr_index_t;
+
+expr_t* expr_index_make(expr_t* array, expr_t* index);
 
 typedef enum {
     STMT_VARDECL,
@@ -69,6 +112,8 @@ typedef enum {
     STMT_RETURN,
     STMT_VARASSIGN,
     STMT_IF,
+    STMT_MATCH,
+    STMT_WHILE,
 } stmt_kind_t;
 
 typedef struct {
@@ -101,10 +146,11 @@ stmt_t* stmt_return_make(expr_t* expr);
 typedef struct {
     stmt_t __header;
     token_t ident;
+    expr_t* index; // NULL unless an array element is assigned
     expr_t* expr;
 } stmt_varassign_t;
 
-stmt_t* stmt_varassign_make(token_t ident, expr_t* expr);
+stmt_t* stmt_varassign_make(token_t ident, expr_t* index, expr_t* expr);
 
 typedef struct block_t block_t;
 
@@ -114,18 +160,45 @@ struct block_t {
 };
 
 block_t* block_make(stmt_t* stmt);
-void block_free(block_t* block);
 
 typedef struct {
     stmt_t __header;
     expr_t* condition;
     block_t* true;
     block_t* false;
+    int site; // index among the ifs of its function, in source order
 } stmt_if_t;
 
-stmt_t* stmt_if_make(expr_t* condition, block_t* true, block_t* false);
+stmt_t* stmt_if_make(expr_t* condition, block_t* true, block_t* false, int site);
 
-void stmt_free(stmt_t* stmt);
+typedef struct match_arm_t match_arm_t;
+
+struct match_arm_t {
+    expr_t* values[10]; // int constants
+    int values_len;
+    block_t* body;
+    match_arm_t* next;
+};
+
+match_arm_t* match_arm_make();
+void match_arm_push_value(match_arm_t* arm, expr_t* value);
+
+typedef struct {
+    stmt_t __header;
+    expr_t* subject;
+    match_arm_t* arms;
+    block_t* otherwise; // else arm
+} stmt_match_t;
+
+stmt_t* stmt_match_make(expr_t* subject, match_arm_t* arms, block_t* otherwise);
+
+typedef struct {
+    stmt_t __header;
+    expr_t* condition;
+    block_t* body;
+} stmt_while_t;
+
+stmt_t* stmt_while_make(expr_t* condition, block_t* body);
 
 typedef enum {
     TOPDECL_FUN
@@ -147,13 +220,16 @@ typedef struct {
     int args_len;
     token_t type;
     block_t* funbody;
+    int memo; // annotated with @memo
+    int is_inline; // declared with `inline fun`
+    int is_extern; // declared with `extern fun`, without a body
+    int ifs_len; // ifs of its body, their sites are 0 to ifs_len - 1
+    int reachable; // called, directly or not, from main. set by codegen
 } topdecl_fun_t;
 
 topdecl_t* topdecl_fun_make(token_t name);
 void topdecl_fun_push_arg(topdecl_fun_t* fun, parameter_t arg);
 
-void topdecl_free(topdecl_t* topdecl);
-
 typedef struct program_t program_t;
 
 struct program_t {
@@ -162,5 +238,3 @@ struct program_t {
 };
 
 program_t* program_make(topdecl_t* topdecl);
-
-void program_free(program_t* program);
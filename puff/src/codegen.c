@@ -1,17 +1,32 @@
 #include "codegen.h"
 #include "ast.h"
+#include "ir.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define SYMTABLE_CAP 1024
 
+// instructions a constant call may run at compile time.
+#define CONSTEVAL_BUDGET 1000000
+
+// expression nodes of functions inlined without an `inline` hint.
+#define INLINE_THRESHOLD 8
+
+// a function taking this percentage of the calls of a profiled run is hot,
+// its inline threshold is multiplied by HOT_INLINE_FACTOR.
+#define HOT_CALLS_SHARE 10
+#define HOT_INLINE_FACTOR 4
+
 typedef enum {
     TYPE_BUILTIN_VOID,
     TYPE_BUILTIN_INT,
     TYPE_BUILTIN_DOUBLE,
+    TYPE_ARRAY_INT,
+    TYPE_ARRAY_DOUBLE,
     TYPE_USER_DEFINED,
 } type_kind_t;
 
@@ -20,6 +35,7 @@ typedef struct {
     type_kind_t type;
     int is_fun_args;
     int sp_offset;
+    int array_len; // statically known length of an array variable, -1 if unknown
 } symbol_t;
 
 static int initialized = 0;
@@ -30,16 +46,90 @@ static int sp_offset = -1;
 
 typedef struct {
     topdecl_fun_t* fun;
-    int ip;
+    int ip; // -1 until compiled
+    int pure; // no side effects, only calls pure functions
 } function_t;
 
 static function_t functions[SYMTABLE_CAP];
 static int functions_len = 0;
 
+static const nnative_t* natives = NULL;
+static int natives_len = 0;
+
+// cache index of the function being compiled, -1 unless it's memoized.
+static int memo_index = -1;
+static int memos_len = 0;
+
+// set while compiling a linear recursive function turned into a loop, its
+// accumulator is the first local.
+static char accumulator_op = 0;
+static int32_t accumulator_loop = -1;
+
+static int inline_threshold = INLINE_THRESHOLD;
+
+// functions are declared upfront and compiled on their first call.
+static int lazy = 0;
+
+// set by codegen_set_object.
+static object_t* object = NULL;
+static npb_t* object_pb = NULL;
+
+typedef enum {
+    SITE_CALLS, // entry of a function
+    SITE_TESTS, // first branch of an if condition, every test reaches it
+    SITE_SKIPS, // branch jumping over the then arm
+} site_kind_t;
+
+typedef struct {
+    site_kind_t kind;
+    int32_t entry; // in the profile being recorded
+    int32_t addr;
+} profile_site_t;
+
+// set by codegen_set_profiling.
+static profile_t* profiling = NULL;
+static npb_t* profiled_pb = NULL;
+static profile_site_t* profile_sites = NULL;
+static int32_t profile_sites_len = 0;
+static int32_t profile_sites_cap = 0;
+
+// first branch emitted since it was reset to -1.
+static int32_t condition_branch = -1;
+
+// set by codegen_set_profile.
+static const profile_t* feedback = NULL;
+
+// parameters of an inlined function are bound to the argument expressions of
+// the call, which are compiled in the enclosing environment.
+typedef struct inline_env_t inline_env_t;
+
+struct inline_env_t {
+    topdecl_fun_t* fun;
+    expr_t** args;
+    inline_env_t* parent;
+};
+
+static inline_env_t* inline_env = NULL;
+
+static int inline_param(token_t ident)
+{
+    if (!inline_env)
+        return -1;
+
+    topdecl_fun_t* fun = inline_env->fun;
+
+    for (int i = 0; i < fun->args_len; i++) {
+        if (ident.length == fun->args[i].arg.length && strncmp(ident.start, fun->args[i].arg.start, ident.length) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
 static int locals_lookup(token_t ident)
 {
     for (int i = 0; i < locals_len; i++) {
-        if (strncmp(ident.start, locals[i].token.start, locals[i].token.length) == 0) {
+        if (ident.length == locals[i].token.length && strncmp(ident.start, locals[i].token.start, locals[i].token.length) == 0) {
             return i;
         }
     }
@@ -50,7 +140,18 @@ static int locals_lookup(token_t ident)
 static int functions_lookup(token_t name)
 {
     for (int i = 0; i < functions_len; i++) {
-        if (strncmp(name.start, functions[i].fun->name.start, functions[i].fun->name.length) == 0) {
+        if (name.length == functions[i].fun->name.length && strncmp(name.start, functions[i].fun->name.start, functions[i].fun->name.length) == 0) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static int natives_lookup(token_t name)
+{
+    for (int i = 0; i < natives_len; i++) {
+        if (name.length == (int)strlen(natives[i].name) && strncmp(name.start, natives[i].name, name.length) == 0) {
             return i;
         }
     }
@@ -58,17 +159,242 @@ static int functions_lookup(token_t name)
     return -1;
 }
 
+static int is_builtin(token_t name, const char* builtin)
+{
+    return name.length == (int)strlen(builtin) && strncmp(name.start, builtin, name.length) == 0;
+}
+
+static int is_main(token_t name)
+{
+    return name.length == 4 && strncmp(name.start, "main", 4) == 0;
+}
+
+// builtins that map to a single instruction, overloads are picked by the type
+// of the first argument and every argument has that type.
+typedef struct {
+    const char* name;
+    int args_len;
+    type_kind_t args_type;
+    type_kind_t type;
+    void (*emit)(npb_t* pb);
+} intrinsic_t;
+
+static const intrinsic_t intrinsics[] = {
+    { "todouble", 1, TYPE_BUILTIN_INT,    TYPE_BUILTIN_DOUBLE, npb_i2d },
+    { "toint",    1, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_INT,    npb_d2i },
+    { "sqrt",     1, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dsqrt },
+    { "floor",    1, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dfloor },
+    { "ceil",     1, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dceil },
+    { "abs",      1, TYPE_BUILTIN_INT,    TYPE_BUILTIN_INT,    npb_iabs },
+    { "abs",      1, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dabs },
+    { "min",      2, TYPE_BUILTIN_INT,    TYPE_BUILTIN_INT,    npb_imin },
+    { "min",      2, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dmin },
+    { "max",      2, TYPE_BUILTIN_INT,    TYPE_BUILTIN_INT,    npb_imax },
+    { "max",      2, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dmax },
+    { "fma",      3, TYPE_BUILTIN_DOUBLE, TYPE_BUILTIN_DOUBLE, npb_dfma },
+};
+
+static const int intrinsics_len = sizeof(intrinsics) / sizeof(intrinsics[0]);
+
+// a function of the same name takes precedence, as it does over natives.
+static int is_intrinsic(token_t name)
+{
+    if (functions_lookup(name) != -1)
+        return 0;
+
+    for (int i = 0; i < intrinsics_len; i++) {
+        if (is_builtin(name, intrinsics[i].name))
+            return 1;
+    }
+
+    return 0;
+}
+
+static type_kind_t typecheck_expr(expr_t* expr);
+static type_kind_t get_type_from_token(token_t token);
+
+static int is_array_type(type_kind_t type)
+{
+    return type == TYPE_ARRAY_INT || type == TYPE_ARRAY_DOUBLE;
+}
+
+static type_kind_t element_type(type_kind_t array_type)
+{
+    return array_type == TYPE_ARRAY_DOUBLE ? TYPE_BUILTIN_DOUBLE : TYPE_BUILTIN_INT;
+}
+
+// type checks the call and returns the matching overload.
+static const intrinsic_t* intrinsics_resolve(expr_funcall_t* funcall)
+{
+    type_kind_t args_type = funcall->args_len > 0 ? typecheck_expr(funcall->args[0]) : TYPE_BUILTIN_VOID;
+
+    for (int i = 0; i < intrinsics_len; i++) {
+        const intrinsic_t* intrinsic = &intrinsics[i];
+
+        if (!is_builtin(funcall->name, intrinsic->name) || intrinsic->args_type != args_type)
+            continue;
+
+        if (funcall->args_len != intrinsic->args_len) {
+            fprintf(stderr, "ERROR: builtin function '%s' requires %d argument(s)\n", intrinsic->name, intrinsic->args_len);
+            exit(1);
+        }
+
+        for (int j = 1; j < funcall->args_len; j++) {
+            if (typecheck_expr(funcall->args[j]) != args_type) {
+                fprintf(stderr, "ERROR: mismatched argument types for builtin function '%s'\n", intrinsic->name);
+                exit(1);
+            }
+        }
+
+        return intrinsic;
+    }
+
+    fprintf(stderr, "ERROR: no overload of builtin function '%.*s' takes type %d\n", funcall->name.length, funcall->name.start, args_type);
+    exit(1);
+}
+
 void codegen_init(npb_t* pb)
 {
     npb_init(pb);
     initialized = 1;
 }
 
+void codegen_set_inline_threshold(int threshold)
+{
+    inline_threshold = threshold;
+}
+
+void codegen_set_lazy(int enabled)
+{
+    lazy = enabled;
+}
+
+void codegen_set_object(object_t* output)
+{
+    object = output;
+}
+
+void codegen_set_profiling(profile_t* profile)
+{
+    profiling = profile;
+}
+
+void codegen_set_profile(const profile_t* profile)
+{
+    feedback = profile;
+}
+
+// throwaway programs, like dead blocks, aren't recorded.
+static void record_site(npb_t* pb, site_kind_t kind, token_t function, int site, int32_t addr)
+{
+    if (!profiling || pb != profiled_pb || addr == -1)
+        return;
+
+    if (profile_sites_len == profile_sites_cap) {
+        profile_sites_cap = profile_sites_cap ? profile_sites_cap * 2 : 64;
+        profile_sites = realloc(profile_sites, sizeof(profile_site_t) * profile_sites_cap);
+    }
+
+    profile_sites[profile_sites_len++] = (profile_site_t) {
+        .kind = kind,
+        .entry = profile_add(profiling, function.start, function.length, site, 0, 0),
+        .addr = addr,
+    };
+}
+
+void codegen_collect_profile(const nprofile_t* counts)
+{
+    for (int32_t i = 0; i < profile_sites_len; i++) {
+        profile_site_t* site = &profile_sites[i];
+        profile_entry_t* entry = &profiling->entries[site->entry];
+
+        int64_t count = 0;
+        int64_t skipped = 0;
+
+        switch (site->kind) {
+            case SITE_CALLS: count = counts->calls[site->addr]; break;
+            case SITE_TESTS: count = counts->branches[site->addr]; break;
+            case SITE_SKIPS: skipped = counts->taken[site->addr]; break;
+        }
+
+        profile_add(profiling, entry->function, strlen(entry->function), entry->site, count, skipped);
+    }
+
+    free(profile_sites);
+
+    profile_sites = NULL;
+    profile_sites_len = 0;
+    profile_sites_cap = 0;
+}
+
+static const profile_entry_t* profiled(topdecl_fun_t* fun, int site)
+{
+    if (!feedback)
+        return NULL;
+
+    return profile_lookup(feedback, fun->name.start, fun->name.length, site);
+}
+
+static int64_t profiled_calls(topdecl_fun_t* fun)
+{
+    const profile_entry_t* entry = profiled(fun, -1);
+    return entry ? entry->count : 0;
+}
+
+static int inline_limit(topdecl_fun_t* fun)
+{
+    int64_t calls = profiled_calls(fun);
+
+    if (calls > 0 && calls * 100 >= feedback->calls * HOT_CALLS_SHARE)
+        return inline_threshold * HOT_INLINE_FACTOR;
+
+    return inline_threshold;
+}
+
+// whether the profiled run skipped the then arm more often than not.
+static int else_is_likely(stmt_if_t* sif, topdecl_fun_t* fun)
+{
+    const profile_entry_t* entry = profiled(fun, sif->site);
+    return sif->false && entry && entry->skipped * 2 > entry->count;
+}
+
+void codegen_register_natives(const nnative_t* table, int32_t table_len)
+{
+    natives = table;
+    natives_len = table_len;
+}
+
+static type_kind_t get_type_from_signature(char c)
+{
+    switch (c) {
+        case 'i': return TYPE_BUILTIN_INT;
+        case 'd': return TYPE_BUILTIN_DOUBLE;
+        case 'v': return TYPE_BUILTIN_VOID;
+    }
+
+    assert(0 && "INVALID NATIVE SIGNATURE");
+}
+
+static int native_args_len(const nnative_t* native)
+{
+    return strchr(native->signature, ':') - native->signature;
+}
+
+static type_kind_t native_return_type(const nnative_t* native)
+{
+    return get_type_from_signature(native->signature[native_args_len(native) + 1]);
+}
+
 static type_kind_t typecheck_expr(expr_t* expr)
 {
     switch (expr->kind) {
         case EXPR_IDENTIFIER: {
             expr_ident_t* ident = (expr_ident_t*)expr;
+
+            int param = inline_param(ident->ident);
+            if (param != -1)
+                return get_type_from_token(inline_env->fun->args[param].type);
+
             int index = locals_lookup(ident->ident);
             
             if (index == -1) {
@@ -88,14 +414,20 @@ static type_kind_t typecheck_expr(expr_t* expr)
         }
         case EXPR_UNARY: {
             expr_unary_t* unary = (expr_unary_t*)expr;
+            type_kind_t operand = typecheck_expr(unary->operand);
+
+            if (unary->op == '!' && operand != TYPE_BUILTIN_INT) {
+                fprintf(stderr, "ERROR: unsupported type for unary op: '%c'\n", unary->op);
+                exit(1);
+            }
 
-            return typecheck_expr(unary->operand);
+            return operand;
         }
         case EXPR_BINARY: {
             expr_binary_t* binary = (expr_binary_t*)expr;
 
             type_kind_t lhs = typecheck_expr(binary->lhs);
-            type_kind_t rhs = typecheck_expr(binary->lhs);
+            type_kind_t rhs = typecheck_expr(binary->rhs);
 
             if (lhs != rhs) {
                 fprintf(stderr, "ERROR: mismatched type for binary op: '%c'\n", binary->op);
@@ -107,8 +439,25 @@ static type_kind_t typecheck_expr(expr_t* expr)
                 case '-': break;
                 case '*': break;
                 case '/': break;
+                case '%': break;
+                case '&': break;
+                case '|': break;
+                case '^': break;
+                case 'L': break;
+                case 'R': break;
                 case '=': return TYPE_BUILTIN_INT;
                 case '!': return TYPE_BUILTIN_INT;
+                case '<': return TYPE_BUILTIN_INT;
+                case '>': return TYPE_BUILTIN_INT;
+                case 'l': return TYPE_BUILTIN_INT;
+                case 'g': return TYPE_BUILTIN_INT;
+                case 'A':
+                case 'O': {
+                    if (lhs != TYPE_BUILTIN_INT) {
+                        fprintf(stderr, "ERROR: unsupported type for binary op: '%c'\n", binary->op);
+                        exit(1);
+                    }
+                } break;
                 default: {
                     fprintf(stderr, "ERROR: unknown binary op: '%c'\n", binary->op);
                     exit(1);
@@ -120,7 +469,7 @@ static type_kind_t typecheck_expr(expr_t* expr)
         case EXPR_FUNCALL: {
             expr_funcall_t* funcall = (expr_funcall_t*)expr;
 
-            if (strncmp(funcall->name.start, "print", funcall->name.length) == 0) {
+            if (is_builtin(funcall->name, "print")) {
                 if (funcall->args_len != 1) {
                     fprintf(stderr, "ERROR: builtin function 'print' requires 1 argument\n");
                     exit(1);
@@ -129,7 +478,59 @@ static type_kind_t typecheck_expr(expr_t* expr)
                 return TYPE_BUILTIN_VOID;
             }
 
+            if (is_builtin(funcall->name, "spawn")) {
+                if (funcall->args_len != 1 || funcall->args[0]->kind != EXPR_FUNCALL) {
+                    fprintf(stderr, "ERROR: builtin function 'spawn' requires a function call as argument\n");
+                    exit(1);
+                }
+
+                typecheck_expr(funcall->args[0]);
+
+                return TYPE_BUILTIN_INT;
+            }
+
+            if (is_builtin(funcall->name, "len")) {
+                if (funcall->args_len != 1 || !is_array_type(typecheck_expr(funcall->args[0]))) {
+                    fprintf(stderr, "ERROR: builtin function 'len' requires 1 array argument\n");
+                    exit(1);
+                }
+
+                return TYPE_BUILTIN_INT;
+            }
+
+            if (is_builtin(funcall->name, "yield")) {
+                if (funcall->args_len != 0) {
+                    fprintf(stderr, "ERROR: builtin function 'yield' requires 0 argument\n");
+                    exit(1);
+                }
+
+                return TYPE_BUILTIN_VOID;
+            }
+
+            if (is_builtin(funcall->name, "resume")) {
+                if (funcall->args_len != 1 || typecheck_expr(funcall->args[0]) != TYPE_BUILTIN_INT) {
+                    fprintf(stderr, "ERROR: builtin function 'resume' requires 1 int argument\n");
+                    exit(1);
+                }
+
+                return TYPE_BUILTIN_VOID;
+            }
+
+            if (is_intrinsic(funcall->name))
+                return intrinsics_resolve(funcall)->type;
+
             int index = functions_lookup(funcall->name);
+            int native = index == -1 ? natives_lookup(funcall->name) : -1;
+
+            if (native != -1) {
+                if (funcall->args_len != native_args_len(&natives[native])) {
+                    fprintf(stderr, "ERROR: native function '%s' expecting %d argument(s)\n", natives[native].name, native_args_len(&natives[native]));
+                    exit(1);
+                }
+
+                return native_return_type(&natives[native]);
+            }
+
             if (index == -1) {
                 fprintf(stderr, "ERROR: there's no such function '%.*s'\n", funcall->name.length, funcall->name.start);
                 exit(1);
@@ -141,22 +542,44 @@ static type_kind_t typecheck_expr(expr_t* expr)
                 exit(1);
             }
 
-            if (strncmp(function.fun->type.start, "int", function.fun->type.length) == 0)
-                return TYPE_BUILTIN_INT;
+            return get_type_from_token(function.fun->type);
+        }
+        case EXPR_NEWARRAY: {
+            expr_newarray_t* newarray = (expr_newarray_t*)expr;
+
+            if (typecheck_expr(newarray->len) != TYPE_BUILTIN_INT) {
+                fprintf(stderr, "ERROR: array length must be an int\n");
+                exit(1);
+            }
 
-            if (strncmp(function.fun->type.start, "double", function.fun->type.length) == 0)
-                return TYPE_BUILTIN_DOUBLE;
+            return newarray->type.kind == TOK_DOUBLE ? TYPE_ARRAY_DOUBLE : TYPE_ARRAY_INT;
+        }
+        case EXPR_INDEX: {
+            expr_index_t* index = (expr_index_t*)expr;
 
-            if (strncmp(function.fun->type.start, "void", function.fun->type.length) == 0)
-                return TYPE_BUILTIN_VOID;
+            type_kind_t array_type = typecheck_expr(index->array);
+            if (!is_array_type(array_type)) {
+                fprintf(stderr, "ERROR: indexing a value that is not an array\n");
+                exit(1);
+            }
+
+            if (typecheck_expr(index->index) != TYPE_BUILTIN_INT) {
+                fprintf(stderr, "ERROR: array index must be an int\n");
+                exit(1);
+            }
 
-            assert(0 && "USER DEFINED TYPE IS NOT IMPLEMENTED YET");
+            return element_type(array_type);
         }
     }
+
+    assert(0 && "UNREACHABLE");
 }
 
 static type_kind_t get_type_from_token(token_t token)
 {
+    if (token.start[token.length - 1] == ']')
+        return strncmp(token.start, "double", 6) == 0 ? TYPE_ARRAY_DOUBLE : TYPE_ARRAY_INT;
+
     if (strncmp(token.start, "int", token.length) == 0)
         return TYPE_BUILTIN_INT;
 
@@ -169,80 +592,1569 @@ static type_kind_t get_type_from_token(token_t token)
     assert(0 && "USER DEFINED TYPE IS NOT IMPLEMENTED YET");
 }
 
-void codegen_expr(npb_t* pb, expr_t* expr)
+typedef struct {
+    type_kind_t type; // TYPE_BUILTIN_INT or TYPE_BUILTIN_DOUBLE
+    union {
+        int32_t i;
+        double d;
+    };
+} constant_t;
+
+static int fold_double(char op, double a, double b, constant_t* result)
 {
-    assert(initialized);
+    ir_const_t folded;
 
-    switch (expr->kind) {
-        case EXPR_IDENTIFIER: {
-            expr_ident_t* ident = (expr_ident_t*)expr;
-            int index = locals_lookup(ident->ident);
+    if (!ir_fold_double(op, a, b, &folded))
+        return 0;
 
-            if (locals[index].is_fun_args) {
-                npb_loadarg(pb, locals[index].sp_offset);
-            } else {
-                npb_dup(pb, locals[index].sp_offset);
-            }
-        } break;
+    if (folded.type == IR_DOUBLE) {
+        result->type = TYPE_BUILTIN_DOUBLE;
+        result->d = folded.d;
+    } else {
+        result->type = TYPE_BUILTIN_INT;
+        result->i = folded.i;
+    }
+
+    return 1;
+}
+
+// evaluates literal arithmetic with the vm's int32/double semantics. anything
+// that would trap is left alone so the error still happens at runtime.
+static int fold_constant(expr_t* expr, constant_t* result)
+{
+    switch (expr->kind) {
         case EXPR_NUMBER: {
             expr_num_t* num = (expr_num_t*)expr;
 
             if (num->kind == EXPR_NUM_INT) {
-                npb_ipush(pb, strtoll(num->number.start, NULL, 10));
+                result->type = TYPE_BUILTIN_INT;
+                result->i = num->value.i;
             } else {
-                npb_dpush(pb, strtod(num->number.start, NULL));
+                result->type = TYPE_BUILTIN_DOUBLE;
+                result->d = num->value.d;
             }
-        } break;
+
+            return 1;
+        }
         case EXPR_UNARY: {
             expr_unary_t* unary = (expr_unary_t*)expr;
-            type_kind_t type = typecheck_expr(unary->operand);
-            codegen_expr(pb, unary->operand);
 
-            switch (unary->op) {
-                case '-': {
-                    switch (type) {
-                        case TYPE_BUILTIN_INT:
-                            npb_ipush(pb, -1);
-                            npb_imul(pb);
-                            break;
-                        case TYPE_BUILTIN_DOUBLE:
-                            npb_dpush(pb, -1.0);
-                            npb_dmul(pb);
-                            break;
-                        default:
-                            fprintf(stderr, "ERROR: unsupported type for unary op: '%c'\n", unary->op);
-                            exit(1);
-                    }
-                } break;
-                default:
-                    fprintf(stderr, "ERROR: unknown unary op: '%c'\n", unary->op);
-                    exit(1);
+            if (!fold_constant(unary->operand, result))
+                return 0;
+
+            if (unary->op == '!') {
+                if (result->type != TYPE_BUILTIN_INT)
+                    return 0;
+
+                result->i = result->i == 0;
+            } else if (result->type == TYPE_BUILTIN_INT) {
+                result->i = (int32_t)(0u - (uint32_t)result->i);
+            } else {
+                result->d = result->d * -1.0;
             }
-        } break;
+
+            return 1;
+        }
         case EXPR_BINARY: {
             expr_binary_t* binary = (expr_binary_t*)expr;
+            constant_t lhs, rhs;
 
-            type_kind_t lhs_type = typecheck_expr(binary->lhs);
-            codegen_expr(pb, binary->lhs);
+            if (!fold_constant(binary->lhs, &lhs))
+                return 0;
 
-            type_kind_t rhs_type = typecheck_expr(binary->rhs);
-            codegen_expr(pb, binary->rhs);
+            // the rhs of && and || doesn't need to be constant when it's skipped.
+            if (binary->op == 'A' || binary->op == 'O') {
+                if (lhs.type != TYPE_BUILTIN_INT)
+                    return 0;
 
-            if (lhs_type != rhs_type) {
-                fprintf(stderr, "ERROR: mismatched type for binary op: '%c'\n", binary->op);
-                exit(1);
+                result->type = TYPE_BUILTIN_INT;
+
+                if ((binary->op == 'A') != (lhs.i != 0)) {
+                    result->i = binary->op == 'O';
+                    return 1;
+                }
+
+                if (!fold_constant(binary->rhs, &rhs) || rhs.type != TYPE_BUILTIN_INT)
+                    return 0;
+
+                result->i = rhs.i != 0;
+                return 1;
             }
 
-            switch (binary->op) {
-                case '+': {
-                    switch (lhs_type) {
-                        case TYPE_BUILTIN_INT:    npb_iadd(pb); break;
-                        case TYPE_BUILTIN_DOUBLE: npb_dadd(pb); break;
-                        default:
-                            fprintf(stderr, "ERROR: unsupported type for binary op: '%c'\n", binary->op);
-                            exit(1);
-                    }
-                } break;
+            if (!fold_constant(binary->rhs, &rhs) || lhs.type != rhs.type)
+                return 0;
+
+            if (lhs.type == TYPE_BUILTIN_DOUBLE)
+                return fold_double(binary->op, lhs.d, rhs.d, result);
+
+            result->type = TYPE_BUILTIN_INT;
+            return ir_fold_int(binary->op, lhs.i, rhs.i, &result->i);
+        }
+        default:
+            return 0;
+    }
+}
+
+static int int_constant(expr_t* expr, int32_t* value)
+{
+    constant_t constant;
+
+    if (!fold_constant(expr, &constant) || constant.type != TYPE_BUILTIN_INT)
+        return 0;
+
+    *value = constant.i;
+    return 1;
+}
+
+// while the body of `while (i < bound)` runs, `i` is known to be in
+// [0, bound) until the body assigns it.
+typedef struct {
+    int counter; // local of `i`, -1 once the body assigned it
+    int array; // local whose length is the bound, -1 for a constant bound
+    int32_t bound;
+} loop_range_t;
+
+static loop_range_t loop_ranges[SYMTABLE_CAP];
+static int loop_ranges_len = 0;
+
+// whether the bounds check of `array[index]` is redundant, that is the index
+// is a constant below the known length of an array variable, or the counter
+// of an enclosing loop bounded by the array length.
+static int index_in_bounds(expr_t* array, expr_t* index)
+{
+    if (array->kind != EXPR_IDENTIFIER)
+        return 0;
+
+    int local = locals_lookup(((expr_ident_t*)array)->ident);
+    int32_t value = 0;
+
+    if (local == -1)
+        return 0;
+
+    if (int_constant(index, &value))
+        return locals[local].array_len >= 0 && value >= 0 && value < locals[local].array_len;
+
+    if (index->kind != EXPR_IDENTIFIER || inline_env)
+        return 0;
+
+    int counter = locals_lookup(((expr_ident_t*)index)->ident);
+
+    for (int i = 0; counter != -1 && i < loop_ranges_len; i++) {
+        loop_range_t* range = &loop_ranges[i];
+
+        if (range->counter != counter)
+            continue;
+
+        if (range->array == local || (range->array == -1 && locals[local].array_len >= 0 && range->bound <= locals[local].array_len))
+            return 1;
+    }
+
+    return 0;
+}
+
+// whether `ident` is assigned a whole new value anywhere in the block.
+static int is_reassigned(block_t* block, token_t ident)
+{
+    for (; block; block = block->next) {
+        stmt_t* stmt = block->stmt;
+
+        switch (stmt->kind) {
+            case STMT_VARASSIGN: {
+                stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
+
+                if (!assign->index && assign->ident.length == ident.length && strncmp(assign->ident.start, ident.start, ident.length) == 0)
+                    return 1;
+            } break;
+            case STMT_IF: {
+                stmt_if_t* sif = (stmt_if_t*)stmt;
+
+                if (is_reassigned(sif->true, ident) || is_reassigned(sif->false, ident))
+                    return 1;
+            } break;
+            case STMT_MATCH: {
+                stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+                for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+                    if (is_reassigned(arm->body, ident))
+                        return 1;
+                }
+
+                if (is_reassigned(smatch->otherwise, ident))
+                    return 1;
+            } break;
+            case STMT_WHILE: {
+                if (is_reassigned(((stmt_while_t*)stmt)->body, ident))
+                    return 1;
+            } break;
+            default:
+                break;
+        }
+    }
+
+    return 0;
+}
+
+static int is_ident(expr_t* expr, token_t ident)
+{
+    if (expr->kind != EXPR_IDENTIFIER)
+        return 0;
+
+    token_t name = ((expr_ident_t*)expr)->ident;
+    return name.length == ident.length && strncmp(name.start, ident.start, ident.length) == 0;
+}
+
+static int max_int(int a, int b)
+{
+    return a > b ? a : b;
+}
+
+// how many times `ident` can be incremented by one on a path through the
+// block, -1 if it's assigned anything else or assigned inside a loop.
+static int increments(block_t* block, token_t ident)
+{
+    int count = 0;
+
+    for (; block; block = block->next) {
+        stmt_t* stmt = block->stmt;
+        int nested = 0;
+
+        switch (stmt->kind) {
+            case STMT_VARASSIGN: {
+                stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
+
+                if (assign->index || assign->ident.length != ident.length || strncmp(assign->ident.start, ident.start, ident.length) != 0)
+                    break;
+
+                expr_binary_t* binary = (expr_binary_t*)assign->expr;
+                int32_t one = 0;
+
+                if (assign->expr->kind != EXPR_BINARY || binary->op != '+')
+                    return -1;
+
+                if (!(is_ident(binary->lhs, ident) && int_constant(binary->rhs, &one) && one == 1)
+                    && !(is_ident(binary->rhs, ident) && int_constant(binary->lhs, &one) && one == 1))
+                    return -1;
+
+                nested = 1;
+            } break;
+            case STMT_IF: {
+                stmt_if_t* sif = (stmt_if_t*)stmt;
+                int on_true = increments(sif->true, ident);
+                int on_false = increments(sif->false, ident);
+
+                if (on_true == -1 || on_false == -1)
+                    return -1;
+
+                nested = max_int(on_true, on_false);
+            } break;
+            case STMT_MATCH: {
+                stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+                nested = increments(smatch->otherwise, ident);
+
+                for (match_arm_t* arm = smatch->arms; arm && nested != -1; arm = arm->next) {
+                    int on_arm = increments(arm->body, ident);
+                    nested = on_arm == -1 ? -1 : max_int(nested, on_arm);
+                }
+
+                if (nested == -1)
+                    return -1;
+            } break;
+            case STMT_WHILE: {
+                if (is_reassigned(((stmt_while_t*)stmt)->body, ident))
+                    return -1;
+            } break;
+            default:
+                break;
+        }
+
+        count += nested;
+    }
+
+    return count;
+}
+
+static int is_pure_block(block_t* block, topdecl_fun_t* fun);
+
+// natives are opaque to the compiler, so calling one counts as a side effect.
+static int is_pure_expr(expr_t* expr, topdecl_fun_t* fun)
+{
+    if (!expr)
+        return 1;
+
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER:
+        case EXPR_NUMBER:
+            return 1;
+        case EXPR_UNARY:
+            return is_pure_expr(((expr_unary_t*)expr)->operand, fun);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+            return is_pure_expr(binary->lhs, fun) && is_pure_expr(binary->rhs, fun);
+        }
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+
+            for (int i = 0; i < funcall->args_len; i++) {
+                if (!is_pure_expr(funcall->args[i], fun))
+                    return 0;
+            }
+
+            if (is_builtin(funcall->name, "len") || is_intrinsic(funcall->name))
+                return 1;
+
+            if (is_builtin(funcall->name, "print") || is_builtin(funcall->name, "spawn")
+                || is_builtin(funcall->name, "yield") || is_builtin(funcall->name, "resume"))
+                return 0;
+
+            // callees are compiled first, except for recursive calls.
+            if (funcall->name.length == fun->name.length && strncmp(funcall->name.start, fun->name.start, fun->name.length) == 0)
+                return 1;
+
+            int index = functions_lookup(funcall->name);
+            return index != -1 && functions[index].pure;
+        }
+        case EXPR_NEWARRAY:
+            return is_pure_expr(((expr_newarray_t*)expr)->len, fun);
+        case EXPR_INDEX: {
+            expr_index_t* index = (expr_index_t*)expr;
+            return is_pure_expr(index->array, fun) && is_pure_expr(index->index, fun);
+        }
+    }
+
+    return 0;
+}
+
+// whether every declaration of `ident` in the block passes `check`, `found`
+// is set once there's one.
+static int all_vardecls(block_t* block, token_t ident, int (*check)(stmt_vardecl_t*), int* found)
+{
+    for (; block; block = block->next) {
+        stmt_t* stmt = block->stmt;
+
+        switch (stmt->kind) {
+            case STMT_VARDECL: {
+                stmt_vardecl_t* vardecl = (stmt_vardecl_t*)stmt;
+
+                if (vardecl->ident.length == ident.length && strncmp(vardecl->ident.start, ident.start, ident.length) == 0) {
+                    if (!check(vardecl))
+                        return 0;
+
+                    *found = 1;
+                }
+            } break;
+            case STMT_IF: {
+                stmt_if_t* sif = (stmt_if_t*)stmt;
+
+                if (!all_vardecls(sif->true, ident, check, found) || !all_vardecls(sif->false, ident, check, found))
+                    return 0;
+            } break;
+            case STMT_MATCH: {
+                stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+                for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+                    if (!all_vardecls(arm->body, ident, check, found))
+                        return 0;
+                }
+
+                if (!all_vardecls(smatch->otherwise, ident, check, found))
+                    return 0;
+            } break;
+            case STMT_WHILE: {
+                if (!all_vardecls(((stmt_while_t*)stmt)->body, ident, check, found))
+                    return 0;
+            } break;
+            default:
+                break;
+        }
+    }
+
+    return 1;
+}
+
+static int allocates_array(stmt_vardecl_t* vardecl)
+{
+    return vardecl->expr->kind == EXPR_NEWARRAY;
+}
+
+static int declares_scalar(stmt_vardecl_t* vardecl)
+{
+    return !is_array_type(get_type_from_token(vardecl->type));
+}
+
+static int is_param(topdecl_fun_t* fun, token_t ident)
+{
+    for (int i = 0; i < fun->args_len; i++) {
+        if (fun->args[i].arg.length == ident.length && strncmp(fun->args[i].arg.start, ident.start, ident.length) == 0)
+            return 1;
+    }
+
+    return 0;
+}
+
+// an array the function allocated itself and never rebinds, so stores into it
+// can't be seen by the caller. parameters may alias the caller's arrays.
+static int is_own_array(topdecl_fun_t* fun, token_t ident)
+{
+    int found = 0;
+
+    if (is_param(fun, ident))
+        return 0;
+
+    return all_vardecls(fun->funbody, ident, allocates_array, &found) && found && !is_reassigned(fun->funbody, ident);
+}
+
+// whether the expression may read an array, which a call could write to. it
+// runs before the locals of the function are known, so types come from the
+// declarations.
+static int reads_arrays(expr_t* expr, topdecl_fun_t* fun)
+{
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER: {
+            token_t ident = ((expr_ident_t*)expr)->ident;
+            int found = 0;
+
+            for (int i = 0; i < fun->args_len; i++) {
+                if (fun->args[i].arg.length == ident.length && strncmp(fun->args[i].arg.start, ident.start, ident.length) == 0)
+                    return is_array_type(get_type_from_token(fun->args[i].type));
+            }
+
+            return !all_vardecls(fun->funbody, ident, declares_scalar, &found);
+        }
+        case EXPR_NUMBER:
+            return 0;
+        case EXPR_UNARY:
+            return reads_arrays(((expr_unary_t*)expr)->operand, fun);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+            return reads_arrays(binary->lhs, fun) || reads_arrays(binary->rhs, fun);
+        }
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+
+            for (int i = 0; i < funcall->args_len; i++) {
+                if (reads_arrays(funcall->args[i], fun))
+                    return 1;
+            }
+
+            return 0;
+        }
+        case EXPR_NEWARRAY:
+            return reads_arrays(((expr_newarray_t*)expr)->len, fun);
+        case EXPR_INDEX:
+            return 1;
+    }
+
+    return 1;
+}
+
+static int is_pure_stmt(stmt_t* stmt, topdecl_fun_t* fun)
+{
+    switch (stmt->kind) {
+        case STMT_VARDECL:
+            return is_pure_expr(((stmt_vardecl_t*)stmt)->expr, fun);
+        case STMT_EXPR:
+            return is_pure_expr(((stmt_expr_t*)stmt)->expr, fun);
+        case STMT_RETURN:
+            return is_pure_expr(((stmt_return_t*)stmt)->expr, fun);
+        case STMT_VARASSIGN: {
+            stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
+
+            if (assign->index && !is_own_array(fun, assign->ident))
+                return 0;
+
+            return is_pure_expr(assign->index, fun) && is_pure_expr(assign->expr, fun);
+        }
+        case STMT_IF: {
+            stmt_if_t* sif = (stmt_if_t*)stmt;
+            return is_pure_expr(sif->condition, fun) && is_pure_block(sif->true, fun) && is_pure_block(sif->false, fun);
+        }
+        case STMT_MATCH: {
+            stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+            if (!is_pure_expr(smatch->subject, fun) || !is_pure_block(smatch->otherwise, fun))
+                return 0;
+
+            for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+                if (!is_pure_block(arm->body, fun))
+                    return 0;
+            }
+
+            return 1;
+        }
+        case STMT_WHILE: {
+            stmt_while_t* swhile = (stmt_while_t*)stmt;
+            return is_pure_expr(swhile->condition, fun) && is_pure_block(swhile->body, fun);
+        }
+    }
+
+    return 0;
+}
+
+static int is_pure_block(block_t* block, topdecl_fun_t* fun)
+{
+    for (; block; block = block->next) {
+        if (!is_pure_stmt(block->stmt, fun))
+            return 0;
+    }
+
+    return 1;
+}
+
+// arrays live in the heap, so a cached result keyed on or holding one could
+// be stale.
+static void check_memo(topdecl_fun_t* fun)
+{
+    if (is_main(fun->name)) {
+        fprintf(stderr, "ERROR: the main function cannot be memoized\n");
+        exit(1);
+    }
+
+    type_kind_t type = get_type_from_token(fun->type);
+    if (type == TYPE_BUILTIN_VOID || is_array_type(type)) {
+        fprintf(stderr, "ERROR: memoized function '%.*s' must return int or double\n", fun->name.length, fun->name.start);
+        exit(1);
+    }
+
+    for (int i = 0; i < fun->args_len; i++) {
+        if (is_array_type(get_type_from_token(fun->args[i].type))) {
+            fprintf(stderr, "ERROR: memoized function '%.*s' cannot take arrays\n", fun->name.length, fun->name.start);
+            exit(1);
+        }
+    }
+
+    if (!is_pure_block(fun->funbody, fun)) {
+        fprintf(stderr, "ERROR: memoized function '%.*s' is not pure\n", fun->name.length, fun->name.start);
+        exit(1);
+    }
+}
+
+static int is_self_call(expr_t* expr, topdecl_fun_t* fun)
+{
+    if (expr->kind != EXPR_FUNCALL)
+        return 0;
+
+    token_t name = ((expr_funcall_t*)expr)->name;
+    return name.length == fun->name.length && strncmp(name.start, fun->name.start, name.length) == 0;
+}
+
+static int calls_self(expr_t* expr, topdecl_fun_t* fun)
+{
+    if (!expr)
+        return 0;
+
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER:
+        case EXPR_NUMBER:
+            return 0;
+        case EXPR_UNARY:
+            return calls_self(((expr_unary_t*)expr)->operand, fun);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+            return calls_self(binary->lhs, fun) || calls_self(binary->rhs, fun);
+        }
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+
+            if (is_self_call(expr, fun))
+                return 1;
+
+            for (int i = 0; i < funcall->args_len; i++) {
+                if (calls_self(funcall->args[i], fun))
+                    return 1;
+            }
+
+            return 0;
+        }
+        case EXPR_NEWARRAY:
+            return calls_self(((expr_newarray_t*)expr)->len, fun);
+        case EXPR_INDEX: {
+            expr_index_t* index = (expr_index_t*)expr;
+            return calls_self(index->array, fun) || calls_self(index->index, fun);
+        }
+    }
+
+    return 0;
+}
+
+// splits `return f(...)`, `return x op f(...)` and `return f(...) op x` into
+// the self call and the pending operand, NULL for a plain tail call.
+static int split_self_call(expr_t* expr, topdecl_fun_t* fun, expr_funcall_t** call, expr_t** operand, char* op)
+{
+    *operand = NULL;
+    *op = 0;
+
+    if (is_self_call(expr, fun)) {
+        *call = (expr_funcall_t*)expr;
+    } else if (expr->kind == EXPR_BINARY) {
+        expr_binary_t* binary = (expr_binary_t*)expr;
+
+        if (binary->op != '+' && binary->op != '*')
+            return 0;
+
+        if (is_self_call(binary->rhs, fun)) {
+            *call = (expr_funcall_t*)binary->rhs;
+            *operand = binary->lhs;
+        } else if (is_self_call(binary->lhs, fun)) {
+            // the operand now runs before the call, which may write arrays.
+            if (!is_pure_expr(binary->rhs, fun) || reads_arrays(binary->rhs, fun))
+                return 0;
+
+            *call = (expr_funcall_t*)binary->lhs;
+            *operand = binary->rhs;
+        } else {
+            return 0;
+        }
+
+        *op = binary->op;
+    } else {
+        return 0;
+    }
+
+    if (calls_self(*operand, fun))
+        return 0;
+
+    for (int i = 0; i < (*call)->args_len; i++) {
+        if (calls_self((*call)->args[i], fun))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int find_accumulator_op(block_t* block, topdecl_fun_t* fun, char* op);
+
+static int find_accumulator_op_stmt(stmt_t* stmt, topdecl_fun_t* fun, char* op)
+{
+    switch (stmt->kind) {
+        case STMT_VARDECL:
+            return !calls_self(((stmt_vardecl_t*)stmt)->expr, fun);
+        case STMT_EXPR:
+            return !calls_self(((stmt_expr_t*)stmt)->expr, fun);
+        case STMT_RETURN: {
+            expr_t* expr = ((stmt_return_t*)stmt)->expr;
+
+            if (!calls_self(expr, fun))
+                return 1;
+
+            expr_funcall_t* call;
+            expr_t* operand;
+            char call_op;
+
+            if (!split_self_call(expr, fun, &call, &operand, &call_op))
+                return 0;
+
+            if (!call_op)
+                return 1;
+
+            if (*op && *op != call_op)
+                return 0;
+
+            *op = call_op;
+            return 1;
+        }
+        case STMT_VARASSIGN: {
+            stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
+            return !calls_self(assign->index, fun) && !calls_self(assign->expr, fun);
+        }
+        case STMT_IF: {
+            stmt_if_t* sif = (stmt_if_t*)stmt;
+            return !calls_self(sif->condition, fun) && find_accumulator_op(sif->true, fun, op) && find_accumulator_op(sif->false, fun, op);
+        }
+        case STMT_MATCH: {
+            stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+            if (calls_self(smatch->subject, fun) || !find_accumulator_op(smatch->otherwise, fun, op))
+                return 0;
+
+            for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+                if (!find_accumulator_op(arm->body, fun, op))
+                    return 0;
+            }
+
+            return 1;
+        }
+        case STMT_WHILE: {
+            stmt_while_t* swhile = (stmt_while_t*)stmt;
+            return !calls_self(swhile->condition, fun) && find_accumulator_op(swhile->body, fun, op);
+        }
+    }
+
+    return 0;
+}
+
+static int find_accumulator_op(block_t* block, topdecl_fun_t* fun, char* op)
+{
+    for (; block; block = block->next) {
+        if (!find_accumulator_op_stmt(block->stmt, fun, op))
+            return 0;
+    }
+
+    return 1;
+}
+
+static int has_self_call(block_t* block, topdecl_fun_t* fun);
+
+static int has_self_call_stmt(stmt_t* stmt, topdecl_fun_t* fun)
+{
+    switch (stmt->kind) {
+        case STMT_RETURN:
+            return calls_self(((stmt_return_t*)stmt)->expr, fun);
+        case STMT_IF: {
+            stmt_if_t* sif = (stmt_if_t*)stmt;
+            return has_self_call(sif->true, fun) || has_self_call(sif->false, fun);
+        }
+        case STMT_MATCH: {
+            stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+            for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+                if (has_self_call(arm->body, fun))
+                    return 1;
+            }
+
+            return has_self_call(smatch->otherwise, fun);
+        }
+        case STMT_WHILE:
+            return has_self_call(((stmt_while_t*)stmt)->body, fun);
+        default:
+            return 0;
+    }
+}
+
+static int has_self_call(block_t* block, topdecl_fun_t* fun)
+{
+    for (; block; block = block->next) {
+        if (has_self_call_stmt(block->stmt, fun))
+            return 1;
+    }
+
+    return 0;
+}
+
+// int functions whose self calls all sit in returns of the form
+// `f(...)`, `x op f(...)` or `f(...) op x`, with one associative op, can keep
+// the pending `x op` parts in an accumulator and loop instead of calling.
+// returns the op, '+' when there are only tail calls, 0 otherwise.
+static char linear_recursion_op(topdecl_fun_t* fun)
+{
+    if (fun->memo || get_type_from_token(fun->type) != TYPE_BUILTIN_INT)
+        return 0;
+
+    if (is_main(fun->name))
+        return 0;
+
+    char op = 0;
+
+    if (!has_self_call(fun->funbody, fun) || !find_accumulator_op(fun->funbody, fun, &op))
+        return 0;
+
+    return op ? op : '+';
+}
+
+static void codegen_accumulate(npb_t* pb)
+{
+    if (accumulator_op == '+') {
+        npb_iadd(pb);
+    } else {
+        npb_imul(pb);
+    }
+}
+
+// log2 of a positive power of two literal, -1 otherwise.
+static int power_of_two_literal(expr_t* expr)
+{
+    int32_t value = 0;
+
+    if (!int_constant(expr, &value) || value <= 0 || (value & (value - 1)) != 0)
+        return -1;
+
+    return __builtin_ctz(value);
+}
+
+static int is_nonnegative(expr_t* expr)
+{
+    int32_t value = 0;
+
+    if (int_constant(expr, &value))
+        return value >= 0;
+
+    if (expr->kind == EXPR_FUNCALL)
+        return is_builtin(((expr_funcall_t*)expr)->name, "len");
+
+    if (expr->kind == EXPR_UNARY)
+        return ((expr_unary_t*)expr)->op == '!';
+
+    if (expr->kind != EXPR_BINARY)
+        return 0;
+
+    expr_binary_t* binary = (expr_binary_t*)expr;
+
+    switch (binary->op) {
+        case '&': return is_nonnegative(binary->lhs) || is_nonnegative(binary->rhs);
+        case '/': return is_nonnegative(binary->lhs) && is_nonnegative(binary->rhs);
+        case '%': return is_nonnegative(binary->lhs);
+        case 'R': return is_nonnegative(binary->lhs);
+        case '=':
+        case '!':
+        case '<':
+        case '>':
+        case 'l':
+        case 'g':
+        case 'A':
+        case 'O': return 1;
+        default:  return 0;
+    }
+}
+
+// rewrites int multiplication by a power of two into a shift, division and
+// remainder are only rewritten when the dividend can't be negative since the
+// shift and mask round differently. returns 0 if nothing was emitted.
+static int codegen_strength_reduced(npb_t* pb, expr_binary_t* binary)
+{
+    if (binary->op != '*' && binary->op != '/' && binary->op != '%')
+        return 0;
+
+    if (typecheck_expr(binary->lhs) != TYPE_BUILTIN_INT || typecheck_expr(binary->rhs) != TYPE_BUILTIN_INT)
+        return 0;
+
+    expr_t* operand = binary->lhs;
+    int shift = power_of_two_literal(binary->rhs);
+
+    if (shift == -1 && binary->op == '*') {
+        operand = binary->rhs;
+        shift = power_of_two_literal(binary->lhs);
+    }
+
+    if (shift <= 0)
+        return 0;
+
+    if (binary->op != '*' && !is_nonnegative(operand))
+        return 0;
+
+    codegen_expr(pb, operand);
+
+    switch (binary->op) {
+        case '*':
+            npb_ipush(pb, shift);
+            npb_ishl(pb);
+            break;
+        case '/':
+            npb_ipush(pb, shift);
+            npb_ishr(pb);
+            break;
+        case '%':
+            npb_ipush(pb, (1 << shift) - 1);
+            npb_iand(pb);
+            break;
+    }
+
+    return 1;
+}
+
+// checks the arguments of a call to a user defined function and pushes them,
+// returns the index of the callee.
+static int codegen_call_args(npb_t* pb, expr_funcall_t* funcall)
+{
+    int index = functions_lookup(funcall->name);
+    if (index == -1) {
+        fprintf(stderr, "ERROR: there's no such function '%.*s'\n", funcall->name.length, funcall->name.start);
+        exit(1);
+    }
+
+    function_t function = functions[index];
+    if (funcall->args_len != function.fun->args_len) {
+        fprintf(stderr, "ERROR: function '%.*s' expecting %d argument(s)\n", function.fun->name.length, function.fun->name.start, function.fun->args_len);
+        exit(1);
+    }
+
+    for (int i = 0; i < funcall->args_len; i++) {
+        type_kind_t expr_type = typecheck_expr(funcall->args[i]);
+        type_kind_t param_type = get_type_from_token(functions[index].fun->args[i].type);
+
+        codegen_expr(pb, funcall->args[i]);
+
+        if (param_type != expr_type) {
+            topdecl_fun_t* fun = functions[index].fun;
+            fprintf(stderr, "ERROR: the %d argument of '%.*s' is expecting: %d type but got %d\n", i, fun->name.length, fun->name.start, param_type, expr_type);
+            exit(1);
+        }
+    }
+
+    return index;
+}
+
+// parameter types then the return type, as in object_symbol_t.
+static void signature_of(topdecl_fun_t* fun, char* signature)
+{
+    static const char kinds[] = {
+        [TYPE_BUILTIN_VOID] = 'v',
+        [TYPE_BUILTIN_INT] = 'i',
+        [TYPE_BUILTIN_DOUBLE] = 'd',
+        [TYPE_ARRAY_INT] = 'I',
+        [TYPE_ARRAY_DOUBLE] = 'D',
+    };
+
+    for (int i = 0; i < fun->args_len; i++)
+        *signature++ = kinds[get_type_from_token(fun->args[i].type)];
+
+    *signature++ = ':';
+    *signature++ = kinds[get_type_from_token(fun->type)];
+    *signature = '\0';
+}
+
+// the address of an extern function is left to the linker.
+static void relocate_extern(npb_t* pb, int index)
+{
+    topdecl_fun_t* fun = functions[index].fun;
+
+    if (!object) {
+        fprintf(stderr, "ERROR: extern function '%.*s' is only defined when linking\n", fun->name.length, fun->name.start);
+        exit(1);
+    }
+
+    if (pb != object_pb)
+        return;
+
+    char signature[16];
+    signature_of(fun, signature);
+
+    object_add_relocation(object, fun->name.start, fun->name.length, signature, pb->program_len + 1);
+}
+
+// functions not compiled yet are called through a stub that compiles them.
+static void codegen_call(npb_t* pb, int index, int32_t num_args)
+{
+    if (functions[index].fun->is_extern) {
+        relocate_extern(pb, index);
+        npb_call(pb, -1, num_args);
+    } else if (functions[index].ip == -1) {
+        npb_callstub(pb, index, num_args);
+    } else {
+        npb_call(pb, functions[index].ip, num_args);
+    }
+}
+
+static void codegen_spawn(npb_t* pb, int index, int32_t num_args)
+{
+    if (functions[index].fun->is_extern) {
+        relocate_extern(pb, index);
+        npb_spawn(pb, -1, num_args);
+    } else if (functions[index].ip == -1) {
+        npb_spawnstub(pb, index, num_args);
+    } else {
+        npb_spawn(pb, functions[index].ip, num_args);
+    }
+}
+
+static int is_constant_call(expr_funcall_t* funcall);
+
+static int is_constant_expr(expr_t* expr)
+{
+    switch (expr->kind) {
+        case EXPR_NUMBER:
+            return 1;
+        case EXPR_UNARY:
+            return is_constant_expr(((expr_unary_t*)expr)->operand);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+            return is_constant_expr(binary->lhs) && is_constant_expr(binary->rhs);
+        }
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+
+            if (is_intrinsic(funcall->name)) {
+                for (int i = 0; i < funcall->args_len; i++) {
+                    if (!is_constant_expr(funcall->args[i]))
+                        return 0;
+                }
+
+                return 1;
+            }
+
+            return is_constant_call(funcall);
+        }
+        default:
+            return 0;
+    }
+}
+
+// pure scalar calls with constant arguments, the last function in `functions`
+// is the one being compiled so it can't run yet, nor can uncompiled ones.
+static int is_constant_call(expr_funcall_t* funcall)
+{
+    int index = functions_lookup(funcall->name);
+
+    if (index == -1 || index == functions_len - 1 || functions[index].ip == -1 || !functions[index].pure)
+        return 0;
+
+    type_kind_t type = get_type_from_token(functions[index].fun->type);
+    if (type != TYPE_BUILTIN_INT && type != TYPE_BUILTIN_DOUBLE)
+        return 0;
+
+    for (int i = 0; i < funcall->args_len; i++) {
+        if (!is_constant_expr(funcall->args[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+// runs a constant call in a sandbox vm, calls that trap or exceed the budget
+// are left to the runtime.
+static int consteval(npb_t* pb, expr_funcall_t* funcall, value_t* result)
+{
+    if (!is_constant_call(funcall))
+        return 0;
+
+    int32_t start = pb->program_len;
+
+    int index = codegen_call_args(pb, funcall);
+    codegen_call(pb, index, funcall->args_len);
+    npb_halt(pb);
+
+    noice_t vm;
+    noice_init(&vm);
+    noice_load_program(&vm, pb->program, pb->program_len, start);
+
+    ntrap_t trap = noice_run_budget(&vm, CONSTEVAL_BUDGET);
+    *result = trap == TRAP_HALT ? vm.stack[vm.sp] : 0;
+
+    noice_free(&vm);
+    pb->program_len = start;
+
+    return trap == TRAP_HALT;
+}
+
+// pushes the result of a constant call instead of calling it.
+static int codegen_consteval(npb_t* pb, expr_funcall_t* funcall)
+{
+    value_t result;
+
+    if (!consteval(pb, funcall, &result))
+        return 0;
+
+    if (get_type_from_token(functions[functions_lookup(funcall->name)].fun->type) == TYPE_BUILTIN_INT) {
+        npb_ipush(pb, value_as_int(result));
+    } else {
+        npb_dpush(pb, value_as_double(result));
+    }
+
+    return 1;
+}
+
+static int expr_size(expr_t* expr)
+{
+    switch (expr->kind) {
+        case EXPR_UNARY:
+            return 1 + expr_size(((expr_unary_t*)expr)->operand);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+            return 1 + expr_size(binary->lhs) + expr_size(binary->rhs);
+        }
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+            int size = 1;
+
+            for (int i = 0; i < funcall->args_len; i++)
+                size += expr_size(funcall->args[i]);
+
+            return size;
+        }
+        case EXPR_NEWARRAY:
+            return 1 + expr_size(((expr_newarray_t*)expr)->len);
+        case EXPR_INDEX: {
+            expr_index_t* index = (expr_index_t*)expr;
+            return 1 + expr_size(index->array) + expr_size(index->index);
+        }
+        default:
+            return 1;
+    }
+}
+
+static int count_uses(expr_t* expr, token_t ident)
+{
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER: {
+            token_t name = ((expr_ident_t*)expr)->ident;
+            return name.length == ident.length && strncmp(name.start, ident.start, name.length) == 0;
+        }
+        case EXPR_NUMBER:
+            return 0;
+        case EXPR_UNARY:
+            return count_uses(((expr_unary_t*)expr)->operand, ident);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+            return count_uses(binary->lhs, ident) + count_uses(binary->rhs, ident);
+        }
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+            int uses = 0;
+
+            for (int i = 0; i < funcall->args_len; i++)
+                uses += count_uses(funcall->args[i], ident);
+
+            return uses;
+        }
+        case EXPR_NEWARRAY:
+            return count_uses(((expr_newarray_t*)expr)->len, ident);
+        case EXPR_INDEX: {
+            expr_index_t* index = (expr_index_t*)expr;
+            return count_uses(index->array, ident) + count_uses(index->index, ident);
+        }
+    }
+
+    return 0;
+}
+
+// the returned expression of a non-recursive `return expr` function taking
+// and returning scalars, NULL if it can't be inlined.
+static expr_t* inline_body(topdecl_fun_t* fun)
+{
+    block_t* body = fun->funbody;
+
+    if (!body || body->next || body->stmt->kind != STMT_RETURN || fun->memo)
+        return NULL;
+
+    expr_t* expr = ((stmt_return_t*)body->stmt)->expr;
+    if (!expr || calls_self(expr, fun))
+        return NULL;
+
+    type_kind_t type = get_type_from_token(fun->type);
+    if (type != TYPE_BUILTIN_INT && type != TYPE_BUILTIN_DOUBLE)
+        return NULL;
+
+    for (int i = 0; i < fun->args_len; i++) {
+        if (is_array_type(get_type_from_token(fun->args[i].type)))
+            return NULL;
+    }
+
+    return expr;
+}
+
+// operands that can be dropped: no calls and nothing that can trap.
+static int is_effect_free(expr_t* expr)
+{
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER:
+        case EXPR_NUMBER:
+            return 1;
+        case EXPR_UNARY:
+            return is_effect_free(((expr_unary_t*)expr)->operand);
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+
+            if (binary->op == '/' || binary->op == '%')
+                return 0;
+
+            return is_effect_free(binary->lhs) && is_effect_free(binary->rhs);
+        }
+        default:
+            return 0;
+    }
+}
+
+// an argument that can be duplicated or dropped without changing anything.
+static int is_trivial_arg(expr_t* expr)
+{
+    int32_t value;
+
+    if (expr->kind == EXPR_NUMBER || int_constant(expr, &value))
+        return 1;
+
+    if (expr->kind != EXPR_IDENTIFIER)
+        return 0;
+
+    int param = inline_param(((expr_ident_t*)expr)->ident);
+    if (param == -1)
+        return 1;
+
+    inline_env_t* env = inline_env;
+
+    inline_env = env->parent;
+    int trivial = is_trivial_arg(env->args[param]);
+    inline_env = env;
+
+    return trivial;
+}
+
+// substitutes the arguments into the body of a small function. other than
+// trivial ones, arguments must be used once and be effect free, as the body
+// may run them in another order or not at all.
+static int codegen_inline_call(npb_t* pb, expr_funcall_t* funcall)
+{
+    int index = functions_lookup(funcall->name);
+    if (index == -1)
+        return 0;
+
+    topdecl_fun_t* fun = functions[index].fun;
+    expr_t* body = inline_body(fun);
+
+    if (!body || funcall->args_len != fun->args_len)
+        return 0;
+
+    if (!fun->is_inline && expr_size(body) > inline_limit(fun))
+        return 0;
+
+    for (int i = 0; i < funcall->args_len; i++) {
+        if (typecheck_expr(funcall->args[i]) != get_type_from_token(fun->args[i].type))
+            return 0;
+
+        if (is_trivial_arg(funcall->args[i]))
+            continue;
+
+        if (!is_effect_free(funcall->args[i]) || count_uses(body, fun->args[i].arg) != 1)
+            return 0;
+    }
+
+    inline_env_t env = {
+        .fun = fun,
+        .args = funcall->args,
+        .parent = inline_env,
+    };
+
+    inline_env = &env;
+    codegen_expr(pb, body);
+    inline_env = env.parent;
+
+    return 1;
+}
+
+static void codegen_native_call(npb_t* pb, expr_funcall_t* funcall, int native)
+{
+    const nnative_t* fn = &natives[native];
+
+    if (funcall->args_len != native_args_len(fn)) {
+        fprintf(stderr, "ERROR: native function '%s' expecting %d argument(s)\n", fn->name, native_args_len(fn));
+        exit(1);
+    }
+
+    for (int i = 0; i < funcall->args_len; i++) {
+        type_kind_t expr_type = typecheck_expr(funcall->args[i]);
+        type_kind_t param_type = get_type_from_signature(fn->signature[i]);
+
+        codegen_expr(pb, funcall->args[i]);
+
+        if (param_type != expr_type) {
+            fprintf(stderr, "ERROR: the %d argument of '%s' is expecting: %d type but got %d\n", i, fn->name, param_type, expr_type);
+            exit(1);
+        }
+    }
+
+    npb_callnative(pb, native, funcall->args_len);
+}
+
+static int is_constant(expr_t* expr, type_kind_t type, double value)
+{
+    constant_t constant;
+
+    if (!fold_constant(expr, &constant) || constant.type != type)
+        return 0;
+
+    return type == TYPE_BUILTIN_INT ? constant.i == value : constant.d == value;
+}
+
+// identities with a constant operand, doubles only get the exact ones since
+// e.g. -0.0 + 0.0 is 0.0.
+static int codegen_simplified(npb_t* pb, expr_binary_t* binary)
+{
+    type_kind_t type = typecheck_expr(binary->lhs);
+
+    if (type != typecheck_expr(binary->rhs))
+        return 0;
+
+    expr_t* lhs = binary->lhs;
+    expr_t* rhs = binary->rhs;
+    expr_t* same = NULL;
+    int zero = 0;
+
+    if (type == TYPE_BUILTIN_INT) {
+        switch (binary->op) {
+            case '+':
+            case '|':
+            case '^':
+                if (is_constant(rhs, type, 0)) {
+                    same = lhs;
+                } else if (is_constant(lhs, type, 0)) {
+                    same = rhs;
+                }
+                break;
+            case '-':
+            case 'L':
+            case 'R':
+                if (is_constant(rhs, type, 0))
+                    same = lhs;
+                break;
+            case '*':
+                if (is_constant(rhs, type, 1)) {
+                    same = lhs;
+                } else if (is_constant(lhs, type, 1)) {
+                    same = rhs;
+                } else if (is_constant(rhs, type, 0) && is_effect_free(lhs)) {
+                    zero = 1;
+                } else if (is_constant(lhs, type, 0) && is_effect_free(rhs)) {
+                    zero = 1;
+                }
+                break;
+            case '&':
+                if ((is_constant(rhs, type, 0) && is_effect_free(lhs)) || (is_constant(lhs, type, 0) && is_effect_free(rhs)))
+                    zero = 1;
+                break;
+            case '/':
+                if (is_constant(rhs, type, 1))
+                    same = lhs;
+                break;
+        }
+    } else if (type == TYPE_BUILTIN_DOUBLE) {
+        switch (binary->op) {
+            case '*':
+                if (is_constant(rhs, type, 1.0)) {
+                    same = lhs;
+                } else if (is_constant(lhs, type, 1.0)) {
+                    same = rhs;
+                }
+                break;
+            case '/':
+                if (is_constant(rhs, type, 1.0))
+                    same = lhs;
+                break;
+            case '-': {
+                constant_t constant;
+
+                if (fold_constant(rhs, &constant) && constant.type == type && constant.d == 0.0 && !signbit(constant.d))
+                    same = lhs;
+            } break;
+        }
+    }
+
+    if (zero) {
+        npb_ipush(pb, 0);
+        return 1;
+    }
+
+    if (same) {
+        codegen_expr(pb, same);
+        return 1;
+    }
+
+    return 0;
+}
+
+// constant subexpressions become a single push.
+static int codegen_folded(npb_t* pb, expr_t* expr)
+{
+    constant_t constant;
+
+    typecheck_expr(expr);
+
+    if (fold_constant(expr, &constant)) {
+        if (constant.type == TYPE_BUILTIN_INT) {
+            npb_ipush(pb, constant.i);
+        } else {
+            npb_dpush(pb, constant.d);
+        }
+
+        return 1;
+    }
+
+    if (expr->kind == EXPR_BINARY)
+        return codegen_simplified(pb, (expr_binary_t*)expr);
+
+    return 0;
+}
+
+static void patch_jump_address(npb_t* pb, int32_t offset, int32_t addr)
+{
+    uint8_t* unpatched_addr = pb->program + offset + 1;
+    memcpy(unpatched_addr, &addr, sizeof(addr));
+}
+
+// unpatched branches of a chain hold the address of the previous branch in
+// their operand, -1 ends the chain.
+static void chain_branch(npb_t* pb, int32_t* chain, int when)
+{
+    int32_t branch_addr = pb->program_len;
+
+    if (condition_branch == -1)
+        condition_branch = branch_addr;
+
+    if (when) {
+        npb_brit(pb, *chain);
+    } else {
+        npb_brif(pb, *chain);
+    }
+
+    *chain = branch_addr;
+}
+
+static void patch_chain(npb_t* pb, int32_t chain, int32_t addr)
+{
+    while (chain != -1) {
+        int32_t next;
+        memcpy(&next, pb->program + chain + 1, sizeof(next));
+
+        patch_jump_address(pb, chain, addr);
+        chain = next;
+    }
+}
+
+// emits a branch taken when `cond` evaluates to `when` and falls through
+// otherwise, the right operand of && and || is skipped once the result is
+// known.
+static void codegen_condition(npb_t* pb, expr_t* cond, int when, int32_t* chain)
+{
+    if (cond->kind == EXPR_UNARY && ((expr_unary_t*)cond)->op == '!') {
+        codegen_condition(pb, ((expr_unary_t*)cond)->operand, !when, chain);
+        return;
+    }
+
+    if (cond->kind == EXPR_BINARY) {
+        expr_binary_t* binary = (expr_binary_t*)cond;
+
+        // for && a false lhs decides the result, for || a true one.
+        if (binary->op == 'A' || binary->op == 'O') {
+            int decides = binary->op == 'O';
+
+            if (when == decides) {
+                codegen_condition(pb, binary->lhs, when, chain);
+                codegen_condition(pb, binary->rhs, when, chain);
+            } else {
+                int32_t skip_chain = -1;
+                codegen_condition(pb, binary->lhs, decides, &skip_chain);
+                codegen_condition(pb, binary->rhs, when, chain);
+                patch_chain(pb, skip_chain, pb->program_len);
+            }
+
+            return;
+        }
+    }
+
+    type_kind_t type = typecheck_expr(cond);
+    if (type != TYPE_BUILTIN_INT) {
+        fprintf(stderr, "ERROR: expected int for condition, but got type %d\n", type);
+        exit(1);
+    }
+
+    codegen_expr(pb, cond);
+    chain_branch(pb, chain, when);
+}
+
+void codegen_expr(npb_t* pb, expr_t* expr)
+{
+    assert(initialized);
+
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER: {
+            expr_ident_t* ident = (expr_ident_t*)expr;
+
+            int param = inline_param(ident->ident);
+            if (param != -1) {
+                inline_env_t* env = inline_env;
+
+                inline_env = env->parent;
+                codegen_expr(pb, env->args[param]);
+                inline_env = env;
+
+                break;
+            }
+
+            int index = locals_lookup(ident->ident);
+
+            if (locals[index].is_fun_args) {
+                npb_loadarg(pb, locals[index].sp_offset);
+            } else {
+                npb_dup(pb, locals[index].sp_offset);
+            }
+        } break;
+        case EXPR_NUMBER: {
+            expr_num_t* num = (expr_num_t*)expr;
+
+            if (num->kind == EXPR_NUM_INT) {
+                npb_ipush(pb, num->value.i);
+            } else {
+                npb_dpush(pb, num->value.d);
+            }
+        } break;
+        case EXPR_UNARY: {
+            if (codegen_folded(pb, expr))
+                break;
+
+            expr_unary_t* unary = (expr_unary_t*)expr;
+            type_kind_t type = typecheck_expr(unary->operand);
+            codegen_expr(pb, unary->operand);
+
+            switch (unary->op) {
+                case '!': {
+                    npb_ipush(pb, 0);
+                    npb_ieq(pb);
+                } break;
+                case '-': {
+                    switch (type) {
+                        case TYPE_BUILTIN_INT:
+                            npb_ipush(pb, -1);
+                            npb_imul(pb);
+                            break;
+                        case TYPE_BUILTIN_DOUBLE:
+                            npb_dpush(pb, -1.0);
+                            npb_dmul(pb);
+                            break;
+                        default:
+                            fprintf(stderr, "ERROR: unsupported type for unary op: '%c'\n", unary->op);
+                            exit(1);
+                    }
+                } break;
+                default:
+                    fprintf(stderr, "ERROR: unknown unary op: '%c'\n", unary->op);
+                    exit(1);
+            }
+        } break;
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+
+            if (codegen_folded(pb, expr))
+                break;
+
+            if (codegen_strength_reduced(pb, binary))
+                break;
+
+            // materialize && and || as 0 or 1 through the branch lowering.
+            if (binary->op == 'A' || binary->op == 'O') {
+                typecheck_expr(expr);
+
+                int32_t false_chain = -1;
+                codegen_condition(pb, expr, 0, &false_chain);
+
+                npb_ipush(pb, 1);
+                int32_t exit_patch_addr = pb->program_len;
+                npb_br(pb, -1);
+
+                patch_chain(pb, false_chain, pb->program_len);
+                npb_ipush(pb, 0);
+
+                patch_jump_address(pb, exit_patch_addr, pb->program_len);
+                break;
+            }
+
+            type_kind_t lhs_type = typecheck_expr(binary->lhs);
+            codegen_expr(pb, binary->lhs);
+
+            type_kind_t rhs_type = typecheck_expr(binary->rhs);
+            codegen_expr(pb, binary->rhs);
+
+            if (lhs_type != rhs_type) {
+                fprintf(stderr, "ERROR: mismatched type for binary op: '%c'\n", binary->op);
+                exit(1);
+            }
+
+            switch (binary->op) {
+                case '+': {
+                    switch (lhs_type) {
+                        case TYPE_BUILTIN_INT:    npb_iadd(pb); break;
+                        case TYPE_BUILTIN_DOUBLE: npb_dadd(pb); break;
+                        default:
+                            fprintf(stderr, "ERROR: unsupported type for binary op: '%c'\n", binary->op);
+                            exit(1);
+                    }
+                } break;
                 case '-': {
                     switch (lhs_type) {
                         case TYPE_BUILTIN_INT:    npb_isub(pb); break;
@@ -270,6 +2182,26 @@ void codegen_expr(npb_t* pb, expr_t* expr)
                             exit(1);
                     }
                 } break;
+                case '%':
+                case '&':
+                case '|':
+                case '^':
+                case 'L':
+                case 'R': {
+                    if (lhs_type != TYPE_BUILTIN_INT) {
+                        fprintf(stderr, "ERROR: unsupported type for binary op: '%c'\n", binary->op);
+                        exit(1);
+                    }
+
+                    switch (binary->op) {
+                        case '%': npb_imod(pb); break;
+                        case '&': npb_iand(pb); break;
+                        case '|': npb_ior(pb); break;
+                        case '^': npb_ixor(pb); break;
+                        case 'L': npb_ishl(pb); break;
+                        case 'R': npb_ishr(pb); break;
+                    }
+                } break;
                 case '=': {
                     switch (lhs_type) {
                         case TYPE_BUILTIN_INT:    npb_ieq(pb); break;
@@ -288,181 +2220,1368 @@ void codegen_expr(npb_t* pb, expr_t* expr)
                             exit(1);
                     }
                 } break;
+                case '<':
+                case '>':
+                case 'l':
+                case 'g': {
+                    if (lhs_type != TYPE_BUILTIN_INT && lhs_type != TYPE_BUILTIN_DOUBLE) {
+                        fprintf(stderr, "ERROR: unsupported type for binary op: '%c'\n", binary->op);
+                        exit(1);
+                    }
+
+                    int is_int = lhs_type == TYPE_BUILTIN_INT;
+
+                    switch (binary->op) {
+                        case '<': is_int ? npb_ilt(pb) : npb_dlt(pb); break;
+                        case '>': is_int ? npb_igt(pb) : npb_dgt(pb); break;
+                        case 'l': is_int ? npb_ilte(pb) : npb_dlte(pb); break;
+                        case 'g': is_int ? npb_igte(pb) : npb_dgte(pb); break;
+                    }
+                } break;
                 default: {
                     fprintf(stderr, "ERROR: unknown binary op: '%c'\n", binary->op);
                     exit(1);
                 }
             }
         } break;
-        case EXPR_FUNCALL: {
-            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+
+            if (is_builtin(funcall->name, "print")) {
+                if (funcall->args_len != 1) {
+                    fprintf(stderr, "ERROR: builtin function 'print' requires 1 argument\n");
+                    exit(1);
+                }
+
+                if (is_array_type(typecheck_expr(funcall->args[0]))) {
+                    fprintf(stderr, "ERROR: builtin function 'print' does not take arrays\n");
+                    exit(1);
+                }
+
+                codegen_expr(pb, funcall->args[0]);
+                npb_print(pb);
+
+                return;
+            }
+
+            if (is_builtin(funcall->name, "len")) {
+                typecheck_expr(expr);
+
+                codegen_expr(pb, funcall->args[0]);
+                npb_alen(pb);
+
+                return;
+            }
+
+            if (is_builtin(funcall->name, "spawn")) {
+                typecheck_expr(expr);
+
+                expr_funcall_t* entry = (expr_funcall_t*)funcall->args[0];
+                int index = codegen_call_args(pb, entry);
+
+                codegen_spawn(pb, index, entry->args_len);
+
+                return;
+            }
+
+            if (is_builtin(funcall->name, "yield")) {
+                typecheck_expr(expr);
+                npb_yield(pb);
+
+                return;
+            }
+
+            if (is_builtin(funcall->name, "resume")) {
+                typecheck_expr(expr);
+
+                codegen_expr(pb, funcall->args[0]);
+                npb_resume(pb);
+
+                return;
+            }
+
+            if (is_intrinsic(funcall->name)) {
+                const intrinsic_t* intrinsic = intrinsics_resolve(funcall);
+
+                for (int i = 0; i < funcall->args_len; i++)
+                    codegen_expr(pb, funcall->args[i]);
+
+                intrinsic->emit(pb);
+
+                return;
+            }
+
+            if (functions_lookup(funcall->name) == -1) {
+                int native = natives_lookup(funcall->name);
+
+                if (native != -1) {
+                    codegen_native_call(pb, funcall, native);
+                    return;
+                }
+            }
+
+            if (codegen_consteval(pb, funcall))
+                break;
+
+            if (codegen_inline_call(pb, funcall))
+                break;
+
+            int index = codegen_call_args(pb, funcall);
+            codegen_call(pb, index, funcall->args_len);
+        } break;
+        case EXPR_NEWARRAY: {
+            expr_newarray_t* newarray = (expr_newarray_t*)expr;
+            type_kind_t type = typecheck_expr(expr);
+
+            codegen_expr(pb, newarray->len);
+            npb_anew(pb, type == TYPE_ARRAY_DOUBLE ? VAL_DOUBLE : VAL_INT);
+        } break;
+        case EXPR_INDEX: {
+            expr_index_t* index = (expr_index_t*)expr;
+            typecheck_expr(expr);
+
+            codegen_expr(pb, index->array);
+            codegen_expr(pb, index->index);
+
+            if (index_in_bounds(index->array, index->index)) {
+                npb_aloadu(pb);
+            } else {
+                npb_aload(pb);
+            }
+        } break;
+    }
+}
+
+static int block_terminates(block_t* block);
+
+// the block a match on a constant subject runs.
+static block_t* match_live_block(stmt_match_t* smatch, int32_t subject)
+{
+    for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+        for (int i = 0; i < arm->values_len; i++) {
+            int32_t value;
+
+            if (int_constant(arm->values[i], &value) && value == subject)
+                return arm->body;
+        }
+    }
+
+    return smatch->otherwise;
+}
+
+// whether control never continues past the statement.
+static int stmt_terminates(stmt_t* stmt)
+{
+    switch (stmt->kind) {
+        case STMT_RETURN:
+            return 1;
+        case STMT_IF: {
+            stmt_if_t* sif = (stmt_if_t*)stmt;
+            int32_t condition;
+
+            if (int_constant(sif->condition, &condition))
+                return block_terminates(condition ? sif->true : sif->false);
+
+            return block_terminates(sif->true) && block_terminates(sif->false);
+        }
+        case STMT_MATCH: {
+            stmt_match_t* smatch = (stmt_match_t*)stmt;
+            int32_t subject;
+
+            if (int_constant(smatch->subject, &subject))
+                return block_terminates(match_live_block(smatch, subject));
+
+            if (!block_terminates(smatch->otherwise))
+                return 0;
+
+            for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+                if (!block_terminates(arm->body))
+                    return 0;
+            }
+
+            return 1;
+        }
+        case STMT_WHILE: {
+            int32_t condition;
+            return int_constant(((stmt_while_t*)stmt)->condition, &condition) && condition;
+        }
+        default:
+            return 0;
+    }
+}
+
+static int block_terminates(block_t* block)
+{
+    for (; block; block = block->next) {
+        if (stmt_terminates(block->stmt))
+            return 1;
+    }
+
+    return 0;
+}
+
+// the statement before the one being compiled in its block, NULL for the first.
+static stmt_t* previous_stmt = NULL;
+
+// whether `stmt` leaves a non-negative value in `ident`.
+static int sets_nonnegative(stmt_t* stmt, token_t ident)
+{
+    if (!stmt)
+        return 0;
+
+    if (stmt->kind == STMT_VARDECL) {
+        stmt_vardecl_t* vardecl = (stmt_vardecl_t*)stmt;
+        return vardecl->ident.length == ident.length && strncmp(vardecl->ident.start, ident.start, ident.length) == 0 && is_nonnegative(vardecl->expr);
+    }
+
+    if (stmt->kind == STMT_VARASSIGN) {
+        stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
+        return !assign->index && assign->ident.length == ident.length && strncmp(assign->ident.start, ident.start, ident.length) == 0 && is_nonnegative(assign->expr);
+    }
+
+    return 0;
+}
+
+// a counter set to a non-negative value right before the loop, compared with
+// `<` against a constant or an array length and incremented at most once per
+// iteration stays in range until the body increments it, so the bounds checks
+// it indexes with in between are dropped.
+static void push_loop_ranges(expr_t* condition, block_t* body, stmt_t* previous)
+{
+    if (condition->kind != EXPR_BINARY)
+        return;
+
+    expr_binary_t* binary = (expr_binary_t*)condition;
+
+    if (binary->op == 'A') {
+        push_loop_ranges(binary->lhs, body, previous);
+        push_loop_ranges(binary->rhs, body, previous);
+        return;
+    }
+
+    if (binary->op != '<' || binary->lhs->kind != EXPR_IDENTIFIER || loop_ranges_len >= SYMTABLE_CAP)
+        return;
+
+    token_t ident = ((expr_ident_t*)binary->lhs)->ident;
+    int counter = locals_lookup(ident);
+    int count = increments(body, ident);
+
+    if (counter == -1 || count == -1 || count > 1 || !sets_nonnegative(previous, ident))
+        return;
+
+    loop_range_t range = { .counter = counter, .array = -1, .bound = 0 };
+
+    if (!int_constant(binary->rhs, &range.bound)) {
+        expr_funcall_t* funcall = (expr_funcall_t*)binary->rhs;
+
+        if (binary->rhs->kind != EXPR_FUNCALL || !is_builtin(funcall->name, "len") || funcall->args_len != 1)
+            return;
+
+        if (funcall->args[0]->kind != EXPR_IDENTIFIER)
+            return;
+
+        token_t array = ((expr_ident_t*)funcall->args[0])->ident;
+        range.array = locals_lookup(array);
+
+        if (range.array == -1 || is_reassigned(body, array))
+            return;
+    }
+
+    loop_ranges[loop_ranges_len++] = range;
+}
+
+// a loop body that assigns a counter ends the range of the loops around it.
+static void end_loop_ranges(block_t* body)
+{
+    for (int i = 0; i < loop_ranges_len; i++) {
+        if (loop_ranges[i].counter != -1 && is_reassigned(body, locals[loop_ranges[i].counter].token))
+            loop_ranges[i].counter = -1;
+    }
+}
+
+static void codegen_scoped_block(npb_t* pb, block_t* block, topdecl_fun_t* fun);
+
+// unreachable code is still compiled, for its type errors, but into a
+// throwaway copy of the program so constant calls still find their callees.
+static void codegen_dead_block(npb_t* pb, block_t* block, topdecl_fun_t* fun)
+{
+    npb_t scratch = {
+        .program = malloc(pb->program_cap),
+        .program_len = pb->program_len,
+        .program_cap = pb->program_cap,
+    };
+
+    memcpy(scratch.program, pb->program, pb->program_len);
+
+    codegen_scoped_block(&scratch, block, fun);
+
+    npb_free(&scratch);
+}
+
+static void codegen_block(npb_t* pb, block_t* block, topdecl_fun_t* fun)
+{
+    for (stmt_t* previous = NULL; block; previous = block->stmt, block = block->next) {
+        previous_stmt = previous;
+        codegen_stmt(pb, block->stmt, fun);
+
+        if (stmt_terminates(block->stmt)) {
+            codegen_dead_block(pb, block->next, fun);
+            return;
+        }
+    }
+}
+
+// locals declared inside a nested block go out of scope, and off the stack,
+// when it ends.
+static void codegen_scoped_block(npb_t* pb, block_t* block, topdecl_fun_t* fun)
+{
+    int current_locals_len = locals_len;
+    int current_sp_offset = sp_offset;
+
+    codegen_block(pb, block, fun);
+
+    if (!block_terminates(block)) {
+        for (int i = current_sp_offset; i < sp_offset; i++)
+            npb_pop(pb);
+    }
+
+    locals_len = current_locals_len;
+    sp_offset = current_sp_offset;
+}
+
+static void patch_int32(npb_t* pb, int32_t offset, int32_t value)
+{
+    memcpy(pb->program + offset, &value, sizeof(value));
+}
+
+typedef struct {
+    int32_t key;
+    int32_t addr;
+} match_case_t;
+
+static int match_case_compare(const void* a, const void* b)
+{
+    int32_t lhs = ((const match_case_t*)a)->key;
+    int32_t rhs = ((const match_case_t*)b)->key;
+
+    return (lhs > rhs) - (lhs < rhs);
+}
+
+// dense cases become a TABLESWITCH indexed by the value, sparse ones a
+// LOOKUPSWITCH that binary searches the sorted keys.
+static void codegen_match(npb_t* pb, stmt_match_t* smatch, topdecl_fun_t* fun)
+{
+    type_kind_t subject_type = typecheck_expr(smatch->subject);
+    if (subject_type != TYPE_BUILTIN_INT) {
+        fprintf(stderr, "ERROR: expected int for match subject, but got type %d\n", subject_type);
+        exit(1);
+    }
+
+    int cases_len = 0;
+    for (match_arm_t* arm = smatch->arms; arm; arm = arm->next)
+        cases_len += arm->values_len;
+
+    // the arm index is kept in `addr` until the arms are emitted.
+    match_case_t* cases = malloc(sizeof(*cases) * (cases_len ? cases_len : 1));
+    int arms_len = 0;
+    cases_len = 0;
+
+    for (match_arm_t* arm = smatch->arms; arm; arm = arm->next, arms_len++) {
+        for (int i = 0; i < arm->values_len; i++) {
+            if (!int_constant(arm->values[i], &cases[cases_len].key)) {
+                fprintf(stderr, "ERROR: case values must be int constants\n");
+                exit(1);
+            }
+
+            cases[cases_len++].addr = arms_len;
+        }
+    }
+
+    qsort(cases, cases_len, sizeof(*cases), match_case_compare);
+
+    for (int i = 1; i < cases_len; i++) {
+        if (cases[i].key == cases[i - 1].key) {
+            fprintf(stderr, "ERROR: duplicate case value %d\n", cases[i].key);
+            exit(1);
+        }
+    }
+
+    int32_t subject;
+
+    if (int_constant(smatch->subject, &subject)) {
+        block_t* live = match_live_block(smatch, subject);
+
+        for (match_arm_t* arm = smatch->arms; arm; arm = arm->next) {
+            if (arm->body != live)
+                codegen_dead_block(pb, arm->body, fun);
+        }
+
+        if (smatch->otherwise != live)
+            codegen_dead_block(pb, smatch->otherwise, fun);
+
+        codegen_scoped_block(pb, live, fun);
+
+        free(cases);
+        return;
+    }
+
+    int64_t range = cases_len ? (int64_t)cases[cases_len - 1].key - cases[0].key + 1 : 0;
+    int dense = cases_len > 0 && range <= 2 * (int64_t)cases_len;
+
+    codegen_expr(pb, smatch->subject);
+
+    int32_t switch_addr = pb->program_len;
+    int32_t default_offset;
+
+    if (dense) {
+        int32_t* addrs = malloc(sizeof(*addrs) * range);
+        for (int64_t i = 0; i < range; i++)
+            addrs[i] = -1;
+
+        npb_tableswitch(pb, cases[0].key, range, -1, addrs);
+        default_offset = switch_addr + 1 + sizeof(int32_t) * 2;
+
+        free(addrs);
+    } else {
+        int32_t* keys = malloc(sizeof(*keys) * (cases_len ? cases_len : 1));
+        for (int i = 0; i < cases_len; i++)
+            keys[i] = cases[i].key;
+
+        npb_lookupswitch(pb, cases_len, -1, keys, keys);
+        default_offset = switch_addr + 1 + sizeof(int32_t);
+
+        free(keys);
+    }
+
+    int32_t* arm_addrs = malloc(sizeof(*arm_addrs) * (arms_len ? arms_len : 1));
+    int32_t* exit_patch_addrs = malloc(sizeof(*exit_patch_addrs) * (arms_len ? arms_len : 1));
+    int exit_patches_len = 0;
+
+    int index = 0;
+    for (match_arm_t* arm = smatch->arms; arm; arm = arm->next, index++) {
+        arm_addrs[index] = pb->program_len;
+
+        codegen_scoped_block(pb, arm->body, fun);
+
+        // the last arm falls through to the exit when there's no else.
+        if ((arm->next || smatch->otherwise) && !block_terminates(arm->body)) {
+            exit_patch_addrs[exit_patches_len++] = pb->program_len;
+            npb_br(pb, -1);
+        }
+    }
+
+    int32_t default_addr = pb->program_len;
+
+    codegen_scoped_block(pb, smatch->otherwise, fun);
+
+    int32_t exit_addr = pb->program_len;
+
+    if (!smatch->otherwise)
+        default_addr = exit_addr;
+
+    for (int i = 0; i < exit_patches_len; i++)
+        patch_jump_address(pb, exit_patch_addrs[i], exit_addr);
+
+    patch_int32(pb, default_offset, default_addr);
+
+    for (int i = 0; i < cases_len; i++) {
+        int32_t addr = arm_addrs[cases[i].addr];
+
+        if (dense) {
+            int32_t slot = cases[i].key - cases[0].key;
+            patch_int32(pb, default_offset + sizeof(int32_t) * (1 + slot), addr);
+        } else {
+            patch_int32(pb, default_offset + sizeof(int32_t) * (2 + 2 * i), addr);
+        }
+    }
+
+    if (dense) {
+        for (int64_t slot = 0; slot < range; slot++) {
+            int32_t at = default_offset + sizeof(int32_t) * (1 + slot);
+            int32_t addr;
+            memcpy(&addr, pb->program + at, sizeof(addr));
+
+            if (addr == -1)
+                patch_int32(pb, at, default_addr);
+        }
+    }
+
+    free(exit_patch_addrs);
+    free(arm_addrs);
+    free(cases);
+}
+
+void codegen_stmt(npb_t* pb, stmt_t* stmt, topdecl_fun_t* fun)
+{
+    assert(initialized);
+
+    switch (stmt->kind) {
+        case STMT_VARDECL: {
+            stmt_vardecl_t* vardecl = (stmt_vardecl_t*)stmt;
+
+            if (locals_lookup(vardecl->ident) != -1) {
+                fprintf(stderr, "ERROR: variable '%.*s' already exist\n", vardecl->ident.length, vardecl->ident.start);
+                exit(1);
+            }
+
+            type_kind_t variable_type = get_type_from_token(vardecl->type);
+            if (variable_type == TYPE_BUILTIN_VOID) {
+                fprintf(stderr, "ERROR: void is not a valid variable type\n");
+                exit(1);
+            }
+
+            type_kind_t expr_type = typecheck_expr(vardecl->expr);
+
+            if (expr_type != variable_type) {
+                fprintf(stderr, "ERROR: variable declared as %d but the expression type is %d\n", variable_type, expr_type);
+                exit(1);
+            }
+
+            int32_t array_len = -1;
+
+            if (vardecl->expr->kind == EXPR_NEWARRAY && !is_reassigned(fun->funbody, vardecl->ident)) {
+                if (!int_constant(((expr_newarray_t*)vardecl->expr)->len, &array_len))
+                    array_len = -1;
+            }
+
+            locals[locals_len++] = (symbol_t) {
+                .token = vardecl->ident,
+                .type = get_type_from_token(vardecl->type),
+                .is_fun_args = 0,
+                .sp_offset = ++sp_offset,
+                .array_len = array_len,
+            };
+
+            codegen_expr(pb, vardecl->expr);
+        } break;
+        case STMT_EXPR: {
+            stmt_expr_t* expr = (stmt_expr_t*)stmt;
+
+            codegen_expr(pb, expr->expr);
+
+            // discard unused results so they don't pile up inside loops.
+            if (typecheck_expr(expr->expr) != TYPE_BUILTIN_VOID)
+                npb_pop(pb);
+        } break;
+        case STMT_RETURN: {
+            assert(fun);
+
+            stmt_return_t* ret = (stmt_return_t*)stmt;
+
+            if (ret->expr) {
+                type_kind_t expr_type = typecheck_expr(ret->expr);
+                type_kind_t function_type = get_type_from_token(fun->type);
+
+                if (function_type  != expr_type) {
+                    fprintf(stderr, "ERROR: return type mismatched, expected %d but got %d\n", function_type, expr_type);
+                    exit(1);
+                }
+
+                if (accumulator_op) {
+                    expr_funcall_t* call;
+                    expr_t* operand;
+                    char op;
+
+                    if (split_self_call(ret->expr, fun, &call, &operand, &op)) {
+                        // fold the pending operand in, rebind the arguments and
+                        // drop the locals before looping back.
+                        if (operand) {
+                            npb_dup(pb, 0);
+                            codegen_expr(pb, operand);
+                            codegen_accumulate(pb);
+                            npb_set(pb, 0);
+                        }
+
+                        codegen_call_args(pb, call);
+
+                        for (int i = call->args_len - 1; i >= 0; i--)
+                            npb_setarg(pb, i);
+
+                        for (int i = 0; i < sp_offset; i++)
+                            npb_pop(pb);
+
+                        npb_br(pb, accumulator_loop);
+                        break;
+                    }
+
+                    npb_dup(pb, 0);
+                    codegen_expr(pb, ret->expr);
+                    codegen_accumulate(pb);
+                    npb_ret(pb);
+                    break;
+                }
+
+                codegen_expr(pb, ret->expr);
+
+                if (memo_index != -1) {
+                    npb_memoret(pb, memo_index);
+                    break;
+                }
+            } else {
+                if (is_main(fun->name)) {
+                    npb_halt(pb);
+                } else {
+                    npb_retvoid(pb);
+                }
+
+                break;
+            }
+
+            if (is_main(fun->name)) {
+                npb_halt(pb);
+            } else {
+                npb_ret(pb);
+            }
+        } break;
+        case STMT_VARASSIGN: {
+            stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
 
-            if (strncmp(funcall->name.start, "print", funcall->name.length) == 0) {
-                if (funcall->args_len != 1) {
-                    fprintf(stderr, "ERROR: builtin function 'print' requires 1 argument\n");
+            int index = locals_lookup(assign->ident);
+            if (index == -1) {
+                fprintf(stderr, "ERROR: variable '%.*s' does not exist\n", assign->ident.length, assign->ident.start);
+                exit(1);
+            }
+
+            if (assign->index) {
+                type_kind_t array_type = locals[index].type;
+
+                if (!is_array_type(array_type)) {
+                    fprintf(stderr, "ERROR: variable '%.*s' is not an array\n", assign->ident.length, assign->ident.start);
                     exit(1);
                 }
 
-                codegen_expr(pb, funcall->args[0]);
-                npb_print(pb);
+                if (typecheck_expr(assign->index) != TYPE_BUILTIN_INT) {
+                    fprintf(stderr, "ERROR: array index must be an int\n");
+                    exit(1);
+                }
 
-                return;
+                if (typecheck_expr(assign->expr) != element_type(array_type)) {
+                    fprintf(stderr, "ERROR: mismatched type for array element assignment\n");
+                    exit(1);
+                }
+
+                expr_ident_t array = { .__header = { .kind = EXPR_IDENTIFIER }, .ident = assign->ident };
+
+                codegen_expr(pb, (expr_t*)&array);
+                codegen_expr(pb, assign->index);
+                codegen_expr(pb, assign->expr);
+
+                if (index_in_bounds((expr_t*)&array, assign->index)) {
+                    npb_astoreu(pb);
+                } else {
+                    npb_astore(pb);
+                }
+
+                break;
             }
 
-            int index = functions_lookup(funcall->name);
-            if (index == -1) {
-                fprintf(stderr, "ERROR: there's no such function '%.*s'\n", funcall->name.length, funcall->name.start);
+            codegen_expr(pb, assign->expr);
+
+            for (int i = 0; i < loop_ranges_len; i++) {
+                if (loop_ranges[i].counter == index)
+                    loop_ranges[i].counter = -1;
+            }
+
+            if (locals[index].is_fun_args) {
+                npb_setarg(pb, locals[index].sp_offset);
+            } else {
+                npb_set(pb, locals[index].sp_offset);
+            }
+        } break;
+        case STMT_IF: {
+            stmt_if_t* sif = (stmt_if_t*)stmt;
+
+            type_kind_t expr_type = typecheck_expr(sif->condition);
+            if (expr_type != TYPE_BUILTIN_INT) {
+                fprintf(stderr, "ERROR: expected int for conditional if statement, but got type %d\n", expr_type);
                 exit(1);
             }
 
-            function_t function = functions[index];
-            if (funcall->args_len != function.fun->args_len) {
-                fprintf(stderr, "ERROR: function '%.*s' expecting %d argument(s)\n", function.fun->name.length, function.fun->name.start, function.fun->args_len);
+            int32_t condition;
+
+            if (int_constant(sif->condition, &condition)) {
+                codegen_scoped_block(pb, condition ? sif->true : sif->false, fun);
+                codegen_dead_block(pb, condition ? sif->false : sif->true, fun);
+                break;
+            }
+
+            // the else arm falls through when it's the likely one.
+            if (else_is_likely(sif, fun)) {
+                int32_t true_chain = -1;
+                codegen_condition(pb, sif->condition, 1, &true_chain);
+
+                codegen_scoped_block(pb, sif->false, fun);
+
+                int32_t false_exit_patch_addr = -1;
+
+                if (!block_terminates(sif->false)) {
+                    false_exit_patch_addr = pb->program_len;
+                    npb_br(pb, -1);
+                }
+
+                patch_chain(pb, true_chain, pb->program_len);
+                codegen_scoped_block(pb, sif->true, fun);
+
+                if (false_exit_patch_addr != -1)
+                    patch_jump_address(pb, false_exit_patch_addr, pb->program_len);
+
+                break;
+            }
+
+            int32_t false_chain = -1;
+
+            condition_branch = -1;
+            codegen_condition(pb, sif->condition, 0, &false_chain);
+            record_site(pb, SITE_TESTS, fun->name, sif->site, condition_branch);
+
+            for (int32_t branch = false_chain; branch != -1;) {
+                record_site(pb, SITE_SKIPS, fun->name, sif->site, branch);
+                memcpy(&branch, pb->program + branch + 1, sizeof(branch));
+            }
+
+            codegen_scoped_block(pb, sif->true, fun);
+
+            if (sif->false) {
+                int32_t true_exit_patch_addr = -1;
+
+                if (!block_terminates(sif->true)) {
+                    true_exit_patch_addr = pb->program_len;
+                    npb_br(pb, -1);
+                }
+
+                patch_chain(pb, false_chain, pb->program_len);
+                codegen_scoped_block(pb, sif->false, fun);
+
+                if (true_exit_patch_addr != -1)
+                    patch_jump_address(pb, true_exit_patch_addr, pb->program_len);
+            } else {
+                patch_chain(pb, false_chain, pb->program_len);
+            }
+        } break;
+        case STMT_MATCH: {
+            codegen_match(pb, (stmt_match_t*)stmt, fun);
+        } break;
+        case STMT_WHILE: {
+            stmt_while_t* swhile = (stmt_while_t*)stmt;
+            stmt_t* previous = previous_stmt;
+
+            end_loop_ranges(swhile->body);
+
+            type_kind_t expr_type = typecheck_expr(swhile->condition);
+            if (expr_type != TYPE_BUILTIN_INT) {
+                fprintf(stderr, "ERROR: expected int for conditional while statement, but got type %d\n", expr_type);
                 exit(1);
             }
 
-            for (int i = 0; i < funcall->args_len; i++) {
-                type_kind_t expr_type = typecheck_expr(funcall->args[i]);
-                type_kind_t param_type = get_type_from_token(functions[index].fun->args[i].type);
+            int32_t condition;
+
+            if (int_constant(swhile->condition, &condition)) {
+                if (!condition) {
+                    codegen_dead_block(pb, swhile->body, fun);
+                    break;
+                }
+
+                int32_t body = pb->program_len;
+                codegen_scoped_block(pb, swhile->body, fun);
+
+                if (!block_terminates(swhile->body))
+                    npb_br(pb, body);
+
+                break;
+            }
+
+            // the condition sits at the bottom so each iteration takes a
+            // single conditional branch.
+            int32_t condition_patch_addr = pb->program_len;
+            npb_br(pb, -1);
+
+            int32_t body = pb->program_len;
+            int ranges_len = loop_ranges_len;
+
+            push_loop_ranges(swhile->condition, swhile->body, previous);
+            codegen_scoped_block(pb, swhile->body, fun);
+
+            loop_ranges_len = ranges_len;
+
+            patch_jump_address(pb, condition_patch_addr, pb->program_len);
+
+            int32_t true_chain = -1;
+            codegen_condition(pb, swhile->condition, 1, &true_chain);
+            patch_chain(pb, true_chain, body);
+        } break;
+    }
+}
+
+// set by --ssa, functions are built into the ssa ir and optimized there.
+static int ssa_enabled = 0;
+
+static ir_fun_t ssa_fun;
+static npb_t* ssa_pb = NULL;
+
+// block being built, -1 once the code can't be reached.
+static int32_t ssa_block = -1;
+
+typedef struct {
+    token_t name;
+    int32_t var;
+} ssa_var_t;
+
+static ssa_var_t ssa_vars[SYMTABLE_CAP];
+static int ssa_vars_len = 0;
+
+// parameters of an inlined function are bound to the values of the
+// arguments, evaluated once before the body like a call would.
+typedef struct {
+    topdecl_fun_t* fun;
+    int32_t* args;
+} ssa_inline_t;
+
+static ssa_inline_t* ssa_inline = NULL;
+
+void codegen_set_ssa(int enabled)
+{
+    ssa_enabled = enabled;
+}
+
+static ir_type_t ssa_type(type_kind_t type)
+{
+    switch (type) {
+        case TYPE_BUILTIN_INT:    return IR_INT;
+        case TYPE_BUILTIN_DOUBLE: return IR_DOUBLE;
+        default:                  return IR_VOID;
+    }
+}
+
+static int32_t ssa_var_lookup(token_t ident)
+{
+    for (int i = ssa_vars_len - 1; i >= 0; i--) {
+        if (ident.length == ssa_vars[i].name.length && strncmp(ident.start, ssa_vars[i].name.start, ident.length) == 0)
+            return ssa_vars[i].var;
+    }
+
+    return -1;
+}
+
+static int32_t ssa_expr(expr_t* expr);
+static int ssa_condition(expr_t* cond, int32_t true_block, int32_t false_block);
+
+// the building functions return -1, or 0 for statements, on anything the ir
+// doesn't cover.
+static int32_t ssa_logical(expr_t* expr)
+{
+    int32_t var = ir_var_new(&ssa_fun, IR_INT);
+    int32_t true_block = ir_block_new(&ssa_fun);
+    int32_t false_block = ir_block_new(&ssa_fun);
+    int32_t join = ir_block_new(&ssa_fun);
+
+    if (!ssa_condition(expr, true_block, false_block))
+        return -1;
+
+    ir_block_seal(&ssa_fun, true_block);
+    ir_block_seal(&ssa_fun, false_block);
+
+    ir_block_place(&ssa_fun, true_block);
+    ir_var_write(&ssa_fun, var, true_block, ir_const_int(&ssa_fun, true_block, 1));
+    ir_br(&ssa_fun, true_block, join);
+
+    ir_block_place(&ssa_fun, false_block);
+    ir_var_write(&ssa_fun, var, false_block, ir_const_int(&ssa_fun, false_block, 0));
+    ir_br(&ssa_fun, false_block, join);
+
+    ir_block_seal(&ssa_fun, join);
+    ir_block_place(&ssa_fun, join);
+    ssa_block = join;
+
+    return ir_var_read(&ssa_fun, var, join);
+}
+
+static int32_t ssa_call(expr_funcall_t* funcall)
+{
+    int32_t args[10];
+
+    if (is_builtin(funcall->name, "len") || is_builtin(funcall->name, "spawn") || is_builtin(funcall->name, "yield") || is_builtin(funcall->name, "resume"))
+        return -1;
+
+    for (int i = 0; i < funcall->args_len; i++) {
+        args[i] = ssa_expr(funcall->args[i]);
+
+        if (args[i] == -1 || ssa_fun.values[args[i]].type == IR_VOID)
+            return -1;
+    }
+
+    if (is_builtin(funcall->name, "print"))
+        return ir_print(&ssa_fun, ssa_block, args[0]);
+
+    if (is_intrinsic(funcall->name)) {
+        ir_type_t args_type = funcall->args_len > 0 ? ssa_fun.values[args[0]].type : IR_VOID;
+
+        for (int i = 0; i < intrinsics_len; i++) {
+            const intrinsic_t* intrinsic = &intrinsics[i];
+
+            if (is_builtin(funcall->name, intrinsic->name) && ssa_type(intrinsic->args_type) == args_type)
+                return ir_intrinsic(&ssa_fun, ssa_block, intrinsic->emit, ssa_type(intrinsic->type), args, funcall->args_len);
+        }
+
+        return -1;
+    }
+
+    int index = functions_lookup(funcall->name);
+    if (index == -1)
+        return -1;
+
+    topdecl_fun_t* fun = functions[index].fun;
+    type_kind_t type = get_type_from_token(fun->type);
+
+    if (is_array_type(type))
+        return -1;
+
+    value_t result;
+
+    if (consteval(ssa_pb, funcall, &result)) {
+        if (type == TYPE_BUILTIN_INT)
+            return ir_const_int(&ssa_fun, ssa_block, value_as_int(result));
+
+        return ir_const_double(&ssa_fun, ssa_block, value_as_double(result));
+    }
+
+    expr_t* body = inline_body(fun);
+
+    if (body && (fun->is_inline || expr_size(body) <= inline_limit(fun))) {
+        ssa_inline_t env = {
+            .fun = fun,
+            .args = args,
+        };
+
+        ssa_inline_t* parent = ssa_inline;
+
+        ssa_inline = &env;
+        int32_t value = ssa_expr(body);
+        ssa_inline = parent;
+
+        return value;
+    }
+
+    // the ir only calls compiled functions.
+    if (functions[index].ip == -1)
+        return -1;
+
+    return ir_call(&ssa_fun, ssa_block, functions[index].ip, ssa_type(type), functions[index].pure, args, funcall->args_len);
+}
+
+static int32_t ssa_expr(expr_t* expr)
+{
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER: {
+            token_t ident = ((expr_ident_t*)expr)->ident;
+
+            // an inlined body only sees its parameters.
+            if (ssa_inline) {
+                topdecl_fun_t* fun = ssa_inline->fun;
+
+                for (int i = 0; i < fun->args_len; i++) {
+                    if (ident.length == fun->args[i].arg.length && strncmp(ident.start, fun->args[i].arg.start, ident.length) == 0)
+                        return ssa_inline->args[i];
+                }
+
+                return -1;
+            }
+
+            int32_t var = ssa_var_lookup(ident);
+            if (var == -1)
+                return -1;
+
+            return ir_var_read(&ssa_fun, var, ssa_block);
+        }
+        case EXPR_NUMBER: {
+            expr_num_t* num = (expr_num_t*)expr;
+
+            if (num->kind == EXPR_NUM_INT)
+                return ir_const_int(&ssa_fun, ssa_block, num->value.i);
+
+            return ir_const_double(&ssa_fun, ssa_block, num->value.d);
+        }
+        case EXPR_UNARY: {
+            expr_unary_t* unary = (expr_unary_t*)expr;
+
+            int32_t operand = ssa_expr(unary->operand);
+            if (operand == -1)
+                return -1;
+
+            return ir_unary(&ssa_fun, ssa_block, unary->op, operand);
+        }
+        case EXPR_BINARY: {
+            expr_binary_t* binary = (expr_binary_t*)expr;
+
+            if (binary->op == 'A' || binary->op == 'O')
+                return ssa_logical(expr);
+
+            int32_t lhs = ssa_expr(binary->lhs);
+            if (lhs == -1)
+                return -1;
+
+            int32_t rhs = ssa_expr(binary->rhs);
+            if (rhs == -1)
+                return -1;
+
+            return ir_binary(&ssa_fun, ssa_block, binary->op, lhs, rhs);
+        }
+        case EXPR_FUNCALL:
+            return ssa_call((expr_funcall_t*)expr);
+        default:
+            return -1;
+    }
+}
+
+// ends the current block with a branch on `cond`, && and || only evaluate
+// their right operand in a block of its own.
+static int ssa_condition(expr_t* cond, int32_t true_block, int32_t false_block)
+{
+    if (cond->kind == EXPR_UNARY && ((expr_unary_t*)cond)->op == '!')
+        return ssa_condition(((expr_unary_t*)cond)->operand, false_block, true_block);
+
+    if (cond->kind == EXPR_BINARY) {
+        expr_binary_t* binary = (expr_binary_t*)cond;
+
+        if (binary->op == 'A' || binary->op == 'O') {
+            int32_t rhs_block = ir_block_new(&ssa_fun);
+            int built = binary->op == 'A'
+                ? ssa_condition(binary->lhs, rhs_block, false_block)
+                : ssa_condition(binary->lhs, true_block, rhs_block);
 
-                codegen_expr(pb, funcall->args[i]);
+            if (!built)
+                return 0;
 
-                if (param_type != expr_type) {
-                    topdecl_fun_t* fun = functions[index].fun;
-                    fprintf(stderr, "ERROR: the %d argument of '%.*s' is expecting: %d type but got %d\n", i, fun->name.length, fun->name.start, param_type, expr_type);
-                    exit(1);
-                }
-            }
+            ir_block_seal(&ssa_fun, rhs_block);
+            ir_block_place(&ssa_fun, rhs_block);
+            ssa_block = rhs_block;
 
-            npb_call(pb, function.ip, funcall->args_len);
-        } break;
+            return ssa_condition(binary->rhs, true_block, false_block);
+        }
     }
-}
 
-static void codegen_block(npb_t* pb, block_t* block, topdecl_fun_t* fun)
-{
-    if (!block)
-        return;
+    int32_t value = ssa_expr(cond);
+    if (value == -1)
+        return 0;
 
-    codegen_stmt(pb, block->stmt, fun);
-    codegen_block(pb, block->next, fun);
+    ir_condbr(&ssa_fun, ssa_block, value, true_block, false_block);
+    ssa_block = -1;
+
+    return 1;
 }
 
-static void patch_jump_address(npb_t* pb, int32_t offset, int32_t addr)
+// continues in `block` if anything branches to it.
+static void ssa_continue(int32_t block)
 {
-    uint8_t* unpatched_addr = pb->program + offset + 1;
-    memcpy(unpatched_addr, &addr, sizeof(addr));
+    ir_block_seal(&ssa_fun, block);
+    ssa_block = -1;
+
+    if (ssa_fun.blocks[block].preds_len > 0) {
+        ir_block_place(&ssa_fun, block);
+        ssa_block = block;
+    }
 }
 
-void codegen_stmt(npb_t* pb, stmt_t* stmt, topdecl_fun_t* fun)
-{
-    assert(initialized);
+static int ssa_scoped_block(block_t* block, topdecl_fun_t* fun);
 
+static int ssa_stmt(stmt_t* stmt, topdecl_fun_t* fun)
+{
     switch (stmt->kind) {
         case STMT_VARDECL: {
             stmt_vardecl_t* vardecl = (stmt_vardecl_t*)stmt;
 
-            if (locals_lookup(vardecl->ident) != -1) {
-                fprintf(stderr, "ERROR: variable '%.*s' already exist\n", vardecl->ident.length, vardecl->ident.start);
-                exit(1);
-            }
-
-            type_kind_t variable_type = get_type_from_token(vardecl->type);
-            if (variable_type == TYPE_BUILTIN_VOID) {
-                fprintf(stderr, "ERROR: void is not a valid variable type\n");
-                exit(1);
-            }
+            ir_type_t type = ssa_type(get_type_from_token(vardecl->type));
+            if (type == IR_VOID)
+                return 0;
 
-            type_kind_t expr_type = typecheck_expr(vardecl->expr);
+            int32_t value = ssa_expr(vardecl->expr);
+            if (value == -1)
+                return 0;
 
-            if (expr_type != variable_type) {
-                fprintf(stderr, "ERROR: variable declared as %d but the expression type is %d\n", variable_type, expr_type);
-                exit(1);
-            }
+            int32_t var = ir_var_new(&ssa_fun, type);
+            ir_var_write(&ssa_fun, var, ssa_block, value);
 
-            locals[locals_len++] = (symbol_t) {
-                .token = vardecl->ident,
-                .type = get_type_from_token(vardecl->type),
-                .is_fun_args = 0,
-                .sp_offset = ++sp_offset,
+            ssa_vars[ssa_vars_len++] = (ssa_var_t) {
+                .name = vardecl->ident,
+                .var = var,
             };
 
-            codegen_expr(pb, vardecl->expr);
-        } break;
-        case STMT_EXPR: {
-            stmt_expr_t* expr = (stmt_expr_t*)stmt;
-
-            codegen_expr(pb, expr->expr);
-        } break;
+            return 1;
+        }
+        case STMT_EXPR:
+            return ssa_expr(((stmt_expr_t*)stmt)->expr) != -1;
         case STMT_RETURN: {
-            assert(fun);
-
             stmt_return_t* ret = (stmt_return_t*)stmt;
 
             if (ret->expr) {
-                type_kind_t expr_type = typecheck_expr(ret->expr);
-                type_kind_t function_type = get_type_from_token(fun->type);
-
-                if (function_type  != expr_type) {
-                    fprintf(stderr, "ERROR: return type mismatched, expected %d but got %d\n", function_type, expr_type);
-                    exit(1);
-                }
+                int32_t value = ssa_expr(ret->expr);
+                if (value == -1)
+                    return 0;
 
-                codegen_expr(pb, ret->expr);
+                ir_ret(&ssa_fun, ssa_block, value);
+            } else if (is_main(fun->name)) {
+                ir_halt(&ssa_fun, ssa_block);
             } else {
-                if (strncmp(fun->name.start, "main", fun->name.length) == 0) {
-                    npb_halt(pb);
-                } else {
-                    npb_retvoid(pb);
-                }
+                ir_retvoid(&ssa_fun, ssa_block);
             }
 
-            if (strncmp(fun->name.start, "main", fun->name.length) == 0) {
-                npb_halt(pb);
-            } else {
-                npb_ret(pb);
-            }
-        } break;
+            ssa_block = -1;
+            return 1;
+        }
         case STMT_VARASSIGN: {
             stmt_varassign_t* assign = (stmt_varassign_t*)stmt;
 
-            int index = locals_lookup(assign->ident);
-            if (index == -1) {
-                fprintf(stderr, "ERROR: variable '%.*s' does not exist\n", assign->ident.length, assign->ident.start);
-                exit(1);
-            }
+            int32_t var = ssa_var_lookup(assign->ident);
+            if (assign->index || var == -1)
+                return 0;
 
-            codegen_expr(pb, assign->expr);
-            npb_set(pb, locals[index].sp_offset);
-        } break;
+            int32_t value = ssa_expr(assign->expr);
+            if (value == -1)
+                return 0;
+
+            ir_var_write(&ssa_fun, var, ssa_block, value);
+            return 1;
+        }
         case STMT_IF: {
             stmt_if_t* sif = (stmt_if_t*)stmt;
 
-            type_kind_t expr_type = typecheck_expr(sif->condition);
-            if (expr_type != TYPE_BUILTIN_INT) {
-                fprintf(stderr, "ERROR: expected int for conditional if statement, but got type %d\n", expr_type);
-                exit(1);
+            int32_t true_block = ir_block_new(&ssa_fun);
+            int32_t false_block = sif->false ? ir_block_new(&ssa_fun) : -1;
+            int32_t join = ir_block_new(&ssa_fun);
+
+            if (!ssa_condition(sif->condition, true_block, sif->false ? false_block : join))
+                return 0;
+
+            // arms are placed in the order they're built, the first one
+            // falls through.
+            int swapped = else_is_likely(sif, fun);
+
+            for (int i = 0; i < 2; i++) {
+                int32_t arm = i == swapped ? true_block : false_block;
+
+                if (arm == -1)
+                    continue;
+
+                ir_block_seal(&ssa_fun, arm);
+                ir_block_place(&ssa_fun, arm);
+                ssa_block = arm;
+
+                if (!ssa_scoped_block(arm == true_block ? sif->true : sif->false, fun))
+                    return 0;
+
+                if (ssa_block != -1)
+                    ir_br(&ssa_fun, ssa_block, join);
             }
 
-            codegen_expr(pb, sif->condition);
-            int32_t true_patch_addr = pb->program_len;
-            npb_brit(pb, -1);
+            ssa_continue(join);
+            return 1;
+        }
+        case STMT_WHILE: {
+            stmt_while_t* swhile = (stmt_while_t*)stmt;
 
-            int current_locals_len = locals_len;
-            codegen_block(pb, sif->false, fun);
-            locals_len = current_locals_len;
+            int32_t header = ir_block_new(&ssa_fun);
+            int32_t body = ir_block_new(&ssa_fun);
+            int32_t exit = ir_block_new(&ssa_fun);
 
-            int32_t false_exit_patch_addr = pb->program_len;
-            npb_br(pb, -1);
+            ir_br(&ssa_fun, ssa_block, header);
 
-            int32_t true_block = pb->program_len;
-            codegen_block(pb, sif->true, fun);
-            locals_len = current_locals_len;
+            int32_t condition_start = ssa_fun.layout_len;
+            ir_block_place(&ssa_fun, header);
+            ssa_block = header;
 
-            patch_jump_address(pb, true_patch_addr, true_block);
-            patch_jump_address(pb, false_exit_patch_addr, pb->program_len);
-        } break;
+            if (!ssa_condition(swhile->condition, body, exit))
+                return 0;
+
+            int32_t condition_end = ssa_fun.layout_len;
+
+            ir_block_seal(&ssa_fun, body);
+            ir_block_place(&ssa_fun, body);
+            ssa_block = body;
+
+            if (!ssa_scoped_block(swhile->body, fun))
+                return 0;
+
+            if (ssa_block != -1)
+                ir_br(&ssa_fun, ssa_block, header);
+
+            ir_block_seal(&ssa_fun, header);
+
+            // the condition sits at the bottom, as in the stack code.
+            ir_layout_rotate(&ssa_fun, condition_start, condition_end);
+
+            ssa_continue(exit);
+            return 1;
+        }
+        default:
+            return 0;
+    }
+}
+
+static int ssa_scoped_block(block_t* block, topdecl_fun_t* fun)
+{
+    int vars_len = ssa_vars_len;
+
+    for (; block && ssa_block != -1; block = block->next) {
+        if (!ssa_stmt(block->stmt, fun))
+            return 0;
+    }
+
+    ssa_vars_len = vars_len;
+    return 1;
+}
+
+static int ssa_build(topdecl_fun_t* fun)
+{
+    if (is_array_type(get_type_from_token(fun->type)))
+        return 0;
+
+    ssa_block = ir_block_new(&ssa_fun);
+    ir_block_seal(&ssa_fun, ssa_block);
+    ir_block_place(&ssa_fun, ssa_block);
+
+    for (int i = 0; i < fun->args_len; i++) {
+        ir_type_t type = ssa_type(get_type_from_token(fun->args[i].type));
+        if (type == IR_VOID)
+            return 0;
+
+        int32_t var = ir_var_new(&ssa_fun, type);
+        ir_var_write(&ssa_fun, var, ssa_block, ir_arg(&ssa_fun, ssa_block, i, type));
+
+        ssa_vars[ssa_vars_len++] = (ssa_var_t) {
+            .name = fun->args[i].arg,
+            .var = var,
+        };
+    }
+
+    if (!ssa_scoped_block(fun->funbody, fun))
+        return 0;
+
+    if (ssa_block != -1) {
+        // non-void functions running off their end are left as they are.
+        if (get_type_from_token(fun->type) != TYPE_BUILTIN_VOID)
+            return 0;
+
+        if (is_main(fun->name)) {
+            ir_halt(&ssa_fun, ssa_block);
+        } else {
+            ir_retvoid(&ssa_fun, ssa_block);
+        }
+    }
+
+    return 1;
+}
+
+// rebuilds an already checked and emitted function from the ir in its place,
+// the stack code is kept for functions using what the ir doesn't cover.
+static void codegen_ssa(npb_t* pb, topdecl_fun_t* fun, int32_t ip)
+{
+    ir_fun_init(&ssa_fun);
+
+    ssa_pb = pb;
+    ssa_vars_len = 0;
+    ssa_inline = NULL;
+
+    if (ssa_build(fun)) {
+        pb->program_len = ip;
+
+        ir_optimize(&ssa_fun);
+        ir_lower(&ssa_fun, pb);
+    }
+
+    ir_fun_free(&ssa_fun);
+}
+
+// checks the signature and adds the function without compiling it.
+static void declare_function(topdecl_fun_t* fun)
+{
+    if (functions_lookup(fun->name) != -1) {
+        fprintf(stderr, "ERROR: function '%.*s' already exist\n", fun->name.length, fun->name.start);
+        exit(1);
+    }
+
+    if (is_main(fun->name)) {
+        if (strncmp(fun->type.start, "void", fun->type.length) != 0) {
+            fprintf(stderr, "ERROR: the main function type is not void\n");
+            exit(1);
+        }
+    }
+
+    if (functions_len == SYMTABLE_CAP) {
+        fprintf(stderr, "ERROR: more than %d functions\n", SYMTABLE_CAP);
+        exit(1);
+    }
+
+    int pure = !fun->is_extern && is_pure_block(fun->funbody, fun);
+
+    functions[functions_len++] = (function_t) {
+        .fun = fun,
+        .ip = -1,
+        .pure = pure,
+    };
+}
+
+static void compile_function(npb_t* pb, int index)
+{
+    topdecl_fun_t* fun = functions[index].fun;
+
+    locals_len = 0;
+
+    for (int i = 0; i < fun->args_len; i++) {
+        locals[locals_len++] = (symbol_t) {
+            .token = fun->args[i].arg,
+            .type = get_type_from_token(fun->args[i].type),
+            .is_fun_args = 1,
+            .sp_offset = i,
+            .array_len = -1,
+        };
+    }
+
+    if (fun->memo)
+        check_memo(fun);
+
+    if (fun->is_inline && !inline_body(fun)) {
+        fprintf(stderr, "ERROR: inline function '%.*s' must be a single non-recursive return of scalars\n", fun->name.length, fun->name.start);
+        exit(1);
+    }
+
+    functions[index].ip = pb->program_len;
+
+    record_site(pb, SITE_CALLS, fun->name, -1, pb->program_len);
+
+    memo_index = -1;
+
+    if (fun->memo) {
+        memo_index = memos_len++;
+        npb_memoenter(pb, memo_index);
+    }
+
+    // locals are addressed relative to the frame.
+    sp_offset = -1;
+
+    accumulator_op = linear_recursion_op(fun);
+
+    if (accumulator_op) {
+        npb_ipush(pb, accumulator_op == '+' ? 0 : 1);
+        sp_offset++;
+
+        accumulator_loop = pb->program_len;
+    }
+
+    codegen_block(pb, fun->funbody, fun);
+
+    int lowerable = ssa_enabled && !fun->memo && !accumulator_op;
+    accumulator_op = 0;
+
+    // void functions may run off their end.
+    if (!block_terminates(fun->funbody) && get_type_from_token(fun->type) == TYPE_BUILTIN_VOID) {
+        if (is_main(fun->name)) {
+            npb_halt(pb);
+        } else {
+            npb_retvoid(pb);
+        }
     }
+
+    if (lowerable)
+        codegen_ssa(pb, fun, functions[index].ip);
 }
 
 void codegen_topdecl(npb_t* pb, topdecl_t* topdecl)
@@ -470,50 +3589,210 @@ void codegen_topdecl(npb_t* pb, topdecl_t* topdecl)
     assert(initialized);
 
     switch (topdecl->kind) {
-        case TOPDECL_FUN: {
-            topdecl_fun_t* fun = (topdecl_fun_t*)topdecl;
+        case TOPDECL_FUN:
+            declare_function((topdecl_fun_t*)topdecl);
 
-            if (functions_lookup(fun->name) != -1) {
-                fprintf(stderr, "ERROR: function '%.*s' already exist\n", fun->name.length, fun->name.start);
-                exit(1);
-            }
+            if (!((topdecl_fun_t*)topdecl)->is_extern)
+                compile_function(pb, functions_len - 1);
+            break;
+    }
+}
 
-            if (strncmp(fun->name.start, "main", fun->name.length) == 0) {
-                if (strncmp(fun->type.start, "void", fun->type.length) != 0) {
-                    fprintf(stderr, "ERROR: the main function type is not void\n");
-                    exit(1);
-                }
-            }
+int32_t codegen_compile_function(npb_t* pb, int32_t index)
+{
+    // every stub calling it ends up here, but it's only compiled once.
+    if (functions[index].ip != -1)
+        return functions[index].ip;
 
-            locals_len = 0;
+    // only the functions defined before it are visible, as when compiled in
+    // source order.
+    int len = functions_len;
 
-            for (int i = 0; i < fun->args_len; i++) {
-                locals[locals_len++] = (symbol_t) {
-                    .token = fun->args[i].arg,
-                    .type = get_type_from_token(fun->args[i].type),
-                    .is_fun_args = 1,
-                    .sp_offset = i,
-                };
-            }
+    functions_len = index + 1;
+    compile_function(pb, index);
+    functions_len = len;
 
-            functions[functions_len++] = (function_t) {
-                .fun = fun,
-                .ip = pb->program_len,
-            };
+    return functions[index].ip;
+}
 
-            if (strncmp(fun->name.start, "main", fun->name.length) != 0) {
-                sp_offset += 3 + fun->args_len;
-            }
+typedef void (*call_visitor_t)(token_t name, void* data);
 
-            int start_sp = sp_offset;
-            codegen_block(pb, fun->funbody, fun);
-            sp_offset = start_sp;
+static void visit_calls_block(block_t* block, call_visitor_t visit, void* data);
 
-            if (strncmp(fun->name.start, "main", fun->name.length) != 0) {
-                sp_offset -= 3 + fun->args_len;
-            }
+static void visit_calls_expr(expr_t* expr, call_visitor_t visit, void* data)
+{
+    if (!expr)
+        return;
+
+    switch (expr->kind) {
+        case EXPR_IDENTIFIER:
+        case EXPR_NUMBER:
+            break;
+        case EXPR_UNARY:
+            visit_calls_expr(((expr_unary_t*)expr)->operand, visit, data);
+            break;
+        case EXPR_BINARY:
+            visit_calls_expr(((expr_binary_t*)expr)->lhs, visit, data);
+            visit_calls_expr(((expr_binary_t*)expr)->rhs, visit, data);
+            break;
+        case EXPR_FUNCALL: {
+            expr_funcall_t* funcall = (expr_funcall_t*)expr;
+
+            for (int i = 0; i < funcall->args_len; i++)
+                visit_calls_expr(funcall->args[i], visit, data);
+
+            visit(funcall->name, data);
         } break;
+        case EXPR_NEWARRAY:
+            visit_calls_expr(((expr_newarray_t*)expr)->len, visit, data);
+            break;
+        case EXPR_INDEX:
+            visit_calls_expr(((expr_index_t*)expr)->array, visit, data);
+            visit_calls_expr(((expr_index_t*)expr)->index, visit, data);
+            break;
+    }
+}
+
+static void visit_calls_block(block_t* block, call_visitor_t visit, void* data)
+{
+    for (; block; block = block->next) {
+        stmt_t* stmt = block->stmt;
+
+        switch (stmt->kind) {
+            case STMT_VARDECL:
+                visit_calls_expr(((stmt_vardecl_t*)stmt)->expr, visit, data);
+                break;
+            case STMT_EXPR:
+                visit_calls_expr(((stmt_expr_t*)stmt)->expr, visit, data);
+                break;
+            case STMT_RETURN:
+                visit_calls_expr(((stmt_return_t*)stmt)->expr, visit, data);
+                break;
+            case STMT_VARASSIGN:
+                visit_calls_expr(((stmt_varassign_t*)stmt)->index, visit, data);
+                visit_calls_expr(((stmt_varassign_t*)stmt)->expr, visit, data);
+                break;
+            case STMT_IF:
+                visit_calls_expr(((stmt_if_t*)stmt)->condition, visit, data);
+                visit_calls_block(((stmt_if_t*)stmt)->true, visit, data);
+                visit_calls_block(((stmt_if_t*)stmt)->false, visit, data);
+                break;
+            case STMT_MATCH: {
+                stmt_match_t* smatch = (stmt_match_t*)stmt;
+
+                visit_calls_expr(smatch->subject, visit, data);
+
+                for (match_arm_t* arm = smatch->arms; arm; arm = arm->next)
+                    visit_calls_block(arm->body, visit, data);
+
+                visit_calls_block(smatch->otherwise, visit, data);
+            } break;
+            case STMT_WHILE:
+                visit_calls_expr(((stmt_while_t*)stmt)->condition, visit, data);
+                visit_calls_block(((stmt_while_t*)stmt)->body, visit, data);
+                break;
+        }
+    }
+}
+
+// marks every function declared with the name, so duplicates are still
+// reported.
+static void mark_reachable_call(token_t name, void* data)
+{
+    program_t* program = data;
+
+    for (program_t* it = program; it; it = it->next) {
+        topdecl_fun_t* fun = (topdecl_fun_t*)it->topdecl;
+
+        if (fun->reachable || name.length != fun->name.length || strncmp(name.start, fun->name.start, name.length) != 0)
+            continue;
+
+        fun->reachable = 1;
+        visit_calls_block(fun->funbody, mark_reachable_call, program);
+    }
+}
+
+typedef struct {
+    token_t name;
+    int found;
+} call_search_t;
+
+static void find_call(token_t name, void* data)
+{
+    call_search_t* search = data;
+
+    if (name.length == search->name.length && strncmp(name.start, search->name.start, name.length) == 0)
+        search->found = 1;
+}
+
+// `fun` needs `callee` emitted first, unless it's its own duplicate.
+static int depends_on(topdecl_fun_t* fun, topdecl_fun_t* callee)
+{
+    call_search_t search = { .name = callee->name };
+
+    if (fun->name.length == callee->name.length && strncmp(fun->name.start, callee->name.start, fun->name.length) == 0)
+        return 0;
+
+    visit_calls_block(fun->funbody, find_call, &search);
+    return search.found;
+}
+
+// hottest functions first, but never before a function they call.
+static void codegen_program_by_calls(npb_t* pb, program_t* program)
+{
+    topdecl_fun_t* pending[SYMTABLE_CAP];
+    int pending_len = 0;
+
+    for (program_t* it = program; it && pending_len < SYMTABLE_CAP; it = it->next) {
+        if (((topdecl_fun_t*)it->topdecl)->reachable)
+            pending[pending_len++] = (topdecl_fun_t*)it->topdecl;
+    }
+
+    while (pending_len > 0) {
+        // calls to functions defined later are reported in source order.
+        int next = 0;
+        int64_t next_calls = -1;
+
+        for (int i = 0; i < pending_len; i++) {
+            int ready = 1;
+
+            for (int j = 0; j < pending_len && ready; j++)
+                ready = i == j || !depends_on(pending[i], pending[j]);
+
+            if (ready && profiled_calls(pending[i]) > next_calls) {
+                next = i;
+                next_calls = profiled_calls(pending[i]);
+            }
+        }
+
+        codegen_topdecl(pb, (topdecl_t*)pending[next]);
+
+        memmove(pending + next, pending + next + 1, sizeof(*pending) * (pending_len - next - 1));
+        pending_len--;
+    }
+
+    npb_halt(pb);
+}
+
+static void fill_object(npb_t* pb)
+{
+    for (int i = 0; i < functions_len; i++) {
+        topdecl_fun_t* fun = functions[i].fun;
+
+        if (fun->is_extern)
+            continue;
+
+        char signature[16];
+        signature_of(fun, signature);
+
+        object_add_symbol(object, fun->name.start, fun->name.length, signature, functions[i].ip);
     }
+
+    object->code = malloc(pb->program_len);
+    object->code_len = pb->program_len;
+    memcpy(object->code, pb->program, pb->program_len);
+
+    object->memos_len = memos_len;
 }
 
 static void codegen_program_internal(npb_t* pb, program_t* program)
@@ -525,13 +3804,80 @@ static void codegen_program_internal(npb_t* pb, program_t* program)
         return;
     }
 
-    codegen_topdecl(pb, program->topdecl);
-    codegen_program(pb, program->next);
+    // functions main can't reach are neither checked nor emitted.
+    if (((topdecl_fun_t*)program->topdecl)->reachable)
+        codegen_topdecl(pb, program->topdecl);
+
+    codegen_program_internal(pb, program->next);
+}
+
+// entries of a profile taken from another version of the program are
+// ignored, but they likely mean the profile is stale.
+static void check_profile(program_t* program)
+{
+    for (int32_t i = 0; i < feedback->entries_len; i++) {
+        const profile_entry_t* entry = &feedback->entries[i];
+        topdecl_fun_t* fun = NULL;
+
+        for (program_t* it = program; it && !fun; it = it->next) {
+            topdecl_fun_t* candidate = (topdecl_fun_t*)it->topdecl;
+
+            if (!candidate->is_extern && candidate->name.length == (int)strlen(entry->function)
+                && strncmp(candidate->name.start, entry->function, candidate->name.length) == 0)
+                fun = candidate;
+        }
+
+        if (!fun) {
+            fprintf(stderr, "WARNING: profile names unknown function '%s'\n", entry->function);
+        } else if (entry->site >= fun->ifs_len) {
+            fprintf(stderr, "WARNING: profile names if %d of function '%s', which has %d if(s)\n", entry->site, entry->function, fun->ifs_len);
+        }
+    }
 }
 
 int codegen_program(npb_t* pb, program_t* program)
 {
-    codegen_program_internal(pb, program);
+    assert(initialized);
+
+    profiled_pb = pb;
+    object_pb = pb;
+
+    if (feedback)
+        check_profile(program);
+
+    // only main is compiled now, the rest on demand.
+    if (lazy) {
+        for (program_t* it = program; it; it = it->next)
+            declare_function((topdecl_fun_t*)it->topdecl);
+
+        int main_index = functions_lookup((token_t) { .length = 4, .start = "main" });
+
+        if (main_index == -1)
+            return -1;
+
+        return codegen_compile_function(pb, main_index);
+    }
+
+    mark_reachable_call((token_t) { .length = 4, .start = "main" }, program);
+
+    // nothing is reachable without a main, every function is kept then.
+    int has_main = 0;
+
+    for (program_t* it = program; it; it = it->next)
+        has_main |= ((topdecl_fun_t*)it->topdecl)->reachable;
+
+    // nor when other modules may call them.
+    for (program_t* it = program; it && (!has_main || object); it = it->next)
+        ((topdecl_fun_t*)it->topdecl)->reachable = 1;
+
+    if (feedback && has_main) {
+        codegen_program_by_calls(pb, program);
+    } else {
+        codegen_program_internal(pb, program);
+    }
+    if (object)
+        fill_object(pb);
+
     int main_index = functions_lookup((token_t) { .length = 4, .start = "main" });
 
     if (main_index != -1)
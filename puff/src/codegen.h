@@ -1,10 +1,44 @@
 #pragma once
 
 #include "ast.h"
+#include "object.h"
+#include "profile.h"
 #include "vm.h"
 
 void codegen_init(npb_t* pb);
+void codegen_register_natives(const nnative_t* natives, int32_t natives_len);
+
+// max size, in expression nodes, of functions inlined without an `inline`
+// hint. 0 only inlines hinted functions.
+void codegen_set_inline_threshold(int threshold);
+
+// builds functions into an ssa ir and optimizes them there before emitting.
+void codegen_set_ssa(int enabled);
+
+// only main is compiled by codegen_program, other functions are called through
+// stubs and compiled by codegen_compile_function on their first call. the
+// program must outlive the compilation then.
+void codegen_set_lazy(int enabled);
+
+// compiles the program as a module of a bigger one: every function is kept,
+// calls to extern functions are left to the linker and the module is
+// described in `object` by codegen_program.
+void codegen_set_object(object_t* object);
+
+// remembers where functions and ifs land in the program, the counts of a run
+// are then added to `profile` by codegen_collect_profile. no other profile
+// should be fed back into the same compilation.
+void codegen_set_profiling(profile_t* profile);
+void codegen_collect_profile(const nprofile_t* counts);
+
+// counts of an earlier run: hot functions are inlined more eagerly and
+// emitted first, and the likelier arm of an if falls through.
+void codegen_set_profile(const profile_t* profile);
+
 void codegen_expr(npb_t* pb, expr_t* expr);
 void codegen_stmt(npb_t* pb, stmt_t* stmt, topdecl_fun_t* fun);
 void codegen_topdecl(npb_t* pb, topdecl_t* topdecl);
 int codegen_program(npb_t* pb, program_t* program);
+
+// appends the function a stub refers to and returns where it starts.
+int32_t codegen_compile_function(npb_t* pb, int32_t index);
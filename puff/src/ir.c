@@ -0,0 +1,2037 @@
+#include "ir.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PUSH(array, len, cap, value)                                \
+    {                                                               \
+        if ((len) >= (cap)) {                                       \
+            (cap) = (cap) ? (cap) * 2 : 8;                          \
+            (array) = realloc((array), sizeof(*(array)) * (cap));   \
+        }                                                           \
+        (array)[(len)++] = (value);                                 \
+    }                                                               \
+
+int ir_fold_int(char op, int32_t a, int32_t b, int32_t* result)
+{
+    switch (op) {
+        case '+': *result = (int32_t)((uint32_t)a + (uint32_t)b); return 1;
+        case '-': *result = (int32_t)((uint32_t)a - (uint32_t)b); return 1;
+        case '*': *result = (int32_t)((uint32_t)a * (uint32_t)b); return 1;
+        case '/':
+            if (b == 0)
+                return 0;
+
+            *result = b == -1 ? (int32_t)(0u - (uint32_t)a) : a / b;
+            return 1;
+        case '%':
+            if (b == 0)
+                return 0;
+
+            *result = b == -1 ? 0 : a % b;
+            return 1;
+        case '&': *result = a & b; return 1;
+        case '|': *result = a | b; return 1;
+        case '^': *result = a ^ b; return 1;
+        case 'L': *result = (int32_t)((uint32_t)a << (b & 31)); return 1;
+        case 'R': *result = a >> (b & 31); return 1;
+        case '=': *result = a == b; return 1;
+        case '!': *result = a != b; return 1;
+        case '<': *result = a < b; return 1;
+        case '>': *result = a > b; return 1;
+        case 'l': *result = a <= b; return 1;
+        case 'g': *result = a >= b; return 1;
+        default:  return 0;
+    }
+}
+
+int ir_fold_double(char op, double a, double b, ir_const_t* result)
+{
+    result->type = IR_DOUBLE;
+
+    switch (op) {
+        case '+': result->d = a + b; return 1;
+        case '-': result->d = a - b; return 1;
+        case '*': result->d = a * b; return 1;
+        case '/': result->d = a / b; return 1;
+        default:  break;
+    }
+
+    result->type = IR_INT;
+
+    switch (op) {
+        case '=': result->i = a == b; return 1;
+        case '!': result->i = a != b; return 1;
+        case '<': result->i = a < b; return 1;
+        case '>': result->i = a > b; return 1;
+        case 'l': result->i = a <= b; return 1;
+        case 'g': result->i = a >= b; return 1;
+        default:  return 0;
+    }
+}
+
+void ir_fun_init(ir_fun_t* fn)
+{
+    *fn = (ir_fun_t) { 0 };
+}
+
+void ir_fun_free(ir_fun_t* fn)
+{
+    for (int32_t i = 0; i < fn->values_len; i++)
+        free(fn->values[i].operands);
+
+    for (int32_t i = 0; i < fn->blocks_len; i++) {
+        ir_block_t* block = &fn->blocks[i];
+
+        free(block->phis);
+        free(block->values);
+        free(block->preds);
+        free(block->defs);
+        free(block->incomplete);
+    }
+
+    free(fn->values);
+    free(fn->blocks);
+    free(fn->layout);
+    free(fn->vars);
+
+    *fn = (ir_fun_t) { 0 };
+}
+
+static int32_t value_new(ir_fun_t* fn, int32_t block, ir_kind_t kind, ir_type_t type)
+{
+    ir_value_t value = {
+        .kind = kind,
+        .type = type,
+        .block = block,
+        .forward = -1,
+        .slot = -1,
+    };
+
+    PUSH(fn->values, fn->values_len, fn->values_cap, value);
+    int32_t index = fn->values_len - 1;
+
+    ir_block_t* b = &fn->blocks[block];
+
+    if (kind == IR_PHI) {
+        PUSH(b->phis, b->phis_len, b->phis_cap, index);
+    } else {
+        PUSH(b->values, b->values_len, b->values_cap, index);
+    }
+
+    return index;
+}
+
+static void operand_push(ir_fun_t* fn, int32_t value, int32_t operand)
+{
+    ir_value_t* v = &fn->values[value];
+    PUSH(v->operands, v->operands_len, v->operands_cap, operand);
+}
+
+int32_t ir_resolve(ir_fun_t* fn, int32_t value)
+{
+    while (fn->values[value].forward != -1)
+        value = fn->values[value].forward;
+
+    return value;
+}
+
+static void replace(ir_fun_t* fn, int32_t value, int32_t with)
+{
+    fn->values[value].kind = IR_NOP;
+    fn->values[value].forward = with;
+}
+
+int32_t ir_block_new(ir_fun_t* fn)
+{
+    ir_block_t block = {
+        .terminator = IR_NONE,
+        .operand = -1,
+        .targets = { -1, -1 },
+    };
+
+    PUSH(fn->blocks, fn->blocks_len, fn->blocks_cap, block);
+    return fn->blocks_len - 1;
+}
+
+void ir_block_place(ir_fun_t* fn, int32_t block)
+{
+    PUSH(fn->layout, fn->layout_len, fn->layout_cap, block);
+}
+
+void ir_layout_rotate(ir_fun_t* fn, int32_t from, int32_t middle)
+{
+    int32_t len = middle - from;
+    int32_t* moved = malloc(sizeof(*moved) * (len ? len : 1));
+
+    memcpy(moved, fn->layout + from, sizeof(*moved) * len);
+    memmove(fn->layout + from, fn->layout + middle, sizeof(*moved) * (fn->layout_len - middle));
+    memcpy(fn->layout + fn->layout_len - len, moved, sizeof(*moved) * len);
+
+    free(moved);
+}
+
+int32_t ir_var_new(ir_fun_t* fn, ir_type_t type)
+{
+    PUSH(fn->vars, fn->vars_len, fn->vars_cap, type);
+    return fn->vars_len - 1;
+}
+
+void ir_var_write(ir_fun_t* fn, int32_t var, int32_t block, int32_t value)
+{
+    ir_block_t* b = &fn->blocks[block];
+
+    if (var >= b->defs_len) {
+        b->defs = realloc(b->defs, sizeof(*b->defs) * fn->vars_len);
+
+        for (int32_t i = b->defs_len; i < fn->vars_len; i++)
+            b->defs[i] = -1;
+
+        b->defs_len = fn->vars_len;
+    }
+
+    b->defs[var] = value;
+}
+
+static int32_t const_zero(ir_fun_t* fn, int32_t block, ir_type_t type)
+{
+    return type == IR_DOUBLE ? ir_const_double(fn, block, 0.0) : ir_const_int(fn, block, 0);
+}
+
+// a phi whose operands are all the same value, or itself, is that value.
+static int32_t remove_trivial_phi(ir_fun_t* fn, int32_t phi)
+{
+    int32_t same = -1;
+
+    for (int32_t i = 0; i < fn->values[phi].operands_len; i++) {
+        int32_t operand = ir_resolve(fn, fn->values[phi].operands[i]);
+
+        if (operand == same || operand == phi)
+            continue;
+
+        if (same != -1)
+            return phi;
+
+        same = operand;
+    }
+
+    // only reachable through itself, the variable is undefined there.
+    if (same == -1)
+        same = const_zero(fn, fn->values[phi].block, fn->values[phi].type);
+
+    replace(fn, phi, same);
+    return same;
+}
+
+static int32_t add_phi_operands(ir_fun_t* fn, int32_t phi)
+{
+    int32_t var = fn->values[phi].index;
+    int32_t block = fn->values[phi].block;
+
+    for (int32_t i = 0; i < fn->blocks[block].preds_len; i++)
+        operand_push(fn, phi, ir_var_read(fn, var, fn->blocks[block].preds[i]));
+
+    return remove_trivial_phi(fn, phi);
+}
+
+static int32_t read_var_recursive(ir_fun_t* fn, int32_t var, int32_t block)
+{
+    ir_block_t* b = &fn->blocks[block];
+    int32_t value;
+
+    if (!b->sealed) {
+        value = value_new(fn, block, IR_PHI, fn->vars[var]);
+        fn->values[value].index = var;
+
+        b = &fn->blocks[block];
+        PUSH(b->incomplete, b->incomplete_len, b->incomplete_cap, value);
+    } else if (b->preds_len == 0) {
+        value = const_zero(fn, block, fn->vars[var]);
+    } else if (b->preds_len == 1) {
+        value = ir_var_read(fn, var, b->preds[0]);
+    } else {
+        // written first to break cycles through loops.
+        value = value_new(fn, block, IR_PHI, fn->vars[var]);
+        fn->values[value].index = var;
+
+        ir_var_write(fn, var, block, value);
+        value = add_phi_operands(fn, value);
+    }
+
+    ir_var_write(fn, var, block, value);
+    return value;
+}
+
+int32_t ir_var_read(ir_fun_t* fn, int32_t var, int32_t block)
+{
+    ir_block_t* b = &fn->blocks[block];
+
+    if (var < b->defs_len && b->defs[var] != -1)
+        return ir_resolve(fn, b->defs[var]);
+
+    return read_var_recursive(fn, var, block);
+}
+
+void ir_block_seal(ir_fun_t* fn, int32_t block)
+{
+    // completing a phi can add more of them to the block.
+    for (int32_t i = 0; i < fn->blocks[block].incomplete_len; i++)
+        add_phi_operands(fn, fn->blocks[block].incomplete[i]);
+
+    fn->blocks[block].incomplete_len = 0;
+    fn->blocks[block].sealed = 1;
+}
+
+int32_t ir_const_int(ir_fun_t* fn, int32_t block, int32_t value)
+{
+    int32_t index = value_new(fn, block, IR_CONST, IR_INT);
+    fn->values[index].constant = (ir_const_t) { .type = IR_INT, .i = value };
+
+    return index;
+}
+
+int32_t ir_const_double(ir_fun_t* fn, int32_t block, double value)
+{
+    int32_t index = value_new(fn, block, IR_CONST, IR_DOUBLE);
+    fn->values[index].constant = (ir_const_t) { .type = IR_DOUBLE, .d = value };
+
+    return index;
+}
+
+int32_t ir_arg(ir_fun_t* fn, int32_t block, int32_t index, ir_type_t type)
+{
+    int32_t value = value_new(fn, block, IR_ARG, type);
+    fn->values[value].index = index;
+
+    return value;
+}
+
+static int is_comparison(char op)
+{
+    return op == '=' || op == '!' || op == '<' || op == '>' || op == 'l' || op == 'g';
+}
+
+int32_t ir_unary(ir_fun_t* fn, int32_t block, char op, int32_t operand)
+{
+    int32_t value = value_new(fn, block, IR_UNARY, op == '!' ? IR_INT : fn->values[operand].type);
+    fn->values[value].op = op;
+    operand_push(fn, value, operand);
+
+    return value;
+}
+
+int32_t ir_binary(ir_fun_t* fn, int32_t block, char op, int32_t lhs, int32_t rhs)
+{
+    int32_t value = value_new(fn, block, IR_BINARY, is_comparison(op) ? IR_INT : fn->values[lhs].type);
+    fn->values[value].op = op;
+    operand_push(fn, value, lhs);
+    operand_push(fn, value, rhs);
+
+    return value;
+}
+
+int32_t ir_call(ir_fun_t* fn, int32_t block, int32_t addr, ir_type_t type, int pure, const int32_t* args, int32_t args_len)
+{
+    int32_t value = value_new(fn, block, IR_CALL, type);
+    fn->values[value].index = addr;
+    fn->values[value].pure = pure;
+
+    for (int32_t i = 0; i < args_len; i++)
+        operand_push(fn, value, args[i]);
+
+    return value;
+}
+
+int32_t ir_intrinsic(ir_fun_t* fn, int32_t block, void (*emit)(npb_t* pb), ir_type_t type, const int32_t* args, int32_t args_len)
+{
+    int32_t value = value_new(fn, block, IR_INTRINSIC, type);
+    fn->values[value].emit = emit;
+
+    for (int32_t i = 0; i < args_len; i++)
+        operand_push(fn, value, args[i]);
+
+    return value;
+}
+
+int32_t ir_print(ir_fun_t* fn, int32_t block, int32_t operand)
+{
+    int32_t value = value_new(fn, block, IR_PRINT, IR_VOID);
+    operand_push(fn, value, operand);
+
+    return value;
+}
+
+static void pred_push(ir_fun_t* fn, int32_t block, int32_t pred)
+{
+    ir_block_t* b = &fn->blocks[block];
+
+    assert(!b->sealed);
+    PUSH(b->preds, b->preds_len, b->preds_cap, pred);
+}
+
+void ir_br(ir_fun_t* fn, int32_t block, int32_t target)
+{
+    fn->blocks[block].terminator = IR_BR;
+    fn->blocks[block].targets[0] = target;
+
+    pred_push(fn, target, block);
+}
+
+void ir_condbr(ir_fun_t* fn, int32_t block, int32_t condition, int32_t true_target, int32_t false_target)
+{
+    fn->blocks[block].terminator = IR_CONDBR;
+    fn->blocks[block].operand = condition;
+    fn->blocks[block].targets[0] = true_target;
+    fn->blocks[block].targets[1] = false_target;
+
+    pred_push(fn, true_target, block);
+    pred_push(fn, false_target, block);
+}
+
+void ir_ret(ir_fun_t* fn, int32_t block, int32_t value)
+{
+    fn->blocks[block].terminator = IR_RET;
+    fn->blocks[block].operand = value;
+}
+
+void ir_retvoid(ir_fun_t* fn, int32_t block)
+{
+    fn->blocks[block].terminator = IR_RETVOID;
+}
+
+void ir_halt(ir_fun_t* fn, int32_t block)
+{
+    fn->blocks[block].terminator = IR_HALT;
+}
+
+static int successors_len(ir_block_t* block)
+{
+    switch (block->terminator) {
+        case IR_BR:     return 1;
+        case IR_CONDBR: return 2;
+        default:        return 0;
+    }
+}
+
+static int32_t pred_index(ir_fun_t* fn, int32_t block, int32_t pred)
+{
+    for (int32_t i = 0; i < fn->blocks[block].preds_len; i++) {
+        if (fn->blocks[block].preds[i] == pred)
+            return i;
+    }
+
+    return -1;
+}
+
+// drops an incoming edge along with the matching phi operands.
+static void remove_pred(ir_fun_t* fn, int32_t block, int32_t index)
+{
+    ir_block_t* b = &fn->blocks[block];
+
+    for (int32_t i = 0; i < b->phis_len; i++) {
+        ir_value_t* phi = &fn->values[b->phis[i]];
+
+        if (phi->kind != IR_PHI)
+            continue;
+
+        memmove(phi->operands + index, phi->operands + index + 1, sizeof(int32_t) * (phi->operands_len - index - 1));
+        phi->operands_len--;
+    }
+
+    memmove(b->preds + index, b->preds + index + 1, sizeof(int32_t) * (b->preds_len - index - 1));
+    b->preds_len--;
+}
+
+static void resolve_operands(ir_fun_t* fn)
+{
+    for (int32_t i = 0; i < fn->values_len; i++) {
+        ir_value_t* value = &fn->values[i];
+
+        if (value->kind == IR_NOP)
+            continue;
+
+        for (int32_t j = 0; j < value->operands_len; j++)
+            value->operands[j] = ir_resolve(fn, value->operands[j]);
+    }
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        ir_block_t* block = &fn->blocks[fn->layout[i]];
+
+        if (block->operand != -1)
+            block->operand = ir_resolve(fn, block->operand);
+    }
+}
+
+static void remove_trivial_phis(ir_fun_t* fn)
+{
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+
+        for (int32_t i = 0; i < fn->layout_len; i++) {
+            ir_block_t* block = &fn->blocks[fn->layout[i]];
+
+            for (int32_t j = 0; j < block->phis_len; j++) {
+                int32_t phi = block->phis[j];
+
+                if (fn->values[phi].kind != IR_PHI || block->preds_len == 0)
+                    continue;
+
+                if (remove_trivial_phi(fn, phi) != phi)
+                    changed = 1;
+            }
+        }
+    }
+
+    resolve_operands(fn);
+}
+
+typedef enum {
+    LATTICE_UNKNOWN,
+    LATTICE_CONST,
+    LATTICE_VARYING,
+} lattice_t;
+
+typedef struct {
+    ir_fun_t* fn;
+    lattice_t* state;
+    ir_const_t* constants;
+    int* executable; // per block
+    uint8_t** edges; // per block, whether the edge from each predecessor can be taken
+    int changed;
+} propagation_t;
+
+static int same_constant(ir_const_t a, ir_const_t b)
+{
+    if (a.type != b.type)
+        return 0;
+
+    // bitwise so -0.0 and 0.0 stay apart.
+    return a.type == IR_INT ? a.i == b.i : memcmp(&a.d, &b.d, sizeof(a.d)) == 0;
+}
+
+static void lower_to(propagation_t* p, int32_t value, lattice_t state, ir_const_t constant)
+{
+    if (p->state[value] == LATTICE_CONST && state == LATTICE_CONST && !same_constant(p->constants[value], constant))
+        state = LATTICE_VARYING;
+
+    if (state <= p->state[value])
+        return;
+
+    p->state[value] = state;
+    p->constants[value] = constant;
+    p->changed = 1;
+}
+
+static void mark_edge(propagation_t* p, int32_t from, int32_t to)
+{
+    ir_block_t* block = &p->fn->blocks[to];
+
+    for (int32_t i = 0; i < block->preds_len; i++) {
+        if (block->preds[i] == from && !p->edges[to][i]) {
+            p->edges[to][i] = 1;
+            p->changed = 1;
+        }
+    }
+
+    if (!p->executable[to]) {
+        p->executable[to] = 1;
+        p->changed = 1;
+    }
+}
+
+static void evaluate(propagation_t* p, int32_t index)
+{
+    ir_value_t* value = &p->fn->values[index];
+    ir_const_t result = { 0 };
+
+    switch (value->kind) {
+        case IR_NOP:
+            return;
+        case IR_CONST:
+            lower_to(p, index, LATTICE_CONST, value->constant);
+            return;
+        case IR_PHI: {
+            lattice_t state = LATTICE_UNKNOWN;
+
+            for (int32_t i = 0; i < value->operands_len; i++) {
+                int32_t operand = value->operands[i];
+
+                if (!p->edges[value->block][i] || p->state[operand] == LATTICE_UNKNOWN)
+                    continue;
+
+                if (p->state[operand] == LATTICE_VARYING || (state == LATTICE_CONST && !same_constant(result, p->constants[operand]))) {
+                    state = LATTICE_VARYING;
+                    break;
+                }
+
+                state = LATTICE_CONST;
+                result = p->constants[operand];
+            }
+
+            lower_to(p, index, state, result);
+            return;
+        }
+        case IR_UNARY:
+        case IR_BINARY: {
+            for (int32_t i = 0; i < value->operands_len; i++) {
+                if (p->state[value->operands[i]] == LATTICE_VARYING) {
+                    lower_to(p, index, LATTICE_VARYING, result);
+                    return;
+                }
+            }
+
+            for (int32_t i = 0; i < value->operands_len; i++) {
+                if (p->state[value->operands[i]] == LATTICE_UNKNOWN)
+                    return;
+            }
+
+            ir_const_t a = p->constants[value->operands[0]];
+            int folded = 1;
+
+            if (value->kind == IR_UNARY) {
+                result = a;
+
+                if (value->op == '!') {
+                    folded = a.type == IR_INT;
+                    result.i = a.i == 0;
+                } else if (a.type == IR_INT) {
+                    result.i = (int32_t)(0u - (uint32_t)a.i);
+                } else {
+                    result.d = a.d * -1.0;
+                }
+            } else {
+                ir_const_t b = p->constants[value->operands[1]];
+
+                if (a.type == IR_DOUBLE) {
+                    folded = ir_fold_double(value->op, a.d, b.d, &result);
+                } else {
+                    result.type = IR_INT;
+                    folded = ir_fold_int(value->op, a.i, b.i, &result.i);
+                }
+            }
+
+            lower_to(p, index, folded ? LATTICE_CONST : LATTICE_VARYING, result);
+            return;
+        }
+        default:
+            lower_to(p, index, LATTICE_VARYING, result);
+            return;
+    }
+}
+
+// sparse conditional constant propagation: values are assumed constant and
+// blocks unreachable until shown otherwise, so constants flowing around
+// loops and branches that can't be taken are found too.
+static void propagate_constants(ir_fun_t* fn)
+{
+    propagation_t p = {
+        .fn = fn,
+        .state = calloc(fn->values_len, sizeof(lattice_t)),
+        .constants = calloc(fn->values_len, sizeof(ir_const_t)),
+        .executable = calloc(fn->blocks_len, sizeof(int)),
+        .edges = calloc(fn->blocks_len, sizeof(uint8_t*)),
+        .changed = 1,
+    };
+
+    for (int32_t i = 0; i < fn->blocks_len; i++)
+        p.edges[i] = calloc(fn->blocks[i].preds_len + 1, sizeof(uint8_t));
+
+    p.executable[fn->layout[0]] = 1;
+
+    while (p.changed) {
+        p.changed = 0;
+
+        for (int32_t i = 0; i < fn->layout_len; i++) {
+            int32_t index = fn->layout[i];
+            ir_block_t* block = &fn->blocks[index];
+
+            if (!p.executable[index])
+                continue;
+
+            for (int32_t j = 0; j < block->phis_len; j++)
+                evaluate(&p, block->phis[j]);
+
+            for (int32_t j = 0; j < block->values_len; j++)
+                evaluate(&p, block->values[j]);
+
+            if (block->terminator == IR_BR) {
+                mark_edge(&p, index, block->targets[0]);
+            } else if (block->terminator == IR_CONDBR) {
+                switch (p.state[block->operand]) {
+                    case LATTICE_UNKNOWN:
+                        break;
+                    case LATTICE_CONST:
+                        mark_edge(&p, index, block->targets[p.constants[block->operand].i ? 0 : 1]);
+                        break;
+                    case LATTICE_VARYING:
+                        mark_edge(&p, index, block->targets[0]);
+                        mark_edge(&p, index, block->targets[1]);
+                        break;
+                }
+            }
+        }
+    }
+
+    int32_t layout_len = 0;
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+        ir_block_t* block = &fn->blocks[index];
+
+        if (!p.executable[index]) {
+            for (int32_t j = 0; j < successors_len(block); j++) {
+                int32_t target = block->targets[j];
+                int32_t pred;
+
+                while ((pred = pred_index(fn, target, index)) != -1)
+                    remove_pred(fn, target, pred);
+            }
+
+            for (int32_t j = 0; j < block->phis_len; j++)
+                fn->values[block->phis[j]].kind = IR_NOP;
+
+            for (int32_t j = 0; j < block->values_len; j++)
+                fn->values[block->values[j]].kind = IR_NOP;
+
+            block->terminator = IR_NONE;
+            block->reachable = 0;
+            continue;
+        }
+
+        block->reachable = 1;
+        fn->layout[layout_len++] = index;
+
+        for (int32_t j = 0; j < block->phis_len + block->values_len; j++) {
+            int32_t value = j < block->phis_len ? block->phis[j] : block->values[j - block->phis_len];
+            ir_value_t* v = &fn->values[value];
+
+            if (p.state[value] != LATTICE_CONST || (v->kind != IR_PHI && v->kind != IR_UNARY && v->kind != IR_BINARY))
+                continue;
+
+            v->kind = IR_CONST;
+            v->constant = p.constants[value];
+            v->operands_len = 0;
+        }
+
+        if (block->terminator == IR_CONDBR && p.state[block->operand] == LATTICE_CONST) {
+            int taken = p.constants[block->operand].i ? 0 : 1;
+            int32_t target = block->targets[taken];
+            int32_t skipped = block->targets[1 - taken];
+
+            block->terminator = IR_BR;
+            block->operand = -1;
+            block->targets[0] = target;
+            block->targets[1] = -1;
+
+            // a branch to the same block both ways has two edges to drop one of.
+            int32_t pred = pred_index(fn, skipped, index);
+            if (target == skipped) {
+                for (pred = fn->blocks[skipped].preds_len - 1; fn->blocks[skipped].preds[pred] != index; pred--);
+            }
+
+            remove_pred(fn, skipped, pred);
+        }
+    }
+
+    fn->layout_len = layout_len;
+
+    for (int32_t i = 0; i < fn->blocks_len; i++)
+        free(p.edges[i]);
+
+    free(p.edges);
+    free(p.executable);
+    free(p.constants);
+    free(p.state);
+
+    resolve_operands(fn);
+}
+
+static int int_constant(ir_fun_t* fn, int32_t value, int32_t* result)
+{
+    ir_value_t* v = &fn->values[value];
+
+    if (v->kind != IR_CONST || v->type != IR_INT)
+        return 0;
+
+    *result = v->constant.i;
+    return 1;
+}
+
+static void become_int(ir_fun_t* fn, int32_t value, int32_t constant)
+{
+    ir_value_t* v = &fn->values[value];
+
+    v->kind = IR_CONST;
+    v->type = IR_INT;
+    v->constant = (ir_const_t) { .type = IR_INT, .i = constant };
+    v->operands_len = 0;
+}
+
+// algebraic identities of int operations, values are computed once so an
+// operand that no longer matters is left to dead value elimination.
+static void simplify(ir_fun_t* fn)
+{
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+
+        for (int32_t j = 0; j < fn->blocks[index].values_len; j++) {
+            int32_t value = fn->blocks[index].values[j];
+            ir_value_t* v = &fn->values[value];
+
+            if (v->kind != IR_BINARY || fn->values[v->operands[0]].type != IR_INT)
+                continue;
+
+            int32_t lhs = v->operands[0];
+            int32_t rhs = v->operands[1];
+            int32_t l = 0, r = 0;
+            int lconst = int_constant(fn, lhs, &l);
+            int rconst = int_constant(fn, rhs, &r);
+            char op = v->op;
+
+            if (rconst && r == 0 && strchr("+-|^LR", op)) {
+                replace(fn, value, lhs);
+            } else if (lconst && l == 0 && strchr("+|^", op)) {
+                replace(fn, value, rhs);
+            } else if (rconst && r == 1 && strchr("*/", op)) {
+                replace(fn, value, lhs);
+            } else if (lconst && l == 1 && op == '*') {
+                replace(fn, value, rhs);
+            } else if (((lconst && l == 0) || (rconst && r == 0)) && strchr("*&", op)) {
+                become_int(fn, value, 0);
+            } else if (lhs == rhs && strchr("-^!<>", op)) {
+                become_int(fn, value, 0);
+            } else if (lhs == rhs && strchr("=lg", op)) {
+                become_int(fn, value, 1);
+            } else if (op == '*' && ((rconst && r > 1 && (r & (r - 1)) == 0) || (lconst && l > 1 && (l & (l - 1)) == 0))) {
+                int32_t factor = rconst && r > 1 && (r & (r - 1)) == 0 ? r : l;
+                int32_t operand = factor == r && rconst ? lhs : rhs;
+                int32_t shift = 0;
+
+                while ((1 << shift) != factor)
+                    shift++;
+
+                int32_t amount = ir_const_int(fn, index, shift);
+
+                v = &fn->values[value];
+                v->op = 'L';
+                v->operands[0] = operand;
+                v->operands[1] = amount;
+            }
+        }
+    }
+
+    resolve_operands(fn);
+}
+
+static int is_commutative(char op)
+{
+    return op == '+' || op == '*' || op == '&' || op == '|' || op == '^' || op == '=' || op == '!';
+}
+
+static int is_redundant_candidate(ir_value_t* value)
+{
+    switch (value->kind) {
+        case IR_UNARY:
+        case IR_BINARY:
+        case IR_INTRINSIC:
+            return 1;
+        case IR_CALL:
+            return value->pure;
+        default:
+            return 0;
+    }
+}
+
+static int same_value(ir_value_t* a, ir_value_t* b)
+{
+    if (a->kind != b->kind || a->type != b->type || a->op != b->op || a->index != b->index || a->emit != b->emit || a->operands_len != b->operands_len)
+        return 0;
+
+    if (a->kind == IR_BINARY && is_commutative(a->op) && a->operands[0] == b->operands[1] && a->operands[1] == b->operands[0])
+        return 1;
+
+    for (int32_t i = 0; i < a->operands_len; i++) {
+        if (a->operands[i] != b->operands[i])
+            return 0;
+    }
+
+    return 1;
+}
+
+typedef struct {
+    ir_fun_t* fn;
+    int32_t* idom;
+    int32_t** children;
+    int32_t* children_len;
+    int32_t* children_cap;
+    int32_t* available;
+    int32_t available_len;
+} redundancy_t;
+
+static void eliminate_in_subtree(redundancy_t* r, int32_t block)
+{
+    ir_fun_t* fn = r->fn;
+    int32_t available_len = r->available_len;
+
+    for (int32_t i = 0; i < fn->blocks[block].values_len; i++) {
+        int32_t value = fn->blocks[block].values[i];
+        ir_value_t* v = &fn->values[value];
+
+        if (!is_redundant_candidate(v))
+            continue;
+
+        for (int32_t j = 0; j < v->operands_len; j++)
+            v->operands[j] = ir_resolve(fn, v->operands[j]);
+
+        int32_t found = -1;
+
+        for (int32_t j = r->available_len - 1; j >= 0 && found == -1; j--) {
+            if (same_value(&fn->values[r->available[j]], v))
+                found = r->available[j];
+        }
+
+        if (found != -1) {
+            replace(fn, value, found);
+        } else {
+            r->available[r->available_len++] = value;
+        }
+    }
+
+    for (int32_t i = 0; i < r->children_len[block]; i++)
+        eliminate_in_subtree(r, r->children[block][i]);
+
+    r->available_len = available_len;
+}
+
+static void postorder(ir_fun_t* fn, int32_t block, int* visited, int32_t* order, int32_t* order_len)
+{
+    visited[block] = 1;
+
+    ir_block_t* b = &fn->blocks[block];
+
+    for (int i = 0; i < successors_len(b); i++) {
+        if (!visited[b->targets[i]])
+            postorder(fn, b->targets[i], visited, order, order_len);
+    }
+
+    order[(*order_len)++] = block;
+}
+
+// a value computed again where an equal one already dominates it is replaced
+// by the earlier one.
+static void eliminate_common_subexpressions(ir_fun_t* fn)
+{
+    int32_t entry = fn->layout[0];
+    int* visited = calloc(fn->blocks_len, sizeof(int));
+    int32_t* order = malloc(sizeof(int32_t) * fn->blocks_len);
+    int32_t* rpo = malloc(sizeof(int32_t) * fn->blocks_len);
+    int32_t order_len = 0;
+
+    postorder(fn, entry, visited, order, &order_len);
+
+    for (int32_t i = 0; i < order_len; i++)
+        rpo[order[i]] = order_len - 1 - i;
+
+    redundancy_t r = {
+        .fn = fn,
+        .idom = malloc(sizeof(int32_t) * fn->blocks_len),
+        .children = calloc(fn->blocks_len, sizeof(int32_t*)),
+        .children_len = calloc(fn->blocks_len, sizeof(int32_t)),
+        .children_cap = calloc(fn->blocks_len, sizeof(int32_t)),
+        .available = malloc(sizeof(int32_t) * (fn->values_len + 1)),
+        .available_len = 0,
+    };
+
+    for (int32_t i = 0; i < fn->blocks_len; i++)
+        r.idom[i] = -1;
+
+    r.idom[entry] = entry;
+
+    // cooper, harvey and kennedy's iterative dominators over reverse postorder.
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+
+        for (int32_t i = order_len - 2; i >= 0; i--) {
+            int32_t block = order[i];
+            int32_t idom = -1;
+
+            for (int32_t j = 0; j < fn->blocks[block].preds_len; j++) {
+                int32_t pred = fn->blocks[block].preds[j];
+
+                if (r.idom[pred] == -1)
+                    continue;
+
+                if (idom == -1) {
+                    idom = pred;
+                    continue;
+                }
+
+                int32_t a = pred, b = idom;
+
+                while (a != b) {
+                    while (rpo[a] > rpo[b])
+                        a = r.idom[a];
+                    while (rpo[b] > rpo[a])
+                        b = r.idom[b];
+                }
+
+                idom = a;
+            }
+
+            if (idom != r.idom[block]) {
+                r.idom[block] = idom;
+                changed = 1;
+            }
+        }
+    }
+
+    for (int32_t i = order_len - 2; i >= 0; i--) {
+        int32_t block = order[i];
+        int32_t parent = r.idom[block];
+
+        PUSH(r.children[parent], r.children_len[parent], r.children_cap[parent], block);
+    }
+
+    eliminate_in_subtree(&r, entry);
+
+    for (int32_t i = 0; i < fn->blocks_len; i++)
+        free(r.children[i]);
+
+    free(r.available);
+    free(r.children_cap);
+    free(r.children_len);
+    free(r.children);
+    free(r.idom);
+    free(rpo);
+    free(order);
+    free(visited);
+
+    resolve_operands(fn);
+}
+
+// whether the value must be computed even if nothing uses it.
+static int has_effect(ir_fun_t* fn, ir_value_t* value)
+{
+    int32_t divisor;
+
+    switch (value->kind) {
+        case IR_CALL:
+        case IR_PRINT:
+            return 1;
+        case IR_BINARY:
+            return value->type == IR_INT && (value->op == '/' || value->op == '%')
+                && !(int_constant(fn, value->operands[1], &divisor) && divisor != 0);
+        default:
+            return 0;
+    }
+}
+
+static void mark_live(uint8_t* live, int32_t* worklist, int32_t* worklist_len, int32_t value)
+{
+    if (live[value])
+        return;
+
+    live[value] = 1;
+    worklist[(*worklist_len)++] = value;
+}
+
+static void eliminate_dead_values(ir_fun_t* fn)
+{
+    uint8_t* live = calloc(fn->values_len, sizeof(uint8_t));
+    int32_t* worklist = malloc(sizeof(int32_t) * (fn->values_len + 1));
+    int32_t worklist_len = 0;
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        ir_block_t* block = &fn->blocks[fn->layout[i]];
+
+        for (int32_t j = 0; j < block->values_len; j++) {
+            if (has_effect(fn, &fn->values[block->values[j]]))
+                mark_live(live, worklist, &worklist_len, block->values[j]);
+        }
+
+        if (block->operand != -1)
+            mark_live(live, worklist, &worklist_len, block->operand);
+    }
+
+    while (worklist_len > 0) {
+        ir_value_t* value = &fn->values[worklist[--worklist_len]];
+
+        for (int32_t i = 0; i < value->operands_len; i++)
+            mark_live(live, worklist, &worklist_len, value->operands[i]);
+    }
+
+    for (int32_t i = 0; i < fn->values_len; i++) {
+        if (!live[i] && fn->values[i].kind != IR_NOP) {
+            fn->values[i].kind = IR_NOP;
+            fn->values[i].forward = -1;
+        }
+    }
+
+    free(worklist);
+    free(live);
+}
+
+void ir_optimize(ir_fun_t* fn)
+{
+    resolve_operands(fn);
+
+    // folding and identities expose each other, twice catches most of it.
+    for (int i = 0; i < 2; i++) {
+        remove_trivial_phis(fn);
+        propagate_constants(fn);
+        remove_trivial_phis(fn);
+        simplify(fn);
+        eliminate_common_subexpressions(fn);
+    }
+
+    eliminate_dead_values(fn);
+}
+
+typedef struct {
+    int32_t* values;
+    int32_t len;
+    int32_t cap;
+} list_t;
+
+static void list_prepend(list_t* list, const int32_t* values, int32_t len)
+{
+    for (int32_t i = 0; i < len; i++) {
+        PUSH(list->values, list->len, list->cap, 0);
+    }
+
+    memmove(list->values + len, list->values, sizeof(int32_t) * (list->len - len));
+    memcpy(list->values, values, sizeof(int32_t) * len);
+}
+
+typedef struct {
+    ir_fun_t* fn;
+    npb_t* pb;
+
+    // per block: operands pushed ahead of each position, a position per value
+    // then the phi copies and the terminator.
+    list_t** pushes;
+    list_t* copies; // phis of the successor, in the order their values are pushed
+
+    list_t stack; // values left on the operand stack while planning
+
+    // values sharing a slot, as a union-find forest and a circular list per
+    // class. the slot is kept by the root.
+    int32_t* parent;
+    int32_t* next;
+
+    // per block bitsets of the values live on entry and exit.
+    uint64_t* live_in;
+    uint64_t* live_out;
+    int32_t words;
+
+    int32_t slots_len;
+
+    // the entry block claims slots as its values end up on top of the frame,
+    // the rest is pushed at once the last time the operand stack was empty.
+    int dry;
+    int in_entry;
+    int claiming;
+    int32_t reserved;
+    int32_t height;
+    int32_t event;
+    int32_t last_clean;
+    int32_t pad_event;
+
+    list_t fixups; // (offset, block) pairs of branches to patch
+    int32_t* addrs;
+} lowering_t;
+
+static void remove_nops(int32_t* values, int32_t* len, ir_fun_t* fn, ir_kind_t keep)
+{
+    int32_t kept = 0;
+
+    for (int32_t i = 0; i < *len; i++) {
+        ir_kind_t kind = fn->values[values[i]].kind;
+
+        if (kind != IR_NOP && (keep == IR_NOP || kind == keep))
+            values[kept++] = values[i];
+    }
+
+    *len = kept;
+}
+
+// a phi copy on an edge out of a conditional branch would run on both paths,
+// so such edges get a block of their own.
+static void split_critical_edges(ir_fun_t* fn)
+{
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+
+        if (fn->blocks[index].phis_len == 0)
+            continue;
+
+        for (int32_t j = 0; j < fn->blocks[index].preds_len; j++) {
+            int32_t pred = fn->blocks[index].preds[j];
+
+            if (fn->blocks[pred].terminator != IR_CONDBR)
+                continue;
+
+            int32_t split = ir_block_new(fn);
+            ir_block_t* block = &fn->blocks[split];
+
+            block->terminator = IR_BR;
+            block->targets[0] = index;
+            block->reachable = 1;
+            PUSH(block->preds, block->preds_len, block->preds_cap, pred);
+
+            ir_block_t* p = &fn->blocks[pred];
+            p->targets[p->targets[0] == index ? 0 : 1] = split;
+            fn->blocks[index].preds[j] = split;
+
+            PUSH(fn->layout, fn->layout_len, fn->layout_cap, 0);
+            memmove(fn->layout + i + 1, fn->layout + i, sizeof(int32_t) * (fn->layout_len - i - 1));
+            fn->layout[i++] = split;
+        }
+    }
+}
+
+static void prepare(ir_fun_t* fn)
+{
+    resolve_operands(fn);
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+        ir_block_t* block = &fn->blocks[index];
+
+        remove_nops(block->phis, &block->phis_len, fn, IR_PHI);
+        remove_nops(block->values, &block->values_len, fn, IR_NOP);
+
+        if (block->terminator == IR_CONDBR && block->targets[0] == block->targets[1]) {
+            int32_t target = block->targets[0];
+            int32_t pred = fn->blocks[target].preds_len - 1;
+
+            while (fn->blocks[target].preds[pred] != index)
+                pred--;
+
+            remove_pred(fn, target, pred);
+
+            // the condition is still evaluated for its effects.
+            block->terminator = IR_BR;
+            block->targets[1] = -1;
+            block->operand = -1;
+        }
+    }
+
+    split_critical_edges(fn);
+
+    for (int32_t i = 0; i < fn->values_len; i++) {
+        fn->values[i].uses = 0;
+        fn->values[i].user_block = -1;
+    }
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+        ir_block_t* block = &fn->blocks[index];
+
+        for (int32_t j = 0; j < block->phis_len; j++) {
+            ir_value_t* phi = &fn->values[block->phis[j]];
+
+            // copied at the end of the predecessor.
+            for (int32_t k = 0; k < phi->operands_len; k++) {
+                fn->values[phi->operands[k]].uses++;
+                fn->values[phi->operands[k]].user_block = block->preds[k];
+            }
+        }
+
+        for (int32_t j = 0; j < block->values_len; j++) {
+            ir_value_t* value = &fn->values[block->values[j]];
+
+            for (int32_t k = 0; k < value->operands_len; k++) {
+                fn->values[value->operands[k]].uses++;
+                fn->values[value->operands[k]].user_block = index;
+            }
+        }
+
+        if (block->operand != -1) {
+            fn->values[block->operand].uses++;
+            fn->values[block->operand].user_block = index;
+        }
+    }
+}
+
+static int is_rematerialized(ir_value_t* value)
+{
+    return value->kind == IR_CONST || value->kind == IR_ARG;
+}
+
+static int is_materialized(ir_value_t* value)
+{
+    if (value->kind == IR_PHI)
+        return 1;
+
+    return !is_rematerialized(value) && value->kind != IR_NOP && value->type != IR_VOID && value->uses > 0 && !value->left;
+}
+
+static int32_t find(lowering_t* l, int32_t value)
+{
+    while (l->parent[value] != value) {
+        l->parent[value] = l->parent[l->parent[value]];
+        value = l->parent[value];
+    }
+
+    return value;
+}
+
+static void stack_remove(lowering_t* l, int32_t value)
+{
+    list_t* stack = &l->stack;
+
+    for (int32_t i = 0; i < stack->len; i++) {
+        if (stack->values[i] == value) {
+            memmove(stack->values + i, stack->values + i + 1, sizeof(int32_t) * (stack->len - i - 1));
+            stack->len--;
+            break;
+        }
+    }
+
+    l->fn->values[value].left = 0;
+    l->fn->values[value].on_stack = 0;
+}
+
+// plans how the operands of the instruction at `position` get on the operand
+// stack: values left there by earlier instructions are used in place when
+// they are on top in order, the others are pushed, ahead of time if needed.
+// returns the position the instruction's own pushes start at.
+static int32_t plan_operands(lowering_t* l, int32_t block, int32_t position, const int32_t* ops, int32_t ops_len)
+{
+    ir_fun_t* fn = l->fn;
+    list_t* stack = &l->stack;
+    int32_t* at = malloc(sizeof(int32_t) * (ops_len + 1));
+
+    for (;;) {
+        // the operands left on the stack must be its top entries, in order.
+        int32_t matched = 0;
+        int32_t on_stack = 0;
+
+        for (int32_t i = 0; i < ops_len; i++)
+            on_stack += fn->values[ops[i]].on_stack;
+
+        for (int32_t q = on_stack; q > 0 && !matched; q--) {
+            if (q > stack->len)
+                continue;
+
+            int32_t seen = 0;
+            int match = 1;
+
+            for (int32_t i = 0; i < ops_len && match; i++) {
+                if (!fn->values[ops[i]].on_stack)
+                    continue;
+
+                if (seen++ >= on_stack - q && stack->values[stack->len - on_stack + seen - 1] != ops[i])
+                    match = 0;
+            }
+
+            if (match)
+                matched = q;
+        }
+
+        // the rest are pushed and get a slot if they're computed.
+        int32_t skipped = on_stack - matched;
+
+        for (int32_t i = 0; i < ops_len && skipped > 0; i++) {
+            if (fn->values[ops[i]].on_stack) {
+                stack_remove(l, ops[i]);
+                skipped--;
+            }
+        }
+
+        int32_t next = position;
+        int32_t culprit = -1;
+        int32_t last = -1;
+
+        for (int32_t i = ops_len - 1; i >= 0; i--) {
+            ir_value_t* op = &fn->values[ops[i]];
+
+            if (op->on_stack) {
+                next = op->start;
+                last = ops[i];
+                continue;
+            }
+
+            at[i] = next;
+
+            // a computed value can't be pushed before it's stored.
+            if (op->kind != IR_PHI && !is_rematerialized(op) && op->block == block && op->position >= next) {
+                culprit = last;
+                break;
+            }
+        }
+
+        if (culprit == -1)
+            break;
+
+        stack_remove(l, culprit);
+    }
+
+    int32_t start = position;
+
+    for (int32_t i = ops_len - 1; i >= 0; i--) {
+        ir_value_t* op = &fn->values[ops[i]];
+
+        if (op->on_stack) {
+            start = op->start;
+            stack->len--;
+            op->on_stack = 0;
+            continue;
+        }
+
+        start = at[i];
+
+        // contiguous pushes share a position.
+        int32_t first = i;
+        while (first > 0 && !fn->values[ops[first - 1]].on_stack && at[first - 1] == at[i])
+            first--;
+
+        list_t* pushes = &l->pushes[block][at[i]];
+
+        if (at[i] == position) {
+            for (int32_t j = first; j <= i; j++) {
+                PUSH(pushes->values, pushes->len, pushes->cap, ops[j]);
+            }
+        } else {
+            list_prepend(pushes, ops + first, i - first + 1);
+        }
+
+        i = first;
+    }
+
+    free(at);
+    return start;
+}
+
+static void plan_block(lowering_t* l, int32_t index)
+{
+    ir_fun_t* fn = l->fn;
+    ir_block_t* block = &fn->blocks[index];
+
+    l->pushes[index] = calloc(block->values_len + 2, sizeof(list_t));
+    l->stack.len = 0;
+
+    for (int32_t i = 0; i < block->values_len; i++)
+        fn->values[block->values[i]].position = i;
+
+    for (int32_t i = 0; i < block->values_len; i++) {
+        int32_t value = block->values[i];
+        ir_value_t* v = &fn->values[value];
+
+        if (is_rematerialized(v))
+            continue;
+
+        int32_t start = plan_operands(l, index, i, v->operands, v->operands_len);
+
+        v = &fn->values[value];
+        v->start = start;
+
+        if (v->type != IR_VOID && v->uses == 1 && v->user_block == index && l->next[value] == value) {
+            v->left = 1;
+            v->on_stack = 1;
+            PUSH(l->stack.values, l->stack.len, l->stack.cap, value);
+        }
+    }
+
+    list_t* copies = &l->copies[index];
+
+    if (block->terminator == IR_BR && fn->blocks[block->targets[0]].phis_len > 0) {
+        ir_block_t* target = &fn->blocks[block->targets[0]];
+        int32_t pred = pred_index(fn, block->targets[0], index);
+
+        // values already on the stack go first, in stack order.
+        for (int32_t i = 0; i < l->stack.len; i++) {
+            for (int32_t j = 0; j < target->phis_len; j++) {
+                int32_t phi = target->phis[j];
+
+                if (fn->values[phi].operands[pred] == l->stack.values[i] && find(l, phi) != find(l, l->stack.values[i])) {
+                    PUSH(copies->values, copies->len, copies->cap, phi);
+                }
+            }
+        }
+
+        for (int32_t j = 0; j < target->phis_len; j++) {
+            int32_t phi = target->phis[j];
+            int32_t incoming = fn->values[phi].operands[pred];
+
+            if (find(l, incoming) != find(l, phi) && !fn->values[incoming].on_stack) {
+                PUSH(copies->values, copies->len, copies->cap, phi);
+            }
+        }
+
+        int32_t* ops = malloc(sizeof(int32_t) * (copies->len + 1));
+
+        for (int32_t i = 0; i < copies->len; i++)
+            ops[i] = fn->values[copies->values[i]].operands[pred];
+
+        plan_operands(l, index, block->values_len, ops, copies->len);
+        free(ops);
+    }
+
+    if (block->operand != -1)
+        plan_operands(l, index, block->values_len + 1, &block->operand, 1);
+
+    while (l->stack.len > 0)
+        stack_remove(l, l->stack.values[l->stack.len - 1]);
+}
+
+static int is_live(uint64_t* set, int32_t value)
+{
+    return (set[value / 64] >> (value % 64)) & 1;
+}
+
+static void set_live(uint64_t* set, int32_t value)
+{
+    set[value / 64] |= (uint64_t)1 << (value % 64);
+}
+
+static int is_tracked(ir_value_t* value)
+{
+    return value->kind != IR_NOP && !is_rematerialized(value) && value->type != IR_VOID;
+}
+
+// backwards dataflow over the blocks, a phi operand is used at the end of
+// its predecessor and the phi is defined on entry to its block.
+static void compute_liveness(lowering_t* l)
+{
+    ir_fun_t* fn = l->fn;
+
+    l->words = fn->values_len / 64 + 1;
+    l->live_in = calloc(fn->blocks_len * l->words, sizeof(uint64_t));
+    l->live_out = calloc(fn->blocks_len * l->words, sizeof(uint64_t));
+
+    uint64_t* gen = calloc(fn->blocks_len * l->words, sizeof(uint64_t));
+    uint64_t* kill = calloc(fn->blocks_len * l->words, sizeof(uint64_t));
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+        ir_block_t* block = &fn->blocks[index];
+        uint64_t* g = gen + index * l->words;
+
+        for (int32_t j = 0; j < block->phis_len; j++)
+            set_live(kill + index * l->words, block->phis[j]);
+
+        for (int32_t j = 0; j < block->values_len; j++) {
+            ir_value_t* value = &fn->values[block->values[j]];
+
+            for (int32_t k = 0; k < value->operands_len; k++) {
+                int32_t operand = value->operands[k];
+
+                if (is_tracked(&fn->values[operand]) && fn->values[operand].block != index)
+                    set_live(g, operand);
+            }
+
+            set_live(kill + index * l->words, block->values[j]);
+        }
+
+        if (block->operand != -1 && is_tracked(&fn->values[block->operand]) && fn->values[block->operand].block != index)
+            set_live(g, block->operand);
+    }
+
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+
+        for (int32_t i = fn->layout_len - 1; i >= 0; i--) {
+            int32_t index = fn->layout[i];
+            ir_block_t* block = &fn->blocks[index];
+            uint64_t* in = l->live_in + index * l->words;
+            uint64_t* out = l->live_out + index * l->words;
+
+            for (int32_t j = 0; j < successors_len(block); j++) {
+                int32_t target = block->targets[j];
+                ir_block_t* t = &fn->blocks[target];
+
+                for (int32_t w = 0; w < l->words; w++)
+                    out[w] |= l->live_in[target * l->words + w];
+
+                if (t->phis_len == 0)
+                    continue;
+
+                int32_t pred = pred_index(fn, target, index);
+
+                for (int32_t k = 0; k < t->phis_len; k++) {
+                    int32_t incoming = fn->values[t->phis[k]].operands[pred];
+
+                    if (is_tracked(&fn->values[incoming]))
+                        set_live(out, incoming);
+                }
+            }
+
+            for (int32_t w = 0; w < l->words; w++) {
+                uint64_t live = gen[index * l->words + w] | (out[w] & ~kill[index * l->words + w]);
+
+                if (live != in[w]) {
+                    in[w] = live;
+                    changed = 1;
+                }
+            }
+        }
+    }
+
+    free(kill);
+    free(gen);
+}
+
+// whether `value` is still needed right after position `position` of the
+// block, -1 being the phis on entry.
+static int is_live_after(lowering_t* l, int32_t value, int32_t block, int32_t position)
+{
+    ir_fun_t* fn = l->fn;
+    ir_value_t* v = &fn->values[value];
+    ir_block_t* b = &fn->blocks[block];
+
+    int defined = v->block == block
+        ? v->kind == IR_PHI || v->position < position
+        : is_live(l->live_in + block * l->words, value);
+
+    if (!defined)
+        return 0;
+
+    if (is_live(l->live_out + block * l->words, value) || b->operand == value)
+        return 1;
+
+    for (int32_t i = position + 1; i < b->values_len; i++) {
+        ir_value_t* user = &fn->values[b->values[i]];
+
+        for (int32_t j = 0; j < user->operands_len; j++) {
+            if (user->operands[j] == value)
+                return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int is_live_at_definition(lowering_t* l, int32_t value, int32_t of)
+{
+    ir_value_t* v = &l->fn->values[of];
+
+    // phis of a block are all written together.
+    if (v->kind == IR_PHI)
+        return l->fn->values[value].kind == IR_PHI && l->fn->values[value].block == v->block
+            ? 1
+            : is_live(l->live_in + v->block * l->words, value);
+
+    return is_live_after(l, value, v->block, v->position);
+}
+
+static int interferes(lowering_t* l, int32_t a, int32_t b)
+{
+    for (int32_t x = a;; x = l->next[x]) {
+        for (int32_t y = b;; y = l->next[y]) {
+            if (is_live_at_definition(l, x, y) || is_live_at_definition(l, y, x))
+                return 1;
+
+            if (l->next[y] == b)
+                break;
+        }
+
+        if (l->next[x] == a)
+            return 0;
+    }
+}
+
+// a phi and the values flowing into it share a slot when their lifetimes
+// don't overlap, which removes the copy between them.
+static void coalesce(lowering_t* l)
+{
+    ir_fun_t* fn = l->fn;
+
+    compute_liveness(l);
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        ir_block_t* block = &fn->blocks[fn->layout[i]];
+
+        for (int32_t j = 0; j < block->phis_len; j++) {
+            int32_t phi = block->phis[j];
+
+            for (int32_t k = 0; k < fn->values[phi].operands_len; k++) {
+                int32_t incoming = fn->values[phi].operands[k];
+                int32_t a = find(l, phi);
+                int32_t b = find(l, incoming);
+
+                if (a == b || !is_tracked(&fn->values[incoming]) || !is_materialized(&fn->values[incoming]))
+                    continue;
+
+                if (interferes(l, a, b))
+                    continue;
+
+                l->parent[b] = a;
+
+                int32_t next = l->next[a];
+                l->next[a] = l->next[b];
+                l->next[b] = next;
+            }
+        }
+    }
+
+    free(l->live_in);
+    free(l->live_out);
+}
+
+// the operand stack may grow past the slots only once they're all there.
+static void boundary(lowering_t* l)
+{
+    if (l->dry) {
+        if (l->height == l->reserved)
+            l->last_clean = l->event;
+    } else if (l->event == l->pad_event) {
+        for (; l->reserved < l->slots_len; l->reserved++) {
+            npb_ipush(l->pb, 0);
+            l->height++;
+        }
+    }
+
+    l->event++;
+}
+
+static void stop_claiming(lowering_t* l)
+{
+    if (l->claiming) {
+        l->claiming = 0;
+        l->pad_event = l->last_clean;
+    }
+}
+
+static void push_value(lowering_t* l, int32_t index)
+{
+    ir_value_t* value = &l->fn->values[index];
+
+    boundary(l);
+
+    switch (value->kind) {
+        case IR_CONST:
+            if (value->type == IR_INT) {
+                npb_ipush(l->pb, value->constant.i);
+            } else {
+                npb_dpush(l->pb, value->constant.d);
+            }
+            break;
+        case IR_ARG:
+            npb_loadarg(l->pb, value->index);
+            break;
+        default:
+            npb_dup(l->pb, l->fn->values[find(l, index)].slot);
+            break;
+    }
+
+    l->height++;
+}
+
+static void store_value(lowering_t* l, int32_t index)
+{
+    ir_value_t* value = &l->fn->values[index];
+    ir_value_t* root = &l->fn->values[find(l, index)];
+
+    if (l->dry) {
+        if (root->slot == -1 && l->claiming && l->height == l->reserved + 1) {
+            value->claimed = 1;
+            root->slot = l->reserved++;
+            return;
+        }
+
+        if (root->slot == -1)
+            stop_claiming(l);
+    } else if (value->claimed && l->in_entry) {
+        l->reserved++;
+        return;
+    }
+
+    npb_set(l->pb, root->slot);
+    l->height--;
+}
+
+static void emit_binary(npb_t* pb, char op, ir_type_t type)
+{
+    int is_int = type == IR_INT;
+
+    switch (op) {
+        case '+': is_int ? npb_iadd(pb) : npb_dadd(pb); break;
+        case '-': is_int ? npb_isub(pb) : npb_dsub(pb); break;
+        case '*': is_int ? npb_imul(pb) : npb_dmul(pb); break;
+        case '/': is_int ? npb_idiv(pb) : npb_ddiv(pb); break;
+        case '%': npb_imod(pb); break;
+        case '&': npb_iand(pb); break;
+        case '|': npb_ior(pb); break;
+        case '^': npb_ixor(pb); break;
+        case 'L': npb_ishl(pb); break;
+        case 'R': npb_ishr(pb); break;
+        case '=': is_int ? npb_ieq(pb) : npb_deq(pb); break;
+        case '!': is_int ? npb_ineq(pb) : npb_dneq(pb); break;
+        case '<': is_int ? npb_ilt(pb) : npb_dlt(pb); break;
+        case '>': is_int ? npb_igt(pb) : npb_dgt(pb); break;
+        case 'l': is_int ? npb_ilte(pb) : npb_dlte(pb); break;
+        case 'g': is_int ? npb_igte(pb) : npb_dgte(pb); break;
+        default:  assert(0 && "UNKNOWN BINARY OP");
+    }
+}
+
+static void emit_branch(lowering_t* l, void (*branch)(npb_t* pb, int32_t addr), int32_t target)
+{
+    PUSH(l->fixups.values, l->fixups.len, l->fixups.cap, l->pb->program_len);
+    PUSH(l->fixups.values, l->fixups.len, l->fixups.cap, target);
+
+    branch(l->pb, -1);
+}
+
+static void emit_block(lowering_t* l, int32_t index, int32_t next)
+{
+    ir_fun_t* fn = l->fn;
+    npb_t* pb = l->pb;
+    ir_block_t* block = &fn->blocks[index];
+    list_t* pushes = l->pushes[index];
+
+    for (int32_t i = 0; i < block->values_len; i++) {
+        int32_t index = block->values[i];
+        ir_value_t* value = &fn->values[index];
+
+        for (int32_t j = 0; j < pushes[i].len; j++)
+            push_value(l, pushes[i].values[j]);
+
+        if (is_rematerialized(value))
+            continue;
+
+        boundary(l);
+
+        switch (value->kind) {
+            case IR_UNARY:
+                if (value->op == '!') {
+                    npb_ipush(pb, 0);
+                    npb_ieq(pb);
+                } else if (value->type == IR_INT) {
+                    npb_ipush(pb, -1);
+                    npb_imul(pb);
+                } else {
+                    npb_dpush(pb, -1.0);
+                    npb_dmul(pb);
+                }
+                break;
+            case IR_BINARY:
+                emit_binary(pb, value->op, fn->values[value->operands[0]].type);
+                l->height--;
+                break;
+            case IR_CALL:
+                npb_call(pb, value->index, value->operands_len);
+                l->height -= value->operands_len - (value->type != IR_VOID);
+                break;
+            case IR_INTRINSIC:
+                value->emit(pb);
+                l->height -= value->operands_len - 1;
+                break;
+            case IR_PRINT:
+                npb_print(pb);
+                l->height--;
+                break;
+            default:
+                assert(0 && "UNREACHABLE");
+        }
+
+        if (is_materialized(value)) {
+            store_value(l, index);
+        } else if (!value->left && value->type != IR_VOID) {
+            npb_pop(pb);
+            l->height--;
+        }
+    }
+
+    list_t* copies = &l->copies[index];
+    list_t* copy_pushes = &pushes[block->values_len];
+
+    for (int32_t j = 0; j < copy_pushes->len; j++)
+        push_value(l, copy_pushes->values[j]);
+
+    if (copies->len > 0) {
+        boundary(l);
+
+        int claimable = l->dry && l->claiming && l->height == l->reserved + copies->len;
+
+        for (int32_t i = 0; i < copies->len && claimable; i++)
+            claimable = fn->values[find(l, copies->values[i])].slot == -1;
+
+        if (claimable) {
+            for (int32_t i = 0; i < copies->len; i++) {
+                fn->values[copies->values[i]].claimed = 1;
+                fn->values[find(l, copies->values[i])].slot = l->reserved++;
+            }
+        } else {
+            // every value is pushed before any phi is overwritten.
+            for (int32_t i = copies->len - 1; i >= 0; i--)
+                store_value(l, copies->values[i]);
+        }
+    }
+
+    list_t* terminator_pushes = &pushes[block->values_len + 1];
+
+    for (int32_t j = 0; j < terminator_pushes->len; j++)
+        push_value(l, terminator_pushes->values[j]);
+
+    boundary(l);
+
+    if (block->terminator == IR_BR || block->terminator == IR_CONDBR) {
+        if (l->dry && l->reserved < l->slots_len)
+            stop_claiming(l);
+    }
+
+    switch (block->terminator) {
+        case IR_BR:
+            if (block->targets[0] != next)
+                emit_branch(l, npb_br, block->targets[0]);
+            break;
+        case IR_CONDBR:
+            if (block->targets[1] == next) {
+                emit_branch(l, npb_brit, block->targets[0]);
+            } else if (block->targets[0] == next) {
+                emit_branch(l, npb_brif, block->targets[1]);
+            } else {
+                emit_branch(l, npb_brit, block->targets[0]);
+                emit_branch(l, npb_br, block->targets[1]);
+            }
+
+            l->height--;
+            break;
+        case IR_RET:
+            npb_ret(pb);
+            break;
+        case IR_RETVOID:
+            npb_retvoid(pb);
+            break;
+        case IR_HALT:
+            npb_halt(pb);
+            break;
+        case IR_NONE:
+            assert(0 && "UNTERMINATED BLOCK");
+    }
+}
+
+// values live in frame slots only when they can't be left on the operand
+// stack for their user, constants and arguments are pushed where needed.
+void ir_lower(ir_fun_t* fn, npb_t* pb)
+{
+    prepare(fn);
+
+    lowering_t l = {
+        .fn = fn,
+        .pb = pb,
+        .pushes = calloc(fn->blocks_len, sizeof(list_t*)),
+        .copies = calloc(fn->blocks_len, sizeof(list_t)),
+        .parent = malloc(sizeof(int32_t) * fn->values_len),
+        .next = malloc(sizeof(int32_t) * fn->values_len),
+        .addrs = malloc(sizeof(int32_t) * fn->blocks_len),
+        .pad_event = -1,
+    };
+
+    for (int32_t i = 0; i < fn->values_len; i++) {
+        l.parent[i] = i;
+        l.next[i] = i;
+    }
+
+    for (int32_t i = 0; i < fn->layout_len; i++)
+        plan_block(&l, fn->layout[i]);
+
+    coalesce(&l);
+
+    // planned again now that some copies are gone and some values need a slot.
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        int32_t index = fn->layout[i];
+        ir_block_t* block = &fn->blocks[index];
+
+        for (int32_t j = 0; j < block->values_len; j++) {
+            ir_value_t* value = &fn->values[block->values[j]];
+            value->left = 0;
+            value->on_stack = 0;
+        }
+
+        for (int32_t j = 0; j < block->values_len + 2; j++)
+            free(l.pushes[index][j].values);
+
+        free(l.pushes[index]);
+        l.copies[index].len = 0;
+    }
+
+    for (int32_t i = 0; i < fn->layout_len; i++)
+        plan_block(&l, fn->layout[i]);
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        ir_block_t* block = &fn->blocks[fn->layout[i]];
+
+        for (int32_t j = 0; j < block->phis_len + block->values_len; j++) {
+            int32_t value = j < block->phis_len ? block->phis[j] : block->values[j - block->phis_len];
+            l.slots_len += is_materialized(&fn->values[value]) && find(&l, value) == value;
+        }
+    }
+
+    // a dry run of the entry block decides which slots it claims.
+    npb_t scratch;
+    npb_init(&scratch);
+
+    l.pb = &scratch;
+    l.dry = 1;
+    l.in_entry = 1;
+    l.claiming = 1;
+    emit_block(&l, fn->layout[0], fn->layout_len > 1 ? fn->layout[1] : -1);
+
+    if (l.claiming)
+        l.pad_event = -1;
+
+    int32_t slot = l.reserved;
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        ir_block_t* block = &fn->blocks[fn->layout[i]];
+
+        for (int32_t j = 0; j < block->phis_len + block->values_len; j++) {
+            int32_t value = j < block->phis_len ? block->phis[j] : block->values[j - block->phis_len];
+            ir_value_t* root = &fn->values[find(&l, value)];
+
+            if (is_materialized(&fn->values[value]) && root->slot == -1)
+                root->slot = slot++;
+        }
+    }
+
+    assert(slot == l.slots_len);
+    npb_free(&scratch);
+
+    l.pb = pb;
+    l.dry = 0;
+    l.reserved = 0;
+    l.height = 0;
+    l.event = 0;
+    l.fixups.len = 0;
+
+    for (int32_t i = 0; i < fn->layout_len; i++) {
+        l.addrs[fn->layout[i]] = pb->program_len;
+        l.in_entry = i == 0;
+        emit_block(&l, fn->layout[i], i + 1 < fn->layout_len ? fn->layout[i + 1] : -1);
+    }
+
+    for (int32_t i = 0; i < l.fixups.len; i += 2) {
+        int32_t addr = l.addrs[l.fixups.values[i + 1]];
+        memcpy(pb->program + l.fixups.values[i] + 1, &addr, sizeof(addr));
+    }
+
+    for (int32_t i = 0; i < fn->blocks_len; i++) {
+        if (!l.pushes[i])
+            continue;
+
+        for (int32_t j = 0; j < fn->blocks[i].values_len + 2; j++)
+            free(l.pushes[i][j].values);
+
+        free(l.pushes[i]);
+        free(l.copies[i].values);
+    }
+
+    free(l.pushes);
+    free(l.copies);
+    free(l.parent);
+    free(l.next);
+    free(l.addrs);
+    free(l.fixups.values);
+    free(l.stack.values);
+}
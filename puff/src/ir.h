@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "vm.h"
+
+// mid-level representation of a function, between the ast and the bytecode.
+// basic blocks of typed instructions in ssa form: every value is assigned
+// exactly once, variables are resolved to values while building.
+
+typedef enum {
+    IR_VOID,
+    IR_INT,
+    IR_DOUBLE,
+} ir_type_t;
+
+typedef struct {
+    ir_type_t type; // IR_INT or IR_DOUBLE
+    union {
+        int32_t i;
+        double d;
+    };
+} ir_const_t;
+
+// constant folding with the vm's int32/double semantics, operations that
+// would trap aren't folded so the error still happens at runtime.
+int ir_fold_int(char op, int32_t a, int32_t b, int32_t* result);
+int ir_fold_double(char op, double a, double b, ir_const_t* result);
+
+typedef enum {
+    IR_NOP, // removed, or replaced by `forward`
+    IR_CONST,
+    IR_ARG,
+    IR_PHI, // one operand per predecessor of its block
+    IR_UNARY, // '-' or '!'
+    IR_BINARY, // ops as in expr_binary_t, except && and ||
+    IR_CALL,
+    IR_INTRINSIC,
+    IR_PRINT,
+} ir_kind_t;
+
+// a value is the instruction computing it.
+typedef struct {
+    ir_kind_t kind;
+    ir_type_t type;
+    char op;
+    int32_t index; // IR_ARG argument, IR_CALL address, IR_PHI variable
+    int pure; // IR_CALL of a function without side effects
+    ir_const_t constant;
+    void (*emit)(npb_t* pb); // IR_INTRINSIC
+
+    int32_t* operands;
+    int32_t operands_len;
+    int32_t operands_cap;
+
+    int32_t block;
+    int32_t forward; // value this one was replaced with, -1 if none
+
+    // set while lowering.
+    int32_t uses;
+    int32_t user_block;
+    int32_t slot;
+    int32_t position; // index in its block
+    int32_t start;
+    int left; // left on the operand stack for its only user
+    int on_stack;
+    int claimed;
+} ir_value_t;
+
+typedef enum {
+    IR_NONE,
+    IR_BR,
+    IR_CONDBR,
+    IR_RET,
+    IR_RETVOID,
+    IR_HALT,
+} ir_terminator_t;
+
+typedef struct {
+    int32_t* phis;
+    int32_t phis_len;
+    int32_t phis_cap;
+
+    int32_t* values;
+    int32_t values_len;
+    int32_t values_cap;
+
+    int32_t* preds;
+    int32_t preds_len;
+    int32_t preds_cap;
+
+    ir_terminator_t terminator;
+    int32_t operand; // IR_CONDBR condition, IR_RET value
+    int32_t targets[2]; // IR_BR target, IR_CONDBR true then false target
+
+    // current value of each variable, -1 if unknown.
+    int32_t* defs;
+    int32_t defs_len;
+
+    // phis created before every predecessor was known.
+    int32_t* incomplete;
+    int32_t incomplete_len;
+    int32_t incomplete_cap;
+    int sealed;
+
+    int reachable;
+} ir_block_t;
+
+typedef struct {
+    ir_value_t* values;
+    int32_t values_len;
+    int32_t values_cap;
+
+    ir_block_t* blocks;
+    int32_t blocks_len;
+    int32_t blocks_cap;
+
+    // order the blocks are emitted in.
+    int32_t* layout;
+    int32_t layout_len;
+    int32_t layout_cap;
+
+    ir_type_t* vars;
+    int32_t vars_len;
+    int32_t vars_cap;
+} ir_fun_t;
+
+void ir_fun_init(ir_fun_t* fn);
+void ir_fun_free(ir_fun_t* fn);
+
+int32_t ir_block_new(ir_fun_t* fn);
+
+// appends the block to the layout.
+void ir_block_place(ir_fun_t* fn, int32_t block);
+
+// moves layout[from..middle) after the blocks placed since.
+void ir_layout_rotate(ir_fun_t* fn, int32_t from, int32_t middle);
+
+// no more predecessors will be added to the block.
+void ir_block_seal(ir_fun_t* fn, int32_t block);
+
+int32_t ir_var_new(ir_fun_t* fn, ir_type_t type);
+void ir_var_write(ir_fun_t* fn, int32_t var, int32_t block, int32_t value);
+int32_t ir_var_read(ir_fun_t* fn, int32_t var, int32_t block);
+
+int32_t ir_const_int(ir_fun_t* fn, int32_t block, int32_t value);
+int32_t ir_const_double(ir_fun_t* fn, int32_t block, double value);
+int32_t ir_arg(ir_fun_t* fn, int32_t block, int32_t index, ir_type_t type);
+int32_t ir_unary(ir_fun_t* fn, int32_t block, char op, int32_t operand);
+int32_t ir_binary(ir_fun_t* fn, int32_t block, char op, int32_t lhs, int32_t rhs);
+int32_t ir_call(ir_fun_t* fn, int32_t block, int32_t addr, ir_type_t type, int pure, const int32_t* args, int32_t args_len);
+int32_t ir_intrinsic(ir_fun_t* fn, int32_t block, void (*emit)(npb_t* pb), ir_type_t type, const int32_t* args, int32_t args_len);
+int32_t ir_print(ir_fun_t* fn, int32_t block, int32_t operand);
+
+void ir_br(ir_fun_t* fn, int32_t block, int32_t target);
+void ir_condbr(ir_fun_t* fn, int32_t block, int32_t condition, int32_t true_target, int32_t false_target);
+void ir_ret(ir_fun_t* fn, int32_t block, int32_t value);
+void ir_retvoid(ir_fun_t* fn, int32_t block);
+void ir_halt(ir_fun_t* fn, int32_t block);
+
+int32_t ir_resolve(ir_fun_t* fn, int32_t value);
+
+// copy propagation, conditional constant propagation, common subexpression
+// and dead value elimination.
+void ir_optimize(ir_fun_t* fn);
+
+// emits the function, the first placed block is the entry.
+void ir_lower(ir_fun_t* fn, npb_t* pb);
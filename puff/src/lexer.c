@@ -1,17 +1,81 @@
 #include "lexer.h"
 
 #include <assert.h>
-#include <ctype.h>
-#include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define CHAR_SPACE 1
+#define CHAR_DIGIT 2
+#define CHAR_ALPHA 4 // letters and '_'
+
+// ascii only, unlike ctype it doesn't depend on the locale.
+static const uint8_t char_classes[256] = {
+    [' '] = CHAR_SPACE,
+    ['\t'] = CHAR_SPACE,
+    ['\n'] = CHAR_SPACE,
+    ['\v'] = CHAR_SPACE,
+    ['\f'] = CHAR_SPACE,
+    ['\r'] = CHAR_SPACE,
+    ['0' ... '9'] = CHAR_DIGIT,
+    ['A' ... 'Z'] = CHAR_ALPHA,
+    ['a' ... 'z'] = CHAR_ALPHA,
+    ['_'] = CHAR_ALPHA,
+};
+
+typedef struct {
+    const char* keyword;
+    token_kind_t kind;
+} keyword_t;
+
+static const keyword_t keywords[] = {
+    { "int", TOK_INT },
+    { "double", TOK_DOUBLE },
+    { "void", TOK_VOID },
+    { "let", TOK_LET },
+    { "set", TOK_SET },
+    { "fun", TOK_FUN },
+    { "return", TOK_RETURN },
+    { "if", TOK_IF },
+    { "else", TOK_ELSE },
+    { "match", TOK_MATCH },
+    { "case", TOK_CASE },
+    { "while", TOK_WHILE },
+    { "inline", TOK_INLINE },
+    { "extern", TOK_EXTERN },
+};
+
+#define KEYWORDS_LEN (int)(sizeof(keywords) / sizeof(keywords[0]))
+
+// no two keywords share a length and first letter, hashing both finds the
+// only keyword an identifier can be.
+#define KEYWORD_TABLE_CAP 32
+#define KEYWORD_HASH(__first, __length) (((uint8_t)(__first) + (__length) * 10) & (KEYWORD_TABLE_CAP - 1))
+
+static const keyword_t* keyword_table[KEYWORD_TABLE_CAP];
+static int keyword_table_ready = 0;
+
 static const char* puff_source = NULL;
+static const char* puff_source_end = NULL;
 
 void lexer_init(const char* source)
 {
     puff_source = source;
+    puff_source_end = source + strlen(source);
+
+    if (keyword_table_ready)
+        return;
+
+    for (int i = 0; i < KEYWORDS_LEN; i++) {
+        const keyword_t* keyword = &keywords[i];
+        int hash = KEYWORD_HASH(keyword->keyword[0], (int)strlen(keyword->keyword));
+
+        assert(!keyword_table[hash] && "KEYWORD HASH COLLISION");
+        keyword_table[hash] = keyword;
+    }
+
+    keyword_table_ready = 1;
 }
 
 static char current()
@@ -27,12 +91,89 @@ static void advance()
     puff_source++;
 }
 
+static int is_class(char c, uint8_t class)
+{
+    return char_classes[(uint8_t)c] & class;
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define SWAR 1
+
+#define ONES  0x0101010101010101ull
+#define HIGHS 0x8080808080808080ull
+
+static uint64_t load_word(const char* at)
+{
+    uint64_t word;
+    memcpy(&word, at, sizeof(word));
+    return word;
+}
+
+// high bit of every byte of `word` between `low` and `high`, both ascii.
+static uint64_t bytes_between(uint64_t word, uint8_t low, uint8_t high)
+{
+    uint64_t at_least_low = (word | HIGHS) - ONES * low;
+    uint64_t above_high = (word | HIGHS) - ONES * (high + 1);
+
+    return at_least_low & ~above_high & ~word & HIGHS;
+}
+
+// bytes at the start of the word before the first one without its high bit.
+static int leading_bytes(uint64_t mask)
+{
+    uint64_t missing = ~mask & HIGHS;
+    return missing ? __builtin_ctzll(missing) / 8 : 8;
+}
+#endif
+
+// runs of spaces, mostly indentation, are skipped a word at a time.
 static void skip_whitespaces()
 {
-    while (isspace(current()))
+    while (is_class(current(), CHAR_SPACE)) {
+        advance();
+
+#ifdef SWAR
+        while (current() == ' ' && puff_source_end - puff_source >= 8) {
+            int spaces = leading_bytes(bytes_between(load_word(puff_source), ' ', ' '));
+            puff_source += spaces;
+
+            if (spaces < 8)
+                break;
+        }
+#endif
+    }
+}
+
+static void skip_identifier()
+{
+#ifdef SWAR
+    while (puff_source_end - puff_source >= 8) {
+        uint64_t word = load_word(puff_source);
+        uint64_t identifier = bytes_between(word, '0', '9') | bytes_between(word, 'A', 'Z')
+            | bytes_between(word, 'a', 'z') | bytes_between(word, '_', '_');
+
+        int length = leading_bytes(identifier);
+        puff_source += length;
+
+        if (length < 8)
+            return;
+    }
+#endif
+
+    while (is_class(current(), CHAR_ALPHA | CHAR_DIGIT))
         advance();
 }
 
+static token_kind_t identifier_kind(const char* start, int length)
+{
+    const keyword_t* keyword = keyword_table[KEYWORD_HASH(start[0], length)];
+
+    if (keyword && strncmp(keyword->keyword, start, length) == 0 && keyword->keyword[length] == '\0')
+        return keyword->kind;
+
+    return TOK_IDENTIFIER;
+}
+
 token_t get_token()
 {
     assert(puff_source);
@@ -57,6 +198,58 @@ token_t get_token()
         case '/':
             advance();
             return make_token(TOK_SLASH, start, 1);
+        case '%':
+            advance();
+            return make_token(TOK_PERCENT, start, 1);
+        case '&':
+            advance();
+
+            if (current() == '&') {
+                advance();
+                return make_token(TOK_AMPERSANDAMPERSAND, start, 2);
+            }
+
+            return make_token(TOK_AMPERSAND, start, 1);
+        case '|':
+            advance();
+
+            if (current() == '|') {
+                advance();
+                return make_token(TOK_PIPEPIPE, start, 2);
+            }
+
+            return make_token(TOK_PIPE, start, 1);
+        case '^':
+            advance();
+            return make_token(TOK_CARET, start, 1);
+        case '<':
+            advance();
+
+            if (current() == '<') {
+                advance();
+                return make_token(TOK_LESSLESS, start, 2);
+            }
+
+            if (current() == '=') {
+                advance();
+                return make_token(TOK_LESSEQUAL, start, 2);
+            }
+
+            return make_token(TOK_LESS, start, 1);
+        case '>':
+            advance();
+
+            if (current() == '>') {
+                advance();
+                return make_token(TOK_GREATERGREATER, start, 2);
+            }
+
+            if (current() == '=') {
+                advance();
+                return make_token(TOK_GREATEREQUAL, start, 2);
+            }
+
+            return make_token(TOK_GREATER, start, 1);
         case '(':
             advance();
             return make_token(TOK_LPAREN, start, 1);
@@ -67,8 +260,7 @@ token_t get_token()
             advance();
 
             if (current() != '=') {
-                advance();
-                return make_token(TOK_ERROR, start, 2);
+                return make_token(TOK_BANG, start, 1);
             }
 
             advance();
@@ -97,22 +289,31 @@ token_t get_token()
         case '}':
             advance();
             return make_token(TOK_RCURLYBRACE, start, 1);
+        case '[':
+            advance();
+            return make_token(TOK_LBRACKET, start, 1);
+        case ']':
+            advance();
+            return make_token(TOK_RBRACKET, start, 1);
+        case '@':
+            advance();
+            return make_token(TOK_AT, start, 1);
     }
 
-    if (isdigit(current())) {
+    if (is_class(current(), CHAR_DIGIT)) {
         int length = 0;
         int mantissa_length = 0;
 
         do {
             length++;
             advance();
-        } while (current() && isdigit(current()));
+        } while (is_class(current(), CHAR_DIGIT));
 
         if (current() == '.') {
             length++;
             advance();
 
-            while (current() && isdigit(current())) {
+            while (is_class(current(), CHAR_DIGIT)) {
                 mantissa_length++;
                 advance();
             }
@@ -127,40 +328,67 @@ token_t get_token()
         return make_token(TOK_INTLITERAL, start, length);
     }
 
-    if (isalpha(current()) || current() == '_') {
-        int length = 0;
-        do {
-            length++;
-            advance();
-        } while (current() && (isalnum(current()) || current() == '_'));
+    if (is_class(current(), CHAR_ALPHA)) {
+        skip_identifier();
 
-        if (strncmp(start, "int", length) == 0)
-            return make_token(TOK_INT, start, length);
+        int length = puff_source - start;
+        return make_token(identifier_kind(start, length), start, length);
+    }
 
-        if (strncmp(start, "double", length) == 0)
-            return make_token(TOK_DOUBLE, start, length);
+    advance();
+    return make_token(TOK_ERROR, start, 1);
+}
 
-        if (strncmp(start, "void", length) == 0)
-            return make_token(TOK_VOID, start, length);
+void token_stream_lex(token_stream_t* stream, const char* source)
+{
+    lexer_init(source);
 
-        if (strncmp(start, "let", length) == 0)
-            return make_token(TOK_LET, start, length);
+    *stream = (token_stream_t) { .source = source };
 
-        if (strncmp(start, "set", length) == 0)
-            return make_token(TOK_SET, start, length);
+    const char* counted = source;
+    int32_t line = 1;
+    token_t token;
 
-        if (strncmp(start, "fun", length) == 0)
-            return make_token(TOK_FUN, start, length);
+    do {
+        token = get_token();
 
-        if (strncmp(start, "return", length) == 0)
-            return make_token(TOK_RETURN, start, length);
+        if (stream->len == stream->cap) {
+            // about one token per 4 bytes of source to begin with.
+            stream->cap = stream->cap ? stream->cap * 2 : (puff_source_end - source) / 4 + 16;
+            stream->kinds = realloc(stream->kinds, sizeof(uint8_t) * stream->cap);
+            stream->offsets = realloc(stream->offsets, sizeof(int32_t) * stream->cap);
+            stream->lengths = realloc(stream->lengths, sizeof(int32_t) * stream->cap);
+            stream->lines = realloc(stream->lines, sizeof(int32_t) * stream->cap);
+        }
 
-        if (strncmp(start, "if", length) == 0)
-            return make_token(TOK_IF, start, length);
+        // tokens don't span lines, only the gaps between them are counted.
+        for (; counted < token.start; counted++)
+            line += *counted == '\n';
 
-        return make_token(TOK_IDENTIFIER, start, length);
-    }
+        counted = token.start + token.length;
 
-    advance();
-    return make_token(TOK_ERROR, start, 1);
+        stream->kinds[stream->len] = token.kind;
+        stream->offsets[stream->len] = token.start - source;
+        stream->lengths[stream->len] = token.length;
+        stream->lines[stream->len] = line;
+        stream->len++;
+    } while (token.kind != TOK_EOF);
+}
+
+void token_stream_free(token_stream_t* stream)
+{
+    free(stream->kinds);
+    free(stream->offsets);
+    free(stream->lengths);
+    free(stream->lines);
+
+    *stream = (token_stream_t) { 0 };
+}
+
+token_t token_stream_get(const token_stream_t* stream, int32_t index)
+{
+    if (index >= stream->len)
+        index = stream->len - 1;
+
+    return make_token(stream->kinds[index], stream->source + stream->offsets[index], stream->lengths[index]);
 }
@@ -2,6 +2,26 @@
 
 #include "token.h"
 
+#include <stdint.h>
+
 void lexer_init(const char* source);
 
 token_t get_token();
+
+// a whole source lexed upfront, one array per field of the tokens.
+typedef struct {
+    const char* source;
+
+    uint8_t* kinds; // token_kind_t
+    int32_t* offsets; // from the start of the source
+    int32_t* lengths;
+    int32_t* lines; // from 1
+
+    int32_t len; // the last token is TOK_EOF
+    int32_t cap;
+} token_stream_t;
+
+void token_stream_lex(token_stream_t* stream, const char* source);
+void token_stream_free(token_stream_t* stream);
+
+token_t token_stream_get(const token_stream_t* stream, int32_t index);
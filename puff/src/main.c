@@ -1,57 +1,312 @@
 #include <assert.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "lexer.h"
 #include "parser.h"
 #include "codegen.h"
+#include "natives.h"
+#include "object.h"
+#include "peephole.h"
+
+typedef struct {
+    npb_t* pb;
+    peephole_stats_t* stats;
+} compiler_t;
+
+// compiles a function on its first call, the vm then runs on the grown program.
+static int32_t compile_stub(noice_t* vm, int32_t index, void* userdata)
+{
+    compiler_t* compiler = userdata;
+    int32_t from = compiler->pb->program_len;
+
+    int32_t ip = codegen_compile_function(compiler->pb, index);
+
+    // nothing new when another stub already compiled it.
+    if (compiler->pb->program_len == from)
+        return ip;
+
+    ip = peephole_optimize(compiler->pb, from, ip, compiler->stats);
+
+    vm->program = compiler->pb->program;
+    vm->program_len = compiler->pb->program_len;
+
+    return ip;
+}
+
+// links the objects into `pb` and returns where main starts.
+static int32_t link_objects(npb_t* pb, const char** paths, int paths_len)
+{
+    object_t* objects = malloc(sizeof(object_t) * paths_len);
+
+    for (int i = 0; i < paths_len; i++) {
+        object_init(&objects[i]);
+
+        if (!object_load(&objects[i], paths[i])) {
+            fprintf(stderr, "ERROR: failed to read object %s\n", paths[i]);
+            exit(1);
+        }
+    }
+
+    int32_t main_ip = object_link(pb, objects, paths_len);
+
+    for (int i = 0; i < paths_len; i++)
+        object_free(&objects[i]);
+
+    free(objects);
+
+    return main_ip;
+}
+
+static void print_peephole_stats(const peephole_stats_t* stats)
+{
+    fprintf(stderr, "instructions: %d -> %d\n", stats->instructions_before, stats->instructions_after);
+    fprintf(stderr, "bytes: %d -> %d\n", stats->bytes_before, stats->bytes_after);
+}
 
 int main(int argc, char** argv)
 {
-    if (argc < 2) {
+    const char* filepath = NULL;
+    const char** objects = malloc(sizeof(char*) * argc);
+    int objects_len = 0;
+    int link = 0;
+    const char* object_out = NULL;
+    int binary_output = 0;
+    int print_stats = 0;
+    int lazy = 0;
+    int pretokenize = 0;
+    const char* profile_out = NULL;
+    const char* profile_in = NULL;
+    int memo_cap = MEMO_CAP;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--binary-output") == 0) {
+            binary_output = 1;
+        } else if (strcmp(argv[i], "--memo-cap") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERROR: --memo-cap requires a number of entries\n");
+                return 1;
+            }
+
+            memo_cap = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--inline-threshold") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "ERROR: --inline-threshold requires a number of expression nodes\n");
+                return 1;
+            }
+
+            codegen_set_inline_threshold(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = 1;
+        } else if (strncmp(argv[i], "--profile-out=", 14) == 0) {
+            profile_out = argv[i] + 14;
+        } else if (strncmp(argv[i], "--profile-in=", 13) == 0) {
+            profile_in = argv[i] + 13;
+        } else if (strcmp(argv[i], "--ssa") == 0) {
+            codegen_set_ssa(1);
+        } else if (strcmp(argv[i], "--lazy") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[i], "--pretokenize") == 0) {
+            pretokenize = 1;
+        } else if (strncmp(argv[i], "--compile=", 10) == 0) {
+            object_out = argv[i] + 10;
+        } else if (strcmp(argv[i], "--link") == 0) {
+            link = 1;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            fprintf(stderr, "ERROR: unknown option %s\n", argv[i]);
+            return 1;
+        } else {
+            filepath = argv[i];
+            objects[objects_len++] = argv[i];
+        }
+    }
+
+    if (!filepath) {
         fprintf(stderr, "ERROR: please provide filepath to command line argument\n");
         return 1;
     }
 
-    FILE* input = fopen(argv[1], "r");
-    if (!input) {
-        fprintf(stderr, "ERROR: failed to open %s\n", argv[1]);
+    if (profile_out && profile_in) {
+        fprintf(stderr, "ERROR: --profile-out and --profile-in can't be used together\n");
         return 1;
     }
 
-    fseek(input, SEEK_SET, SEEK_END);
-    long size = ftell(input);
-    rewind(input);
+    // the counts are sized for the program as loaded.
+    if (profile_out && lazy) {
+        fprintf(stderr, "ERROR: --profile-out and --lazy can't be used together\n");
+        return 1;
+    }
 
-    if (size == 0)
-        return 0;
+    // modules are compiled and linked whole.
+    if ((object_out || link) && (lazy || profile_out)) {
+        fprintf(stderr, "ERROR: --compile and --link can't be used with --lazy or --profile-out\n");
+        return 1;
+    }
+
+    if (object_out && link) {
+        fprintf(stderr, "ERROR: --compile and --link can't be used together\n");
+        return 1;
+    }
+
+    codegen_set_lazy(lazy);
+
+    object_t object;
+    object_init(&object);
+
+    if (object_out)
+        codegen_set_object(&object);
 
-    char* buffer = malloc(size + 1);
-    fread(buffer, 1, size, input);
-    buffer[size] = '\0';
+    profile_t profile;
+    profile_init(&profile);
 
-    fclose(input);
+    if (profile_in) {
+        if (!profile_load(&profile, profile_in)) {
+            fprintf(stderr, "ERROR: failed to read profile %s\n", profile_in);
+            return 1;
+        }
+
+        codegen_set_profile(&profile);
+    }
+
+    // the profiled program is left as codegen laid it out, so the counts map
+    // back to its functions and ifs.
+    if (profile_out) {
+        codegen_set_ssa(0);
+        codegen_set_profiling(&profile);
+    }
 
     noice_t vm;
     noice_init(&vm);
+    noice_register_natives(&vm, puff_natives, puff_natives_len);
+
+    if (binary_output)
+        vm.output.mode = OUTPUT_BINARY;
+
+    vm.memo_cap = memo_cap;
 
     npb_t pb;
-    codegen_init(&pb);
+    int main_ip;
+    program_t* program = NULL;
+    char* buffer = NULL;
+
+    ast_arena_t arena;
+    ast_arena_init(&arena);
+    ast_set_arena(&arena);
+
+    if (link) {
+        npb_init(&pb);
+        main_ip = link_objects(&pb, objects, objects_len);
+    } else {
+        FILE* input = fopen(filepath, "r");
+        if (!input) {
+            fprintf(stderr, "ERROR: failed to open %s\n", filepath);
+            return 1;
+        }
+
+        fseek(input, SEEK_SET, SEEK_END);
+        long size = ftell(input);
+        rewind(input);
+
+        if (size == 0)
+            return 0;
+
+        buffer = malloc(size + 1);
+        fread(buffer, 1, size, input);
+        buffer[size] = '\0';
+
+        fclose(input);
+
+        codegen_init(&pb);
+        codegen_register_natives(puff_natives, puff_natives_len);
+
+        if (pretokenize) {
+            token_stream_t tokens;
+            token_stream_lex(&tokens, buffer);
+
+            parser_init_stream(&tokens);
+            program = parse_program();
+
+            token_stream_free(&tokens);
+        } else {
+            parser_init(buffer);
+            program = parse_program();
+        }
+
+        // every node used to be an allocation of its own.
+        if (print_stats)
+            fprintf(stderr, "ast allocations: %" PRId64 " -> %" PRId64 "\n", arena.nodes, arena.chunks_len);
+
+        main_ip = codegen_program(&pb, program);
+
+        // lazily compiled functions still need their ast.
+        if (!lazy) {
+            ast_arena_free(&arena);
+            free(buffer);
+        }
+    }
+
+    free(objects);
+
+    if (object_out) {
+        if (!object_save(&object, object_out)) {
+            fprintf(stderr, "ERROR: failed to write object %s\n", object_out);
+            return 1;
+        }
 
-    parser_init(buffer);
-    program_t* program = parse_program();
+        object_free(&object);
+        noice_free(&vm);
+        npb_free(&pb);
 
-    int main_ip  = codegen_program(&pb, program);
-    program_free(program);
-    free(buffer);
+        return 0;
+    }
 
     if (main_ip == -1) {
         fprintf(stderr, "ERROR: no main function defined\n");
         return 1;
     }
 
+    peephole_stats_t stats = { 0 };
+    compiler_t compiler = { .pb = &pb, .stats = &stats };
+
+    if (!profile_out) {
+        main_ip = peephole_optimize(&pb, 0, main_ip, &stats);
+
+        if (print_stats && !lazy)
+            print_peephole_stats(&stats);
+    }
+
     noice_load_program(&vm, pb.program, pb.program_len, main_ip);
+
+    if (lazy)
+        noice_register_compiler(&vm, compile_stub, &compiler);
+
+    if (profile_out)
+        noice_enable_profile(&vm);
+
     noice_run(&vm);
 
+    // with the functions compiled during the run.
+    if (print_stats && lazy)
+        print_peephole_stats(&stats);
+
+    if (lazy) {
+        ast_arena_free(&arena);
+        free(buffer);
+    }
+
+    if (profile_out) {
+        codegen_collect_profile(vm.profile);
+
+        if (!profile_save(&profile, profile_out)) {
+            fprintf(stderr, "ERROR: failed to write profile %s\n", profile_out);
+            return 1;
+        }
+    }
+
+    noice_free(&vm);
+    profile_free(&profile);
+
     npb_free(&pb);
 }
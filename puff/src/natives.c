@@ -0,0 +1,54 @@
+#include "natives.h"
+
+#include <math.h>
+#include <time.h>
+
+static int32_t native_clock(value_t* args, int32_t num_args)
+{
+    (void)num_args;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    args[0] = value_from_double(ts.tv_sec + ts.tv_nsec / 1e9);
+    return 1;
+}
+
+#define NATIVE_UNARY(__name, __fn)                                              \
+    static int32_t __name(value_t* args, int32_t num_args)                      \
+    {                                                                           \
+        (void)num_args;                                                         \
+        args[0] = value_from_double(__fn(value_as_double(args[0])));            \
+        return 1;                                                               \
+    }                                                                           \
+
+#define NATIVE_BINARY(__name, __fn)                                             \
+    static int32_t __name(value_t* args, int32_t num_args)                      \
+    {                                                                           \
+        (void)num_args;                                                         \
+        double a = value_as_double(args[0]);                                    \
+        double b = value_as_double(args[1]);                                    \
+        args[0] = value_from_double(__fn(a, b));                                \
+        return 1;                                                               \
+    }                                                                           \
+
+NATIVE_UNARY(native_exp, exp)
+NATIVE_UNARY(native_log, log)
+NATIVE_UNARY(native_sin, sin)
+NATIVE_UNARY(native_cos, cos)
+NATIVE_UNARY(native_tan, tan)
+NATIVE_BINARY(native_pow, pow)
+NATIVE_BINARY(native_atan2, atan2)
+
+const nnative_t puff_natives[] = {
+    { .name = "clock", .signature = ":d",   .fn = native_clock },
+    { .name = "exp",   .signature = "d:d",  .fn = native_exp },
+    { .name = "log",   .signature = "d:d",  .fn = native_log },
+    { .name = "sin",   .signature = "d:d",  .fn = native_sin },
+    { .name = "cos",   .signature = "d:d",  .fn = native_cos },
+    { .name = "tan",   .signature = "d:d",  .fn = native_tan },
+    { .name = "pow",   .signature = "dd:d", .fn = native_pow },
+    { .name = "atan2", .signature = "dd:d", .fn = native_atan2 },
+};
+
+const int32_t puff_natives_len = sizeof(puff_natives) / sizeof(puff_natives[0]);
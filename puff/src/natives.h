@@ -0,0 +1,6 @@
+#pragma once
+
+#include "vm.h"
+
+extern const nnative_t puff_natives[];
+extern const int32_t puff_natives_len;
@@ -0,0 +1,399 @@
+#include "object.h"
+#include "peephole.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define OBJECT_MAGIC "PUFO"
+#define OBJECT_VERSION 1
+
+void object_init(object_t* object)
+{
+    object->code = NULL;
+    object->code_len = 0;
+
+    object->symbols = NULL;
+    object->symbols_len = 0;
+    object->symbols_cap = 0;
+
+    object->relocations = NULL;
+    object->relocations_len = 0;
+    object->relocations_cap = 0;
+
+    object->memos_len = 0;
+}
+
+void object_free(object_t* object)
+{
+    for (int32_t i = 0; i < object->symbols_len; i++) {
+        free(object->symbols[i].name);
+        free(object->symbols[i].signature);
+    }
+
+    for (int32_t i = 0; i < object->relocations_len; i++) {
+        free(object->relocations[i].name);
+        free(object->relocations[i].signature);
+    }
+
+    free(object->code);
+    free(object->symbols);
+    free(object->relocations);
+    object_init(object);
+}
+
+static void push_symbol(object_symbol_t** symbols, int32_t* len, int32_t* cap, object_symbol_t symbol)
+{
+    if (*len == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *symbols = realloc(*symbols, sizeof(object_symbol_t) * *cap);
+    }
+
+    (*symbols)[(*len)++] = symbol;
+}
+
+void object_add_symbol(object_t* object, const char* name, int32_t name_len, const char* signature, int32_t offset)
+{
+    push_symbol(&object->symbols, &object->symbols_len, &object->symbols_cap, (object_symbol_t) {
+        .name = strndup(name, name_len),
+        .signature = strdup(signature),
+        .offset = offset,
+    });
+}
+
+void object_add_relocation(object_t* object, const char* name, int32_t name_len, const char* signature, int32_t offset)
+{
+    push_symbol(&object->relocations, &object->relocations_len, &object->relocations_cap, (object_symbol_t) {
+        .name = strndup(name, name_len),
+        .signature = strdup(signature),
+        .offset = offset,
+    });
+}
+
+static int read_int32(FILE* input, int32_t* value)
+{
+    return fread(value, sizeof(*value), 1, input) == 1;
+}
+
+static char* read_string(FILE* input)
+{
+    int32_t len;
+
+    if (!read_int32(input, &len) || len < 0)
+        return NULL;
+
+    char* string = malloc(len + 1);
+
+    if (fread(string, 1, len, input) != (size_t)len) {
+        free(string);
+        return NULL;
+    }
+
+    string[len] = '\0';
+    return string;
+}
+
+static int read_symbols(FILE* input, object_symbol_t** symbols, int32_t* len, int32_t* cap)
+{
+    int32_t count;
+
+    if (!read_int32(input, &count))
+        return 0;
+
+    for (int32_t i = 0; i < count; i++) {
+        object_symbol_t symbol = { 0 };
+
+        if (!read_int32(input, &symbol.offset))
+            return 0;
+
+        symbol.name = read_string(input);
+        symbol.signature = read_string(input);
+
+        if (!symbol.name || !symbol.signature) {
+            free(symbol.name);
+            free(symbol.signature);
+            return 0;
+        }
+
+        push_symbol(symbols, len, cap, symbol);
+    }
+
+    return 1;
+}
+
+static int32_t code_int32(const uint8_t* code, int32_t offset)
+{
+    int32_t value;
+    memcpy(&value, code + offset, sizeof(value));
+    return value;
+}
+
+// whether the whole instruction at `offset` lies within the code. the switches
+// are sized by counts in their operands, which have to be read first.
+static int instruction_fits(const uint8_t* code, int32_t code_len, int32_t offset)
+{
+    int64_t left = (int64_t)code_len - offset;
+
+    if (code[offset] > INS_SPAWNSTUB || code[offset] == INS_CALLSTUB || code[offset] == INS_SPAWNSTUB)
+        return 0;
+
+    if (code[offset] == INS_TABLESWITCH) {
+        if (left < 13)
+            return 0;
+
+        int32_t count = code_int32(code, offset + 5);
+        if (count < 0 || count > left / 4)
+            return 0;
+    } else if (code[offset] == INS_LOOKUPSWITCH) {
+        if (left < 9)
+            return 0;
+
+        int32_t count = code_int32(code, offset + 1);
+        if (count < 0 || count > left / 8)
+            return 0;
+    }
+
+    return peephole_instruction_len(code, offset) <= left;
+}
+
+// the code has to decode into whole instructions that end exactly at its end,
+// with every address, symbol, relocation and memo cache inside the module.
+static int object_valid(const object_t* object)
+{
+    const uint8_t* code = object->code;
+    int32_t code_len = object->code_len;
+
+    if (object->memos_len < 0)
+        return 0;
+
+    // 1 where an instruction starts, 2 where a relocation is patched in.
+    uint8_t* at = calloc(code_len + 1, 1);
+    int32_t offset = 0;
+    int ok = 1;
+
+    while (ok && offset < code_len) {
+        ok = instruction_fits(code, code_len, offset);
+
+        if (ok) {
+            at[offset] = 1;
+            offset += peephole_instruction_len(code, offset);
+        }
+    }
+
+    ok = ok && offset == code_len;
+
+    for (int32_t i = 0; ok && i < object->symbols_len; i++) {
+        int32_t symbol = object->symbols[i].offset;
+        ok = symbol >= 0 && symbol < code_len && at[symbol] == 1;
+    }
+
+    for (int32_t i = 0; ok && i < object->relocations_len; i++) {
+        int32_t relocation = object->relocations[i].offset;
+
+        ok = relocation >= 1 && relocation <= code_len - 4 && at[relocation - 1] == 1
+            && (code[relocation - 1] == INS_CALL || code[relocation - 1] == INS_SPAWN);
+
+        if (ok)
+            at[relocation] = 2;
+    }
+
+    for (offset = 0; ok && offset < code_len; offset += peephole_instruction_len(code, offset)) {
+        for (int32_t n = 0; ok && n < peephole_addresses_len(code, offset); n++) {
+            int32_t position = peephole_address_position(code, offset, n);
+            int32_t addr = code_int32(code, position);
+
+            ok = at[position] == 2 || (addr >= 0 && addr < code_len && at[addr] == 1);
+        }
+
+        if (ok && (code[offset] == INS_MEMOENTER || code[offset] == INS_MEMORET)) {
+            int32_t memo = code_int32(code, offset + 1);
+            ok = memo >= 0 && memo < object->memos_len;
+        }
+    }
+
+    free(at);
+
+    return ok;
+}
+
+int object_load(object_t* object, const char* path)
+{
+    FILE* input = fopen(path, "rb");
+    if (!input)
+        return 0;
+
+    char magic[4];
+    int32_t version;
+    int ok = fread(magic, 1, 4, input) == 4 && memcmp(magic, OBJECT_MAGIC, 4) == 0
+        && read_int32(input, &version) && version == OBJECT_VERSION
+        && read_int32(input, &object->code_len) && object->code_len >= 0;
+
+    if (ok) {
+        object->code = malloc(object->code_len);
+        ok = fread(object->code, 1, object->code_len, input) == (size_t)object->code_len;
+    }
+
+    ok = ok && read_int32(input, &object->memos_len);
+    ok = ok && read_symbols(input, &object->symbols, &object->symbols_len, &object->symbols_cap);
+    ok = ok && read_symbols(input, &object->relocations, &object->relocations_len, &object->relocations_cap);
+
+    fclose(input);
+
+    return ok && object_valid(object);
+}
+
+static void write_int32(FILE* output, int32_t value)
+{
+    fwrite(&value, sizeof(value), 1, output);
+}
+
+static void write_symbols(FILE* output, const object_symbol_t* symbols, int32_t len)
+{
+    write_int32(output, len);
+
+    for (int32_t i = 0; i < len; i++) {
+        write_int32(output, symbols[i].offset);
+
+        write_int32(output, strlen(symbols[i].name));
+        fputs(symbols[i].name, output);
+
+        write_int32(output, strlen(symbols[i].signature));
+        fputs(symbols[i].signature, output);
+    }
+}
+
+// "PUFO", the format version, the code, the number of memo caches, then the symbols and the
+// relocations. integers are stored in the byte order of the machine, like
+// the operands in the code.
+int object_save(const object_t* object, const char* path)
+{
+    FILE* output = fopen(path, "wb");
+    if (!output)
+        return 0;
+
+    fwrite(OBJECT_MAGIC, 1, 4, output);
+    write_int32(output, OBJECT_VERSION);
+
+    write_int32(output, object->code_len);
+    fwrite(object->code, 1, object->code_len, output);
+
+    write_int32(output, object->memos_len);
+
+    write_symbols(output, object->symbols, object->symbols_len);
+    write_symbols(output, object->relocations, object->relocations_len);
+
+    return fclose(output) == 0;
+}
+
+typedef struct {
+    const object_symbol_t* symbol;
+    int32_t addr; // in the linked program
+} definition_t;
+
+static const definition_t* lookup(const definition_t* definitions, int32_t definitions_len, const char* name)
+{
+    for (int32_t i = 0; i < definitions_len; i++) {
+        if (strcmp(definitions[i].symbol->name, name) == 0)
+            return &definitions[i];
+    }
+
+    return NULL;
+}
+
+static void relocate(uint8_t* program, int32_t position, int32_t base)
+{
+    int32_t addr;
+
+    memcpy(&addr, program + position, sizeof(addr));
+    addr += base;
+    memcpy(program + position, &addr, sizeof(addr));
+}
+
+int32_t object_link(npb_t* pb, const object_t* objects, int32_t objects_len)
+{
+    int32_t symbols_len = 0;
+    int32_t code_len = 0;
+
+    for (int32_t i = 0; i < objects_len; i++) {
+        symbols_len += objects[i].symbols_len;
+        code_len += objects[i].code_len;
+    }
+
+    if (pb->program_len + code_len >= pb->program_cap) {
+        while (pb->program_len + code_len >= pb->program_cap)
+            pb->program_cap *= 2;
+
+        pb->program = realloc(pb->program, pb->program_cap);
+    }
+
+    definition_t* definitions = malloc(sizeof(definition_t) * (symbols_len + 1));
+    int32_t definitions_len = 0;
+
+    int32_t* bases = malloc(sizeof(int32_t) * (objects_len + 1));
+    int32_t memo_base = 0;
+
+    for (int32_t i = 0; i < objects_len; i++) {
+        const object_t* object = &objects[i];
+        int32_t base = pb->program_len;
+
+        bases[i] = base;
+
+        for (int32_t j = 0; j < object->symbols_len; j++) {
+            const object_symbol_t* symbol = &object->symbols[j];
+
+            if (lookup(definitions, definitions_len, symbol->name)) {
+                fprintf(stderr, "ERROR: function '%s' is defined by more than one module\n", symbol->name);
+                exit(1);
+            }
+
+            definitions[definitions_len++] = (definition_t) {
+                .symbol = symbol,
+                .addr = base + symbol->offset,
+            };
+        }
+
+        uint8_t* code = pb->program + base;
+        memcpy(code, object->code, object->code_len);
+
+        for (int32_t offset = 0; offset < object->code_len; offset += peephole_instruction_len(code, offset)) {
+            for (int32_t n = 0; n < peephole_addresses_len(code, offset); n++)
+                relocate(code, peephole_address_position(code, offset, n), base);
+
+            if (code[offset] == INS_MEMOENTER || code[offset] == INS_MEMORET)
+                relocate(code, offset + 1, memo_base);
+        }
+
+        pb->program_len += object->code_len;
+        memo_base += object->memos_len;
+    }
+
+    for (int32_t i = 0; i < objects_len; i++) {
+        const object_t* object = &objects[i];
+
+        for (int32_t j = 0; j < object->relocations_len; j++) {
+            const object_symbol_t* relocation = &object->relocations[j];
+            const definition_t* definition = lookup(definitions, definitions_len, relocation->name);
+
+            if (!definition) {
+                fprintf(stderr, "ERROR: undefined extern function '%s'\n", relocation->name);
+                exit(1);
+            }
+
+            if (strcmp(definition->symbol->signature, relocation->signature) != 0) {
+                fprintf(stderr, "ERROR: extern function '%s' is declared as '%s' but defined as '%s'\n",
+                    relocation->name, relocation->signature, definition->symbol->signature);
+                exit(1);
+            }
+
+            memcpy(pb->program + bases[i] + relocation->offset, &definition->addr, sizeof(definition->addr));
+        }
+    }
+
+    const definition_t* main = lookup(definitions, definitions_len, "main");
+    int32_t main_ip = main ? main->addr : -1;
+
+    free(definitions);
+    free(bases);
+
+    return main_ip;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "vm.h"
+
+// a function defined by the module, or a call to one defined by another.
+typedef struct {
+    char* name;
+    char* signature; // parameter types then the return type, e.g. "iD:v"
+    int32_t offset; // where the function starts, or where the call's address is
+} object_symbol_t;
+
+// relocatable bytecode of a module. addresses in the code are relative to its
+// start and memo caches are numbered from 0, calls to extern functions are
+// left to the relocations.
+typedef struct {
+    uint8_t* code;
+    int32_t code_len;
+
+    object_symbol_t* symbols;
+    int32_t symbols_len;
+    int32_t symbols_cap;
+
+    object_symbol_t* relocations;
+    int32_t relocations_len;
+    int32_t relocations_cap;
+
+    int32_t memos_len;
+} object_t;
+
+void object_init(object_t* object);
+void object_free(object_t* object);
+
+void object_add_symbol(object_t* object, const char* name, int32_t name_len, const char* signature, int32_t offset);
+void object_add_relocation(object_t* object, const char* name, int32_t name_len, const char* signature, int32_t offset);
+
+// return 0 on failure.
+int object_load(object_t* object, const char* path);
+int object_save(const object_t* object, const char* path);
+
+// lays the objects out one after the other in `pb` and resolves the calls
+// between them, returns where main starts or -1 if no object defines it.
+int32_t object_link(npb_t* pb, const object_t* objects, int32_t objects_len);
@@ -5,22 +5,46 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static int initialized = 0;
 static token_t current;
 
+// set by parser_init_stream, tokens are then read from it instead of the lexer.
+static const token_stream_t* stream = NULL;
+static int32_t stream_index = 0;
+
+// ifs parsed so far in the current function.
+static int ifs_len = 0;
+
 void parser_init(const char* source)
 {
     lexer_init(source);
+    stream = NULL;
 
     current = get_token();
     initialized = 1;
 }
 
+void parser_init_stream(const token_stream_t* tokens)
+{
+    stream = tokens;
+    stream_index = 0;
+
+    current = token_stream_get(stream, stream_index);
+    initialized = 1;
+}
+
 static void advance()
 {
-    if (current.kind != TOK_EOF)
+    if (current.kind == TOK_EOF)
+        return;
+
+    if (stream) {
+        current = token_stream_get(stream, ++stream_index);
+    } else {
         current = get_token();
+    }
 }
 
 static int expect(token_kind_t kind)
@@ -34,7 +58,12 @@ static void match(token_kind_t kind)
         fprintf(stderr, "ERROR: unexpected end of file\n");
         exit(1);
     } else if (!expect(kind)) {
-        fprintf(stderr, "ERROR: unexpected token: '%.*s'\n", current.length, current.start);
+        if (stream) {
+            fprintf(stderr, "ERROR: unexpected token: '%.*s' on line %d\n", current.length, current.start, stream->lines[stream_index]);
+        } else {
+            fprintf(stderr, "ERROR: unexpected token: '%.*s'\n", current.length, current.start);
+        }
+
         exit(1);
     }
 
@@ -85,26 +114,74 @@ static expr_t* parse_primary()
         }
 
         return expr_ident_make(ident);
-    } else if (expect(TOK_MINUS)) {
+    } else if (expect(TOK_INT) || expect(TOK_DOUBLE)) {
+        token_t type = current;
         advance();
 
-        return expr_unary_make('-', parse_expression());
+        match(TOK_LBRACKET);
+        expr_t* len = parse_expression();
+        match(TOK_RBRACKET);
+
+        return expr_newarray_make(type, len);
     }
 
     fprintf(stderr, "ERROR: expected primary expression\n");
     exit(1);
 }
 
+static expr_t* parse_postfix()
+{
+    expr_t* expr = parse_primary();
+
+    while (expect(TOK_LBRACKET)) {
+        advance();
+
+        expr_t* index = parse_expression();
+        match(TOK_RBRACKET);
+
+        expr = expr_index_make(expr, index);
+    }
+
+    return expr;
+}
+
+static expr_t* parse_unary()
+{
+    if (expect(TOK_MINUS) || expect(TOK_BANG)) {
+        char op = expect(TOK_MINUS) ? '-' : '!';
+        advance();
+
+        expr_t* operand = parse_unary();
+
+        // negative literals are a single push.
+        if (op == '-' && operand->kind == EXPR_NUMBER) {
+            expr_num_t* num = (expr_num_t*)operand;
+
+            if (num->kind == EXPR_NUM_INT) {
+                num->value.i = (int32_t)(0u - (uint32_t)num->value.i);
+            } else {
+                num->value.d = -num->value.d;
+            }
+
+            return operand;
+        }
+
+        return expr_unary_make(op, operand);
+    }
+
+    return parse_postfix();
+}
+
 static expr_t* parse_factor()
 {
-    expr_t* lhs = parse_primary();
+    expr_t* lhs = parse_unary();
 
-    while (expect(TOK_STAR) || expect(TOK_SLASH)) {
-        char op = expect(TOK_STAR) ? '*' : '/';
+    while (expect(TOK_STAR) || expect(TOK_SLASH) || expect(TOK_PERCENT)) {
+        char op = expect(TOK_STAR) ? '*' : expect(TOK_SLASH) ? '/' : '%';
         advance();
 
 
-        expr_t* rhs = parse_primary();
+        expr_t* rhs = parse_unary();
         lhs = expr_binary_make(lhs, op, rhs);
     }
 
@@ -127,23 +204,123 @@ static expr_t* parse_term()
     return lhs;
 }
 
-expr_t* parse_expression()
+static expr_t* parse_shift()
 {
-    assert(initialized);
-
     expr_t* lhs = parse_term();
 
+    while (expect(TOK_LESSLESS) || expect(TOK_GREATERGREATER)) {
+        char op = expect(TOK_LESSLESS) ? 'L' : 'R';
+        advance();
+
+        expr_t* rhs = parse_term();
+        lhs = expr_binary_make(lhs, op, rhs);
+    }
+
+    return lhs;
+}
+
+static expr_t* parse_relational()
+{
+    expr_t* lhs = parse_shift();
+
+    while (expect(TOK_LESS) || expect(TOK_LESSEQUAL) || expect(TOK_GREATER) || expect(TOK_GREATEREQUAL)) {
+        char op = expect(TOK_LESS) ? '<' : expect(TOK_LESSEQUAL) ? 'l' : expect(TOK_GREATER) ? '>' : 'g';
+        advance();
+
+        expr_t* rhs = parse_shift();
+        lhs = expr_binary_make(lhs, op, rhs);
+    }
+
+    return lhs;
+}
+
+static expr_t* parse_equality()
+{
+    expr_t* lhs = parse_relational();
+
     while (expect(TOK_EQUALEQUAL) || expect(TOK_NOTEQUAL)) {
         char op = expect(TOK_EQUALEQUAL) ? '=' : '!';
         advance();
 
-        expr_t* rhs = parse_term();
+        expr_t* rhs = parse_relational();
         lhs = expr_binary_make(lhs, op, rhs);
     }
 
     return lhs;
 }
 
+static expr_t* parse_bitand()
+{
+    expr_t* lhs = parse_equality();
+
+    while (expect(TOK_AMPERSAND)) {
+        advance();
+
+        expr_t* rhs = parse_equality();
+        lhs = expr_binary_make(lhs, '&', rhs);
+    }
+
+    return lhs;
+}
+
+static expr_t* parse_bitxor()
+{
+    expr_t* lhs = parse_bitand();
+
+    while (expect(TOK_CARET)) {
+        advance();
+
+        expr_t* rhs = parse_bitand();
+        lhs = expr_binary_make(lhs, '^', rhs);
+    }
+
+    return lhs;
+}
+
+static expr_t* parse_bitor()
+{
+    expr_t* lhs = parse_bitxor();
+
+    while (expect(TOK_PIPE)) {
+        advance();
+
+        expr_t* rhs = parse_bitxor();
+        lhs = expr_binary_make(lhs, '|', rhs);
+    }
+
+    return lhs;
+}
+
+static expr_t* parse_logical_and()
+{
+    expr_t* lhs = parse_bitor();
+
+    while (expect(TOK_AMPERSANDAMPERSAND)) {
+        advance();
+
+        expr_t* rhs = parse_bitor();
+        lhs = expr_binary_make(lhs, 'A', rhs);
+    }
+
+    return lhs;
+}
+
+expr_t* parse_expression()
+{
+    assert(initialized);
+
+    expr_t* lhs = parse_logical_and();
+
+    while (expect(TOK_PIPEPIPE)) {
+        advance();
+
+        expr_t* rhs = parse_logical_and();
+        lhs = expr_binary_make(lhs, 'O', rhs);
+    }
+
+    return lhs;
+}
+
 static block_t* parse_block()
 {
     match(TOK_LCURLYBRACE);
@@ -172,6 +349,16 @@ static token_t parse_type()
         token_t type = current;
         advance();
 
+        // array types are a single token spanning up to the closing bracket.
+        if (type.kind != TOK_VOID && expect(TOK_LBRACKET)) {
+            advance();
+
+            const char* end = current.start + current.length;
+            match(TOK_RBRACKET);
+
+            type.length = end - type.start;
+        }
+
         return type;
     }
 
@@ -202,11 +389,20 @@ stmt_t* parse_statement()
         token_t ident = current;
         match(TOK_IDENTIFIER);
 
+        expr_t* index = NULL;
+
+        if (expect(TOK_LBRACKET)) {
+            advance();
+
+            index = parse_expression();
+            match(TOK_RBRACKET);
+        }
+
         match(TOK_EQUAL);
 
         expr_t* expr = parse_expression();
 
-        return stmt_varassign_make(ident, expr);
+        return stmt_varassign_make(ident, index, expr);
     } else if (expect(TOK_RETURN)) {
         advance();
 
@@ -220,13 +416,80 @@ stmt_t* parse_statement()
     } else if (expect(TOK_IF)) {
         advance();
 
+        int site = ifs_len++;
+
         match(TOK_LPAREN);
         expr_t* condition = parse_expression();
         match(TOK_RPAREN);
 
         block_t* true = parse_block();
+        block_t* false = NULL;
+
+        if (expect(TOK_ELSE)) {
+            advance();
+
+            if (expect(TOK_IF)) {
+                false = block_make(parse_statement());
+            } else {
+                false = parse_block();
+            }
+        }
+
+        return stmt_if_make(condition, true, false, site);
+    } else if (expect(TOK_WHILE)) {
+        advance();
+
+        match(TOK_LPAREN);
+        expr_t* condition = parse_expression();
+        match(TOK_RPAREN);
 
-        return stmt_if_make(condition, true, NULL);
+        return stmt_while_make(condition, parse_block());
+    } else if (expect(TOK_MATCH)) {
+        advance();
+
+        match(TOK_LPAREN);
+        expr_t* subject = parse_expression();
+        match(TOK_RPAREN);
+
+        match(TOK_LCURLYBRACE);
+
+        match_arm_t* arms = NULL;
+        match_arm_t* ptr = NULL;
+        block_t* otherwise = NULL;
+
+        while (expect(TOK_CASE)) {
+            advance();
+
+            match_arm_t* arm = match_arm_make();
+
+            int first = 1;
+            while (first || expect(TOK_COMMA)) {
+                if (!first)
+                    advance();
+
+                match_arm_push_value(arm, parse_expression());
+                first = 0;
+            }
+
+            arm->body = parse_block();
+
+            if (!arms) {
+                arms = arm;
+            } else {
+                ptr->next = arm;
+            }
+
+            ptr = arm;
+        }
+
+        if (expect(TOK_ELSE)) {
+            advance();
+            otherwise = parse_block();
+        }
+
+        match(TOK_RCURLYBRACE);
+
+        return stmt_match_make(subject, arms, otherwise);
     }
 
     return stmt_expr_make(parse_expression());
@@ -234,6 +497,36 @@ stmt_t* parse_statement()
 
 topdecl_t* parse_topdecl()
 {
+    int memo = 0;
+
+    while (expect(TOK_AT)) {
+        advance();
+
+        token_t annotation = current;
+        match(TOK_IDENTIFIER);
+
+        if (annotation.length != 4 || strncmp(annotation.start, "memo", 4) != 0) {
+            fprintf(stderr, "ERROR: unknown annotation '@%.*s'\n", annotation.length, annotation.start);
+            exit(1);
+        }
+
+        memo = 1;
+    }
+
+    int is_inline = 0;
+
+    if (expect(TOK_INLINE)) {
+        advance();
+        is_inline = 1;
+    }
+
+    int is_extern = 0;
+
+    if (!memo && !is_inline && expect(TOK_EXTERN)) {
+        advance();
+        is_extern = 1;
+    }
+
     if (expect(TOK_FUN)) {
         advance();
 
@@ -243,6 +536,9 @@ topdecl_t* parse_topdecl()
         match(TOK_LPAREN);
 
         topdecl_fun_t* fun = (topdecl_fun_t*)topdecl_fun_make(name);
+        fun->memo = memo;
+        fun->is_inline = is_inline;
+        fun->is_extern = is_extern;
 
         int first = 1;
         while (fun->args_len < 10 && !expect(TOK_RPAREN)) {
@@ -267,7 +563,14 @@ topdecl_t* parse_topdecl()
         token_t type = parse_type();
 
         fun->type = type;
+
+        // defined by another module.
+        if (is_extern)
+            return (topdecl_t*)fun;
+
+        ifs_len = 0;
         fun->funbody = parse_block();
+        fun->ifs_len = ifs_len;
 
         return (topdecl_t*)fun;
     }
@@ -1,8 +1,12 @@
 #pragma once
 
 #include "ast.h"
+#include "lexer.h"
 
 void parser_init(const char* source);
+
+// parses tokens lexed upfront, the stream must outlive the parsing.
+void parser_init_stream(const token_stream_t* tokens);
 expr_t* parse_expression();
 stmt_t* parse_statement();
 topdecl_t* parse_topdecl();
@@ -0,0 +1,463 @@
+#include "peephole.h"
+#include "ir.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int32_t offset; // in the original program
+    int32_t len;
+    int removed;
+    int target; // some address points at it
+} instruction_t;
+
+typedef struct {
+    uint8_t* program;
+    int32_t program_len;
+
+    instruction_t* instructions;
+    int32_t instructions_len;
+
+    int32_t* at; // instruction starting at each offset, -1 inside operands
+} peephole_t;
+
+static int32_t read_int32(const uint8_t* program, int32_t offset)
+{
+    int32_t value;
+    memcpy(&value, program + offset, sizeof(value));
+    return value;
+}
+
+static void write_int32(uint8_t* program, int32_t offset, int32_t value)
+{
+    memcpy(program + offset, &value, sizeof(value));
+}
+
+int32_t peephole_instruction_len(const uint8_t* program, int32_t offset)
+{
+    switch (program[offset]) {
+        case INS_IPUSH:
+        case INS_DUP:
+        case INS_SET:
+        case INS_BR:
+        case INS_BRIT:
+        case INS_BRIF:
+        case INS_LOADARG:
+        case INS_SETARG:
+        case INS_ANEW:
+        case INS_MEMOENTER:
+        case INS_MEMORET:
+            return 1 + sizeof(int32_t);
+        case INS_DPUSH:
+            return 1 + sizeof(double);
+        case INS_CALL:
+        case INS_SPAWN:
+        case INS_AWAIT:
+        case INS_CALLNATIVE:
+        case INS_CALLSTUB:
+        case INS_SPAWNSTUB:
+            return 1 + 2 * sizeof(int32_t);
+        case INS_TABLESWITCH:
+            return 1 + (3 + read_int32(program, offset + 5)) * sizeof(int32_t);
+        case INS_LOOKUPSWITCH:
+            return 1 + (2 + 2 * read_int32(program, offset + 1)) * sizeof(int32_t);
+        default:
+            return 1;
+    }
+}
+
+int32_t peephole_addresses_len(const uint8_t* program, int32_t offset)
+{
+    switch (program[offset]) {
+        case INS_BR:
+        case INS_BRIT:
+        case INS_BRIF:
+        case INS_CALL:
+        case INS_SPAWN:
+            return 1;
+        case INS_TABLESWITCH:
+            return 1 + read_int32(program, offset + 5);
+        case INS_LOOKUPSWITCH:
+            return 1 + read_int32(program, offset + 1);
+        default:
+            return 0;
+    }
+}
+
+int32_t peephole_address_position(const uint8_t* program, int32_t offset, int32_t n)
+{
+    switch (program[offset]) {
+        case INS_TABLESWITCH:
+            return offset + 9 + n * sizeof(int32_t);
+        case INS_LOOKUPSWITCH:
+            return offset + 5 + (n == 0 ? 0 : 2 * n * (int32_t)sizeof(int32_t));
+        default:
+            return offset + 1;
+    }
+}
+
+static int is_terminator(uint8_t op)
+{
+    switch (op) {
+        case INS_HALT:
+        case INS_BR:
+        case INS_RET:
+        case INS_RETVOID:
+        case INS_MEMORET:
+        case INS_TABLESWITCH:
+        case INS_LOOKUPSWITCH:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static uint8_t op_of(peephole_t* p, int32_t index)
+{
+    return p->program[p->instructions[index].offset];
+}
+
+// first instruction left at or after `index`.
+static int32_t live(peephole_t* p, int32_t index)
+{
+    while (index < p->instructions_len && p->instructions[index].removed)
+        index++;
+
+    return index;
+}
+
+static int32_t live_at(peephole_t* p, int32_t offset)
+{
+    if (offset < 0 || offset >= p->program_len || p->at[offset] == -1)
+        return p->instructions_len;
+
+    return live(p, p->at[offset]);
+}
+
+// whether the instruction is there and can only be reached from the one before.
+static int is_inner(peephole_t* p, int32_t index)
+{
+    return index < p->instructions_len && !p->instructions[index].target;
+}
+
+static void mark_targets(peephole_t* p, int32_t start)
+{
+    for (int32_t i = 0; i < p->instructions_len; i++)
+        p->instructions[i].target = 0;
+
+    if (live_at(p, start) < p->instructions_len)
+        p->instructions[live_at(p, start)].target = 1;
+
+    for (int32_t i = 0; i < p->instructions_len; i++) {
+        instruction_t* ins = &p->instructions[i];
+
+        if (ins->removed)
+            continue;
+
+        for (int32_t n = 0; n < peephole_addresses_len(p->program, ins->offset); n++) {
+            int32_t addr = read_int32(p->program, peephole_address_position(p->program, ins->offset, n));
+            int32_t target = live_at(p, addr);
+
+            if (target < p->instructions_len)
+                p->instructions[target].target = 1;
+        }
+    }
+}
+
+// points the addresses of the instruction past chains of BR.
+static int thread_branches(peephole_t* p, int32_t index)
+{
+    int changed = 0;
+    instruction_t* ins = &p->instructions[index];
+
+    if (op_of(p, index) == INS_CALL || op_of(p, index) == INS_SPAWN)
+        return 0;
+
+    for (int32_t n = 0; n < peephole_addresses_len(p->program, ins->offset); n++) {
+        int32_t position = peephole_address_position(p->program, ins->offset, n);
+        int32_t addr = read_int32(p->program, position);
+
+        // bounded so loops made of branches only are left alone.
+        for (int32_t hops = 0; hops < 8; hops++) {
+            int32_t target = live_at(p, addr);
+
+            if (target == p->instructions_len || target == index || op_of(p, target) != INS_BR)
+                break;
+
+            int32_t next = read_int32(p->program, p->instructions[target].offset + 1);
+
+            if (live_at(p, next) == target)
+                break;
+
+            addr = next;
+        }
+
+        if (addr != read_int32(p->program, position)) {
+            write_int32(p->program, position, addr);
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+// branches to a removed instruction fall through to the next one.
+static void remove_instruction(peephole_t* p, int32_t index)
+{
+    p->instructions[index].removed = 1;
+
+    int32_t next = live(p, index + 1);
+
+    if (p->instructions[index].target && next < p->instructions_len)
+        p->instructions[next].target = 1;
+}
+
+static void rewrite(peephole_t* p, int32_t index, uint8_t op)
+{
+    instruction_t* ins = &p->instructions[index];
+
+    p->program[ins->offset] = op;
+    ins->len = peephole_instruction_len(p->program, ins->offset);
+}
+
+// the binary operator of an int instruction, as in expr_binary_t.
+static char int_operator(uint8_t op)
+{
+    switch (op) {
+        case INS_IADD: return '+';
+        case INS_ISUB: return '-';
+        case INS_IMUL: return '*';
+        case INS_IDIV: return '/';
+        case INS_IMOD: return '%';
+        case INS_IAND: return '&';
+        case INS_IOR:  return '|';
+        case INS_IXOR: return '^';
+        case INS_ISHL: return 'L';
+        case INS_ISHR: return 'R';
+        case INS_IEQ:  return '=';
+        case INS_INEQ: return '!';
+        case INS_ILT:  return '<';
+        case INS_IGT:  return '>';
+        case INS_ILTE: return 'l';
+        case INS_IGTE: return 'g';
+        default:       return 0;
+    }
+}
+
+static int is_push(uint8_t op)
+{
+    return op == INS_IPUSH || op == INS_DPUSH || op == INS_DUP || op == INS_LOADARG;
+}
+
+static int simplify(peephole_t* p, int32_t index)
+{
+    instruction_t* instructions = p->instructions;
+    instruction_t* ins = &instructions[index];
+    uint8_t op = op_of(p, index);
+
+    int32_t next = live(p, index + 1);
+    int32_t after = is_inner(p, next) ? live(p, next + 1) : p->instructions_len;
+
+    if (op == INS_BR || op == INS_BRIT || op == INS_BRIF) {
+        int32_t target = live_at(p, read_int32(p->program, ins->offset + 1));
+
+        if (target == next) {
+            if (op == INS_BR) {
+                remove_instruction(p, index);
+            } else {
+                rewrite(p, index, INS_POP);
+            }
+
+            return 1;
+        }
+
+        if (op == INS_BR && target < p->instructions_len) {
+            uint8_t exit = op_of(p, target);
+
+            if (exit == INS_RET || exit == INS_RETVOID || exit == INS_HALT) {
+                rewrite(p, index, exit);
+                return 1;
+            }
+        }
+
+        // BRIT over a BR is a BRIF to the BR's target.
+        if (op != INS_BR && is_inner(p, next) && op_of(p, next) == INS_BR && target == after) {
+            p->program[ins->offset] = op == INS_BRIT ? INS_BRIF : INS_BRIT;
+            write_int32(p->program, ins->offset + 1, read_int32(p->program, instructions[next].offset + 1));
+            remove_instruction(p, next);
+            return 1;
+        }
+    }
+
+    if (op == INS_IPUSH && is_inner(p, next)) {
+        int32_t value = read_int32(p->program, ins->offset + 1);
+        uint8_t branch = op_of(p, next);
+
+        if (branch == INS_BRIT || branch == INS_BRIF) {
+            remove_instruction(p, index);
+
+            if ((branch == INS_BRIT) == (value != 0)) {
+                rewrite(p, next, INS_BR);
+            } else {
+                remove_instruction(p, next);
+            }
+
+            return 1;
+        }
+
+        int32_t result;
+
+        if (branch == INS_IPUSH && is_inner(p, after) && int_operator(op_of(p, after))
+            && ir_fold_int(int_operator(op_of(p, after)), value, read_int32(p->program, instructions[next].offset + 1), &result)) {
+            write_int32(p->program, ins->offset + 1, result);
+            remove_instruction(p, next);
+            remove_instruction(p, after);
+            return 1;
+        }
+
+        // `!x` feeding a branch.
+        if (value == 0 && branch == INS_IEQ && is_inner(p, after) && (op_of(p, after) == INS_BRIT || op_of(p, after) == INS_BRIF)) {
+            remove_instruction(p, index);
+            remove_instruction(p, next);
+            p->program[instructions[after].offset] = op_of(p, after) == INS_BRIT ? INS_BRIF : INS_BRIT;
+            return 1;
+        }
+    }
+
+    if (is_push(op) && is_inner(p, next) && op_of(p, next) == INS_POP) {
+        remove_instruction(p, index);
+        remove_instruction(p, next);
+        return 1;
+    }
+
+    if (op == INS_DUP && is_inner(p, next) && op_of(p, next) == INS_SET
+        && read_int32(p->program, ins->offset + 1) == read_int32(p->program, instructions[next].offset + 1)) {
+        remove_instruction(p, index);
+        remove_instruction(p, next);
+        return 1;
+    }
+
+    if (is_terminator(op) && is_inner(p, next)) {
+        for (; is_inner(p, next); next = live(p, next + 1))
+            remove_instruction(p, next);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+static void decode(peephole_t* p, int32_t from)
+{
+    p->at = malloc(sizeof(int32_t) * p->program_len);
+
+    for (int32_t i = 0; i < p->program_len; i++)
+        p->at[i] = -1;
+
+    int32_t cap = 0;
+
+    for (int32_t offset = from; offset < p->program_len;) {
+        if (p->instructions_len == cap) {
+            cap = cap ? cap * 2 : 256;
+            p->instructions = realloc(p->instructions, sizeof(instruction_t) * cap);
+        }
+
+        int32_t len = peephole_instruction_len(p->program, offset);
+        assert(offset + len <= p->program_len && "TRUNCATED INSTRUCTION");
+
+        p->at[offset] = p->instructions_len;
+        p->instructions[p->instructions_len++] = (instruction_t) {
+            .offset = offset,
+            .len = len,
+        };
+
+        offset += len;
+    }
+}
+
+int32_t peephole_optimize(npb_t* pb, int32_t from, int32_t start, peephole_stats_t* stats)
+{
+    peephole_t p = {
+        .program = pb->program,
+        .program_len = pb->program_len,
+    };
+
+    decode(&p, from);
+
+    int changed = 1;
+
+    while (changed) {
+        changed = 0;
+        mark_targets(&p, start);
+
+        for (int32_t i = 0; i < p.instructions_len; i++) {
+            if (p.instructions[i].removed)
+                continue;
+
+            changed |= thread_branches(&p, i);
+            changed |= simplify(&p, i);
+        }
+    }
+
+    // new offset of every old one, removed instructions go to what follows.
+    int32_t* moved = malloc(sizeof(int32_t) * (p.program_len + 1));
+    int32_t offset = from;
+
+    for (int32_t i = 0; i < from; i++)
+        moved[i] = i;
+
+    for (int32_t i = 0; i < p.instructions_len; i++) {
+        instruction_t* ins = &p.instructions[i];
+        moved[ins->offset] = offset;
+
+        if (!ins->removed)
+            offset += ins->len;
+    }
+
+    moved[p.program_len] = offset;
+
+    uint8_t* program = malloc(pb->program_cap);
+    int32_t program_len = from;
+    int32_t instructions_after = 0;
+
+    memcpy(program, p.program, from);
+
+    for (int32_t i = 0; i < p.instructions_len; i++) {
+        instruction_t* ins = &p.instructions[i];
+
+        if (ins->removed)
+            continue;
+
+        memcpy(program + program_len, p.program + ins->offset, ins->len);
+
+        for (int32_t n = 0; n < peephole_addresses_len(p.program, ins->offset); n++) {
+            int32_t position = peephole_address_position(p.program, ins->offset, n);
+            int32_t addr = read_int32(p.program, position);
+
+            write_int32(program, position - ins->offset + program_len, moved[addr]);
+        }
+
+        program_len += ins->len;
+        instructions_after++;
+    }
+
+    if (stats) {
+        stats->instructions_before += p.instructions_len;
+        stats->instructions_after += instructions_after;
+        stats->bytes_before += pb->program_len - from;
+        stats->bytes_after += program_len - from;
+    }
+
+    start = moved[start];
+
+    free(pb->program);
+    pb->program = program;
+    pb->program_len = program_len;
+
+    free(moved);
+    free(p.instructions);
+    free(p.at);
+
+    return start;
+}
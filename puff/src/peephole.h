@@ -0,0 +1,25 @@
+#pragma once
+
+#include "vm.h"
+
+typedef struct {
+    int32_t instructions_before;
+    int32_t instructions_after;
+    int32_t bytes_before;
+    int32_t bytes_after;
+} peephole_stats_t;
+
+// size in bytes of the instruction at `offset`, including its operands.
+int32_t peephole_instruction_len(const uint8_t* program, int32_t offset);
+
+// number of addresses in the operands of the instruction at `offset`, and
+// where the `n`th is stored. the default target comes first for switches.
+int32_t peephole_addresses_len(const uint8_t* program, int32_t offset);
+int32_t peephole_address_position(const uint8_t* program, int32_t offset, int32_t n);
+
+// rewrites local waste in the generated program: pushes that are popped right
+// away, stores of what was just loaded, branches to the next instruction or to
+// other branches and unreachable code. only the code from `from` on is
+// rewritten, addresses are fixed up, returns where `start` ended up. `stats`
+// are added to.
+int32_t peephole_optimize(npb_t* pb, int32_t from, int32_t start, peephole_stats_t* stats);
@@ -0,0 +1,124 @@
+#include "profile.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void profile_init(profile_t* profile)
+{
+    profile->entries = NULL;
+    profile->entries_len = 0;
+    profile->entries_cap = 0;
+    profile->calls = 0;
+}
+
+void profile_free(profile_t* profile)
+{
+    for (int32_t i = 0; i < profile->entries_len; i++)
+        free(profile->entries[i].function);
+
+    free(profile->entries);
+    profile_init(profile);
+}
+
+static profile_entry_t* lookup(const profile_t* profile, const char* function, int32_t function_len, int site)
+{
+    for (int32_t i = 0; i < profile->entries_len; i++) {
+        profile_entry_t* entry = &profile->entries[i];
+
+        if (entry->site == site && (int32_t)strlen(entry->function) == function_len && strncmp(entry->function, function, function_len) == 0)
+            return entry;
+    }
+
+    return NULL;
+}
+
+const profile_entry_t* profile_lookup(const profile_t* profile, const char* function, int32_t function_len, int site)
+{
+    return lookup(profile, function, function_len, site);
+}
+
+int32_t profile_add(profile_t* profile, const char* function, int32_t function_len, int site, int64_t count, int64_t skipped)
+{
+    profile_entry_t* entry = lookup(profile, function, function_len, site);
+
+    if (!entry) {
+        if (profile->entries_len == profile->entries_cap) {
+            profile->entries_cap = profile->entries_cap ? profile->entries_cap * 2 : 16;
+            profile->entries = realloc(profile->entries, sizeof(profile_entry_t) * profile->entries_cap);
+        }
+
+        entry = &profile->entries[profile->entries_len++];
+        *entry = (profile_entry_t) {
+            .function = strndup(function, function_len),
+            .site = site,
+        };
+    }
+
+    entry->count += count;
+    entry->skipped += skipped;
+
+    if (site == -1)
+        profile->calls += count;
+
+    return entry - profile->entries;
+}
+
+int profile_load(profile_t* profile, const char* path)
+{
+    FILE* input = fopen(path, "r");
+    if (!input)
+        return 0;
+
+    char kind[8];
+    char function[256];
+
+    int ok = 1;
+    int read;
+
+    while ((read = fscanf(input, "%7s %255s", kind, function)) == 2) {
+        int site = -1;
+        int64_t count = 0;
+        int64_t skipped = 0;
+
+        if (strcmp(kind, "call") == 0) {
+            ok = fscanf(input, "%" SCNd64, &count) == 1;
+        } else if (strcmp(kind, "if") == 0) {
+            ok = fscanf(input, "%d %" SCNd64 " %" SCNd64, &site, &count, &skipped) == 3
+                && site >= 0 && skipped >= 0 && skipped <= count;
+        } else {
+            ok = 0;
+        }
+
+        if (!ok || count < 0)
+            break;
+
+        profile_add(profile, function, strlen(function), site, count, skipped);
+    }
+
+    // a partial entry, like a lone word, is as bad as an unknown one.
+    ok = ok && read == EOF && feof(input);
+    fclose(input);
+
+    return ok;
+}
+
+int profile_save(const profile_t* profile, const char* path)
+{
+    FILE* output = fopen(path, "w");
+    if (!output)
+        return 0;
+
+    for (int32_t i = 0; i < profile->entries_len; i++) {
+        profile_entry_t* entry = &profile->entries[i];
+
+        if (entry->site == -1) {
+            fprintf(output, "call %s %" PRId64 "\n", entry->function, entry->count);
+        } else {
+            fprintf(output, "if %s %d %" PRId64 " %" PRId64 "\n", entry->function, entry->site, entry->count, entry->skipped);
+        }
+    }
+
+    return fclose(output) == 0;
+}
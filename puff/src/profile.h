@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+
+// counts of a run kept per source construct so they still apply once the
+// program is compiled differently. an entry is either the calls of a function
+// or how an if of the function went, ifs are numbered in source order.
+typedef struct {
+    char* function;
+    int site; // -1 for the calls of the function
+    int64_t count; // calls, or times the condition was tested
+    int64_t skipped; // times the then arm was skipped
+} profile_entry_t;
+
+typedef struct {
+    profile_entry_t* entries;
+    int32_t entries_len;
+    int32_t entries_cap;
+
+    int64_t calls; // of every function
+} profile_t;
+
+void profile_init(profile_t* profile);
+void profile_free(profile_t* profile);
+
+// adds to the entry, creating it if needed, returns its index.
+int32_t profile_add(profile_t* profile, const char* function, int32_t function_len, int site, int64_t count, int64_t skipped);
+
+// NULL if the run never got there.
+const profile_entry_t* profile_lookup(const profile_t* profile, const char* function, int32_t function_len, int site);
+
+// text format, one entry per line:
+//     call <function> <count>
+//     if <function> <site> <count> <skipped>
+// return 0 on failure.
+int profile_load(profile_t* profile, const char* path);
+int profile_save(const profile_t* profile, const char* path);
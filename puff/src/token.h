@@ -9,6 +9,12 @@ typedef enum {
     TOK_FUN,
     TOK_RETURN,
     TOK_IF,
+    TOK_ELSE,
+    TOK_MATCH,
+    TOK_CASE,
+    TOK_WHILE,
+    TOK_INLINE,
+    TOK_EXTERN,
     TOK_IDENTIFIER,
     TOK_INTLITERAL,
     TOK_DOUBLELITERAL,
@@ -16,10 +22,26 @@ typedef enum {
     TOK_MINUS,
     TOK_STAR,
     TOK_SLASH,
+    TOK_PERCENT,
+    TOK_AMPERSAND,
+    TOK_PIPE,
+    TOK_CARET,
+    TOK_LESSLESS,
+    TOK_GREATERGREATER,
+    TOK_LESS,
+    TOK_LESSEQUAL,
+    TOK_GREATER,
+    TOK_GREATEREQUAL,
+    TOK_AMPERSANDAMPERSAND,
+    TOK_PIPEPIPE,
+    TOK_BANG,
     TOK_LPAREN,
     TOK_RPAREN,
     TOK_LCURLYBRACE,
     TOK_RCURLYBRACE,
+    TOK_LBRACKET,
+    TOK_RBRACKET,
+    TOK_AT,
     TOK_EQUAL,
     TOK_COMMA,
     TOK_COLON,
@@ -0,0 +1,24 @@
+#!/bin/sh
+# runs every tests/*.puff with each backend and compares the output, stdout
+# then stderr, with the matching .out file. usage: tests/run.sh [puff]
+
+puff=${1:-./puff}
+dir=$(dirname "$0")
+failed=0
+
+for test in "$dir"/*.puff; do
+    expected="${test%.puff}.out"
+
+    for flags in "" "--ssa" "--inline-threshold 0"; do
+        if ! $puff $flags "$test" 2>&1 | cmp -s - "$expected"; then
+            echo "FAILED: $test $flags"
+            failed=$((failed + 1))
+        fi
+    done
+done
+
+if [ $failed -eq 0 ]; then
+    echo "puff tests passed"
+fi
+
+exit $failed
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "vm.h"
+
+// vms parked on one fd. the fd joins the epoll set on the first park and
+// stays there, it's re-armed for whatever its waiters wait for.
+typedef struct {
+    noice_t* waiters; // linked through park_next
+    uint32_t armed; // epoll events it's armed for, 0 once they fired
+    int registered;
+} nloop_fd_t;
+
+// epoll driven event loop that keeps many vms in flight on one thread, a vm
+// that parks on an async operation is resumed once its fd becomes ready.
+typedef struct {
+    int epoll_fd;
+    int32_t running; // vms that have not halted yet
+
+    nloop_fd_t* fds; // indexed by fd
+    int32_t fds_cap;
+} nloop_t;
+
+int nloop_init(nloop_t* loop);
+void nloop_free(nloop_t* loop);
+
+// runs the vm until it halts or parks, parked vms are picked up by nloop_run.
+// any number of vms can wait on the same fd. a vm whose fd can't be waited on
+// stops with TRAP_WAIT_FAILED in vm->trap.
+void nloop_add(nloop_t* loop, noice_t* vm);
+
+// returns once every added vm has stopped.
+void nloop_run(nloop_t* loop);
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "value.h"
+
+#define OUTPUT_BUFFER_CAP 8192
+
+typedef enum {
+    OUTPUT_FD,
+    OUTPUT_MEMORY,
+    OUTPUT_CALLBACK,
+} noutput_kind_t;
+
+typedef enum {
+    OUTPUT_TEXT,
+    // every value is written as a tag byte ('i' or 'd') followed by its
+    // int32/double in native byte order.
+    OUTPUT_BINARY,
+} noutput_mode_t;
+
+typedef void (*noutput_fn_t)(const char* data, int32_t len, void* userdata);
+
+// buffered output channel used by INS_PRINT, the buffer is handed to the sink
+// when it fills up and on noutput_flush.
+typedef struct {
+    noutput_kind_t kind;
+    noutput_mode_t mode;
+
+    char buffer[OUTPUT_BUFFER_CAP];
+    int32_t buffer_len;
+
+    int fd;
+    int error; // errno of the first failed flush, 0 if none
+
+    // everything flushed to an OUTPUT_MEMORY sink, owned by the channel.
+    char* memory;
+    int32_t memory_len;
+    int32_t memory_cap;
+
+    noutput_fn_t fn;
+    void* userdata;
+} noutput_t;
+
+void noutput_init_fd(noutput_t* out, int fd);
+void noutput_init_memory(noutput_t* out);
+void noutput_init_callback(noutput_t* out, noutput_fn_t fn, void* userdata);
+
+// flushes and releases the channel.
+void noutput_free(noutput_t* out);
+
+void noutput_value(noutput_t* out, value_t value);
+
+// returns 0 if this or an earlier flush failed, see `error`.
+int noutput_flush(noutput_t* out);
@@ -7,6 +7,7 @@
 typedef enum {
     VAL_DOUBLE,
     VAL_INT,
+    VAL_ARRAY,
     VAL_UNKNOWN,
 } value_kind_t;
 
@@ -17,10 +18,15 @@ typedef int64_t value_t;
 
 #define INT_MASK        0xfffa000000000000
 
+// compared against the whole tag, INT_MASK style masking would also match it.
+#define ARRAY_TAG       0xfffc000000000000
+
 value_kind_t value_get_type(value_t value);
 
 value_t value_from_double(double value);
 value_t value_from_int(int32_t value);
+value_t value_from_array(int32_t handle);
 
 double value_as_double(value_t value);
 int32_t value_as_int(value_t value);
+int32_t value_as_array(value_t value);
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <stddef.h>
+
+#include "output.h"
 #include "value.h"
 
 // noice program builder.
@@ -23,6 +26,12 @@ void npb_iadd(npb_t* pb);
 void npb_isub(npb_t* pb);
 void npb_imul(npb_t* pb);
 void npb_idiv(npb_t* pb);
+void npb_imod(npb_t* pb);
+void npb_iand(npb_t* pb);
+void npb_ior(npb_t* pb);
+void npb_ixor(npb_t* pb);
+void npb_ishl(npb_t* pb);
+void npb_ishr(npb_t* pb);
 void npb_ieq(npb_t* pb);
 void npb_ineq(npb_t* pb);
 void npb_ilt(npb_t* pb);
@@ -41,12 +50,47 @@ void npb_dlte(npb_t* pb);
 void npb_dgte(npb_t* pb);
 void npb_br(npb_t* pb, int32_t addr);
 void npb_brit(npb_t* pb, int32_t addr);
+void npb_brif(npb_t* pb, int32_t addr);
+void npb_memoenter(npb_t* pb, int32_t index);
+void npb_memoret(npb_t* pb, int32_t index);
 void npb_call(npb_t* pb, int32_t addr, int32_t num_args);
 void npb_ret(npb_t* pb);
 void npb_retvoid(npb_t* pb);
 void npb_loadarg(npb_t* pb, int32_t n);
+void npb_setarg(npb_t* pb, int32_t n);
+void npb_spawn(npb_t* pb, int32_t addr, int32_t num_args);
+void npb_yield(npb_t* pb);
+void npb_resume(npb_t* pb);
+void npb_await(npb_t* pb, int32_t index, int32_t num_args);
+void npb_callnative(npb_t* pb, int32_t index, int32_t num_args);
+void npb_callstub(npb_t* pb, int32_t index, int32_t num_args);
+void npb_spawnstub(npb_t* pb, int32_t index, int32_t num_args);
+void npb_i2d(npb_t* pb);
+void npb_d2i(npb_t* pb);
+void npb_dsqrt(npb_t* pb);
+void npb_dabs(npb_t* pb);
+void npb_iabs(npb_t* pb);
+void npb_dfloor(npb_t* pb);
+void npb_dceil(npb_t* pb);
+void npb_imin(npb_t* pb);
+void npb_imax(npb_t* pb);
+void npb_dmin(npb_t* pb);
+void npb_dmax(npb_t* pb);
+void npb_dfma(npb_t* pb);
+void npb_tableswitch(npb_t* pb, int32_t low, int32_t count, int32_t default_addr, const int32_t* addrs);
+void npb_lookupswitch(npb_t* pb, int32_t count, int32_t default_addr, const int32_t* keys, const int32_t* addrs);
+void npb_anew(npb_t* pb, value_kind_t kind);
+void npb_aload(npb_t* pb);
+void npb_astore(npb_t* pb);
+void npb_aloadu(npb_t* pb);
+void npb_astoreu(npb_t* pb);
+void npb_alen(npb_t* pb);
 
 #define STACK_CAP 1024
+#define COROUTINE_STACK_CAP 256
+#define COROUTINE_INDEX_BITS 20 // of a coroutine handle, the generation is above
+#define MEMO_CAP 4096
+#define HEAP_LIMIT (1 << 20) // bytes of arrays allocated before the first collection
 
 typedef enum {
     TRAP_OK,
@@ -54,6 +98,18 @@ typedef enum {
     TRAP_STACK_OVERFLOW,
     TRAP_STACK_UNDERFLOW,
     TRAP_UNKNOWN_OPCODE,
+    TRAP_INVALID_COROUTINE,
+    TRAP_INVALID_ASYNC,
+    TRAP_INVALID_NATIVE,
+    TRAP_OUT_OF_BOUNDS,
+    TRAP_NEGATIVE_LENGTH,
+    TRAP_DIVISION_BY_ZERO,
+    TRAP_PARK,
+    TRAP_INVALID_MEMO,
+    TRAP_OUT_OF_BUDGET,
+    TRAP_INVALID_STUB,
+    TRAP_OUT_OF_MEMORY,
+    TRAP_WAIT_FAILED, // set by nloop_t when the fd of a parked vm can't be polled
 } ntrap_t;
 
 typedef enum {
@@ -61,8 +117,8 @@ typedef enum {
     INS_IPUSH,
     INS_DPUSH,
     INS_POP,
-    INS_DUP,
-    INS_SET,
+    INS_DUP, // relative to the frame
+    INS_SET, // relative to the frame
     INS_PRINT,
     INS_IADD,
     INS_ISUB,
@@ -90,21 +146,209 @@ typedef enum {
     INS_RET,
     INS_RETVOID,
     INS_LOADARG,
+    INS_SPAWN,
+    INS_YIELD,
+    INS_RESUME,
+    INS_AWAIT,
+    INS_CALLNATIVE,
+    INS_I2D,
+    INS_D2I,
+    INS_DSQRT,
+    INS_DABS,
+    INS_IABS,
+    INS_DFLOOR,
+    INS_DCEIL,
+    INS_IMIN,
+    INS_IMAX,
+    INS_DMIN,
+    INS_DMAX,
+    INS_DFMA,
+    INS_ANEW,
+    INS_ALOAD,
+    INS_ASTORE,
+    INS_ALOADU, // without bounds check
+    INS_ASTOREU, // without bounds check
+    INS_ALEN,
+    INS_IMOD,
+    INS_IAND,
+    INS_IOR,
+    INS_IXOR,
+    INS_ISHL,
+    INS_ISHR,
+    INS_TABLESWITCH, // low, count, default, addrs[count]
+    INS_LOOKUPSWITCH, // count, default, (key, addr)[count] sorted by key
+    INS_BRIF,
+    INS_MEMOENTER, // returns the cached result of the current call, if any
+    INS_MEMORET, // caches the result of the current call then returns it
+    INS_SETARG,
+    INS_CALLSTUB, // index, num_args, becomes an INS_CALL once the function is compiled
+    INS_SPAWNSTUB, // index, num_args, becomes an INS_SPAWN once the function is compiled
 } ninstruction_t;
 
+// unboxed array living in the vm heap, values refer to it by index.
+typedef struct {
+    value_kind_t kind; // VAL_INT or VAL_DOUBLE
+    int32_t len;
+    void* data; // int32_t or double elements, NULL once freed
+    int32_t next; // next free slot
+    int marked;
+} narray_t;
+
+typedef enum {
+    CO_FREE,
+    CO_READY,
+} ncoroutine_state_t;
+
+// saved context of a coroutine that is not currently running.
+typedef struct {
+    ncoroutine_state_t state;
+    int32_t generation; // bumped when it finishes, so stale handles don't match
+
+    int32_t ip;
+    int32_t sp;
+    int32_t fp;
+
+    value_t* stack;
+    int32_t stack_cap;
+
+    int32_t next; // next coroutine in the run ring, or next free slot
+    int32_t prev; // previous coroutine in the run ring
+} ncoroutine_t;
+
+#define NOICE_WAIT_READ  1
+#define NOICE_WAIT_WRITE 2
+
+typedef enum {
+    ASYNC_DONE,
+    ASYNC_PENDING,
+} nasync_status_t;
+
+// host operation invoked by INS_AWAIT, it must not block. returning
+// ASYNC_PENDING parks the vm until `fd` is ready for `events`, the operation
+// is then called again with the same arguments.
+typedef nasync_status_t (*nasync_fn_t)(value_t* args, int32_t num_args, value_t* result, int* fd, int* events, void* userdata);
+
+typedef struct {
+    nasync_fn_t fn;
+    void* userdata;
+} nasync_t;
+
+// native function called by INS_CALLNATIVE. `args` points at the arguments on
+// the value stack, the result is written over args[0] and the function returns
+// how many values it produced (0 or 1).
+typedef int32_t (*nnative_fn_t)(value_t* args, int32_t num_args);
+
 typedef struct {
+    const char* name;
+    // parameter kinds then the return kind, 'i' int, 'd' double, 'v' void.
+    // e.g. "dd:d" takes two doubles and returns a double.
+    const char* signature;
+    nnative_fn_t fn;
+} nnative_t;
+
+// results of a memoized function, open addressed on the argument tuple.
+typedef struct {
+    int32_t num_args;
+    int32_t cap; // power of two, 0 until the first result is cached
+    int32_t len;
+    value_t* keys; // num_args values per entry
+    value_t* results;
+    uint8_t* used;
+} nmemo_t;
+
+typedef struct noice noice_t;
+
+// compiles the function a stub refers to on its first execution and returns
+// where it starts. the host appends the code and updates vm->program and
+// vm->program_len, addresses already in the program must stay valid.
+typedef int32_t (*ncompile_fn_t)(noice_t* vm, int32_t index, void* userdata);
+
+// counts gathered while profiling, indexed by program offset.
+typedef struct {
+    int64_t* calls; // CALLs and SPAWNs of the function starting at the offset
+    int64_t* branches; // executions of the BRIT or BRIF at the offset
+    int64_t* taken; // executions where it jumped
+} nprofile_t;
+
+struct noice {
     uint8_t* program;
     int32_t program_len;
 
     int32_t ip; // instruction pointer
 
-    value_t stack[STACK_CAP];
+    value_t* stack; // stack of the running coroutine
+    int32_t stack_cap;
 
     int32_t sp; // stack pointer
     int32_t fp; // frame pointer
-} noice_t;
+
+    // coroutine 0 is the main program, it's the only one with STACK_CAP slots.
+    ncoroutine_t* coroutines;
+    int32_t coroutines_len;
+    int32_t coroutines_cap;
+    int32_t current; // index of the running coroutine
+    int32_t free; // head of the free slot list, -1 if empty
+
+    nasync_t* asyncs;
+    int32_t asyncs_len;
+    int32_t asyncs_cap;
+
+    // arrays no stack refers to anymore are freed when the allocated bytes
+    // pass heap_limit, which then grows with what's still live.
+    narray_t* heap;
+    int32_t heap_len;
+    int32_t heap_cap;
+    int32_t heap_free; // head of the free slot list, -1 if empty
+    size_t heap_bytes;
+    size_t heap_limit;
+
+    const nnative_t* natives; // owned by the host
+    int32_t natives_len;
+
+    // indexed by INS_MEMOENTER/INS_MEMORET, created on first use.
+    nmemo_t* memos;
+    int32_t memos_len;
+    int32_t memo_cap; // max entries per cache, MEMO_CAP by default, 0 disables caching
+
+    // stdout by default, a host can free it and set up another sink before running.
+    noutput_t output;
+
+    // what a parked vm is waiting for.
+    int park_fd;
+    int park_events;
+    struct noice* park_next; // next vm parked on the same fd, used by nloop_t
+
+    ntrap_t trap; // why the last run stopped
+
+    nprofile_t* profile; // NULL unless profiling
+
+    // called by INS_CALLSTUB and INS_SPAWNSTUB, NULL if the program has none.
+    ncompile_fn_t compile;
+    void* compile_userdata;
+};
 
 void noice_init(noice_t* vm);
+void noice_free(noice_t* vm);
 void noice_load_program(noice_t* vm, uint8_t* program, int32_t program_len, int32_t program_start);
 
-void noice_run(noice_t* vm);
+// counts calls and conditional branches of the loaded program from now on,
+// in vm->profile.
+void noice_enable_profile(noice_t* vm);
+
+// the table is indexed by INS_CALLNATIVE and must outlive the vm.
+void noice_register_natives(noice_t* vm, const nnative_t* natives, int32_t natives_len);
+
+// lets the program compile functions lazily through stubs.
+void noice_register_compiler(noice_t* vm, ncompile_fn_t compile, void* userdata);
+
+// returns the index used by INS_AWAIT.
+int32_t noice_register_async(noice_t* vm, nasync_fn_t fn, void* userdata);
+
+// runs until the program halts, traps or parks on an async operation (TRAP_PARK),
+// a parked vm continues where it stopped on the next call. the output is
+// flushed before returning.
+ntrap_t noice_run(noice_t* vm);
+
+// like noice_run but stops with TRAP_OUT_OF_BUDGET after `budget`
+// instructions, and traps are left to the caller instead of being reported.
+ntrap_t noice_run_budget(noice_t* vm, int64_t budget);
@@ -0,0 +1,218 @@
+#include "loop.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define LOOP_EVENTS_CAP 64
+
+int nloop_init(nloop_t* loop)
+{
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->running = 0;
+
+    loop->fds = NULL;
+    loop->fds_cap = 0;
+
+    return loop->epoll_fd == -1 ? -1 : 0;
+}
+
+void nloop_free(nloop_t* loop)
+{
+    if (loop->epoll_fd != -1)
+        close(loop->epoll_fd);
+
+    free(loop->fds);
+
+    loop->epoll_fd = -1;
+    loop->running = 0;
+    loop->fds = NULL;
+    loop->fds_cap = 0;
+}
+
+static uint32_t epoll_events(int park_events)
+{
+    uint32_t events = 0;
+
+    if (park_events & NOICE_WAIT_READ)
+        events |= EPOLLIN;
+
+    if (park_events & NOICE_WAIT_WRITE)
+        events |= EPOLLOUT;
+
+    return events;
+}
+
+// returns 0 with errno set if the fd can't be tracked.
+static int reserve_fd(nloop_t* loop, int fd)
+{
+    if (fd < 0) {
+        errno = EBADF;
+        return 0;
+    }
+
+    if (fd < loop->fds_cap)
+        return 1;
+
+    int32_t cap = loop->fds_cap ? loop->fds_cap : 64;
+
+    while (cap <= fd)
+        cap *= 2;
+
+    nloop_fd_t* fds = realloc(loop->fds, sizeof(*fds) * cap);
+
+    if (!fds) {
+        errno = ENOMEM;
+        return 0;
+    }
+
+    memset(fds + loop->fds_cap, 0, sizeof(*fds) * (cap - loop->fds_cap));
+
+    loop->fds = fds;
+    loop->fds_cap = cap;
+
+    return 1;
+}
+
+// arms the fd, oneshot, for what its waiters wait for. that's a single
+// syscall when it has to change and none when a waiter joins an armed fd.
+// returns 0 with errno set on failure.
+static int arm(nloop_t* loop, int fd)
+{
+    nloop_fd_t* entry = &loop->fds[fd];
+    uint32_t events = 0;
+
+    for (noice_t* vm = entry->waiters; vm; vm = vm->park_next)
+        events |= epoll_events(vm->park_events);
+
+    if ((events & entry->armed) == events)
+        return 1;
+
+    struct epoll_event event = {
+        .events = events | EPOLLONESHOT,
+        .data.fd = fd,
+    };
+
+    int op = entry->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (epoll_ctl(loop->epoll_fd, op, fd, &event) == -1) {
+        // the fd was closed and reused since it was registered, or registered
+        // by someone else.
+        if (errno != ENOENT && errno != EEXIST)
+            return 0;
+
+        op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+        if (epoll_ctl(loop->epoll_fd, op, fd, &event) == -1)
+            return 0;
+    }
+
+    entry->registered = 1;
+    entry->armed = events;
+
+    return 1;
+}
+
+static void wait_failed(noice_t* vm, int fd)
+{
+    fprintf(stderr, "ERROR: cannot wait on fd %d: %s\n", fd, strerror(errno));
+    vm->trap = TRAP_WAIT_FAILED;
+}
+
+// runs the vm until it stops, returns 1 while it waits on its fd.
+static int step(nloop_t* loop, noice_t* vm)
+{
+    while (noice_run(vm) == TRAP_PARK) {
+        int fd = vm->park_fd;
+
+        if (!reserve_fd(loop, fd)) {
+            wait_failed(vm, fd);
+            return 0;
+        }
+
+        nloop_fd_t* entry = &loop->fds[fd];
+        vm->park_next = entry->waiters;
+        entry->waiters = vm;
+
+        if (arm(loop, fd))
+            return 1;
+
+        entry->waiters = vm->park_next;
+
+        // regular files can't be polled but never block either, retry right away.
+        if (errno != EPERM) {
+            wait_failed(vm, fd);
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+void nloop_add(nloop_t* loop, noice_t* vm)
+{
+    if (step(loop, vm))
+        loop->running++;
+}
+
+// resumes the waiters of `fd` that can make progress with `ready`.
+static void wake(nloop_t* loop, int fd, uint32_t ready)
+{
+    noice_t* waiters = loop->fds[fd].waiters;
+
+    loop->fds[fd].waiters = NULL;
+    loop->fds[fd].armed = 0;
+
+    // errors and hangups wake everyone, the operation sees them when retried.
+    if (ready & (EPOLLERR | EPOLLHUP))
+        ready |= EPOLLIN | EPOLLOUT;
+
+    for (noice_t *vm = waiters, *next; vm; vm = next) {
+        next = vm->park_next;
+
+        // a vm resumed may park again and grow the table.
+        nloop_fd_t* entry = &loop->fds[fd];
+
+        if (!(ready & epoll_events(vm->park_events))) {
+            vm->park_next = entry->waiters;
+            entry->waiters = vm;
+            continue;
+        }
+
+        if (!step(loop, vm))
+            loop->running--;
+    }
+
+    if (!loop->fds[fd].waiters || arm(loop, fd))
+        return;
+
+    for (noice_t* vm = loop->fds[fd].waiters; vm; vm = vm->park_next) {
+        wait_failed(vm, fd);
+        loop->running--;
+    }
+
+    loop->fds[fd].waiters = NULL;
+}
+
+void nloop_run(nloop_t* loop)
+{
+    struct epoll_event events[LOOP_EVENTS_CAP];
+
+    while (loop->running > 0) {
+        int n = epoll_wait(loop->epoll_fd, events, LOOP_EVENTS_CAP, -1);
+
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            perror("ERROR: epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < n; i++)
+            wake(loop, events[i].data.fd, events[i].events);
+    }
+}
@@ -0,0 +1,521 @@
+#include "output.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// longest text a single value can produce, "-1.2345678901234567e-308\n" fits.
+#define VALUE_TEXT_CAP 32
+
+static const char digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static void output_init(noutput_t* out, noutput_kind_t kind)
+{
+    out->kind = kind;
+    out->mode = OUTPUT_TEXT;
+    out->buffer_len = 0;
+
+    out->fd = -1;
+    out->error = 0;
+
+    out->memory = NULL;
+    out->memory_len = 0;
+    out->memory_cap = 0;
+
+    out->fn = NULL;
+    out->userdata = NULL;
+}
+
+void noutput_init_fd(noutput_t* out, int fd)
+{
+    output_init(out, OUTPUT_FD);
+    out->fd = fd;
+}
+
+void noutput_init_memory(noutput_t* out)
+{
+    output_init(out, OUTPUT_MEMORY);
+}
+
+void noutput_init_callback(noutput_t* out, noutput_fn_t fn, void* userdata)
+{
+    output_init(out, OUTPUT_CALLBACK);
+    out->fn = fn;
+    out->userdata = userdata;
+}
+
+void noutput_free(noutput_t* out)
+{
+    noutput_flush(out);
+
+    free(out->memory);
+
+    out->memory = NULL;
+    out->memory_len = 0;
+    out->memory_cap = 0;
+}
+
+int noutput_flush(noutput_t* out)
+{
+    if (out->buffer_len == 0)
+        return !out->error;
+
+    switch (out->kind) {
+        case OUTPUT_FD: {
+            const char* data = out->buffer;
+            int32_t len = out->buffer_len;
+
+            while (len > 0) {
+                ssize_t written = write(out->fd, data, len);
+
+                if (written < 0 && errno == EINTR)
+                    continue;
+
+                // the rest of the buffer is dropped.
+                if (written <= 0) {
+                    out->error = written < 0 ? errno : EIO;
+                    break;
+                }
+
+                data += written;
+                len -= written;
+            }
+        } break;
+        case OUTPUT_MEMORY: {
+            if (out->memory_len + out->buffer_len > out->memory_cap) {
+                int32_t cap = out->memory_cap;
+
+                while (out->memory_len + out->buffer_len > cap)
+                    cap = cap ? cap * 2 : OUTPUT_BUFFER_CAP;
+
+                char* memory = realloc(out->memory, cap);
+
+                if (!memory) {
+                    out->error = ENOMEM;
+                    break;
+                }
+
+                out->memory = memory;
+                out->memory_cap = cap;
+            }
+
+            memcpy(out->memory + out->memory_len, out->buffer, out->buffer_len);
+            out->memory_len += out->buffer_len;
+        } break;
+        case OUTPUT_CALLBACK: {
+            out->fn(out->buffer, out->buffer_len, out->userdata);
+        } break;
+    }
+
+    out->buffer_len = 0;
+
+    return !out->error;
+}
+
+// writes the digits of `value` ending right before `end`, returns the first digit.
+static char* format_u64(char* end, uint64_t value)
+{
+    while (value >= 100) {
+        const char* pair = digit_pairs + (value % 100) * 2;
+        value /= 100;
+
+        *--end = pair[1];
+        *--end = pair[0];
+    }
+
+    if (value >= 10) {
+        const char* pair = digit_pairs + value * 2;
+
+        *--end = pair[1];
+        *--end = pair[0];
+    } else {
+        *--end = '0' + value;
+    }
+
+    return end;
+}
+
+static int32_t format_int(char* dst, int64_t value)
+{
+    char digits[VALUE_TEXT_CAP];
+    char* end = digits + sizeof(digits);
+
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    char* start = format_u64(end, magnitude);
+
+    if (value < 0)
+        *--start = '-';
+
+    memcpy(dst, start, end - start);
+    return end - start;
+}
+
+// base 2^32 digits, least significant first. a double scaled for digit
+// generation stays under 2^1131 (4 * 2^52 * 10^324).
+#define BIG_CAP 40
+
+typedef struct {
+    uint32_t words[BIG_CAP];
+    int32_t len;
+} big_t;
+
+static void big_from_u64(big_t* b, uint64_t value)
+{
+    b->words[0] = (uint32_t)value;
+    b->words[1] = (uint32_t)(value >> 32);
+    b->len = b->words[1] ? 2 : b->words[0] ? 1 : 0;
+}
+
+static void big_shift_left(big_t* b, int32_t bits)
+{
+    int32_t words = bits / 32;
+    bits %= 32;
+
+    if (b->len == 0)
+        return;
+
+    b->words[b->len] = 0;
+
+    for (int32_t i = b->len; i >= 0; i--) {
+        uint32_t high = bits ? b->words[i] << bits : b->words[i];
+        uint32_t low = bits && i > 0 ? b->words[i - 1] >> (32 - bits) : 0;
+        b->words[i + words] = high | low;
+    }
+
+    for (int32_t i = 0; i < words; i++)
+        b->words[i] = 0;
+
+    b->len += words + 1;
+
+    while (b->len > 0 && b->words[b->len - 1] == 0)
+        b->len--;
+}
+
+static void big_mul_small(big_t* b, uint32_t factor)
+{
+    uint64_t carry = 0;
+
+    for (int32_t i = 0; i < b->len; i++) {
+        uint64_t product = (uint64_t)b->words[i] * factor + carry;
+        b->words[i] = (uint32_t)product;
+        carry = product >> 32;
+    }
+
+    if (carry)
+        b->words[b->len++] = (uint32_t)carry;
+}
+
+static void big_mul_pow10(big_t* b, int32_t n)
+{
+    static const uint32_t powers[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+
+    for (; n >= 9; n -= 9)
+        big_mul_small(b, powers[9]);
+
+    if (n)
+        big_mul_small(b, powers[n]);
+}
+
+static int big_compare(const big_t* a, const big_t* b)
+{
+    if (a->len != b->len)
+        return a->len < b->len ? -1 : 1;
+
+    for (int32_t i = a->len - 1; i >= 0; i--) {
+        if (a->words[i] != b->words[i])
+            return a->words[i] < b->words[i] ? -1 : 1;
+    }
+
+    return 0;
+}
+
+static void big_add(big_t* sum, const big_t* a, const big_t* b)
+{
+    int32_t len = a->len > b->len ? a->len : b->len;
+    uint64_t carry = 0;
+
+    for (int32_t i = 0; i < len; i++) {
+        carry += (uint64_t)(i < a->len ? a->words[i] : 0) + (i < b->len ? b->words[i] : 0);
+        sum->words[i] = (uint32_t)carry;
+        carry >>= 32;
+    }
+
+    sum->len = len;
+
+    if (carry)
+        sum->words[sum->len++] = (uint32_t)carry;
+}
+
+// a -= b, with a >= b.
+static void big_sub(big_t* a, const big_t* b)
+{
+    int64_t borrow = 0;
+
+    for (int32_t i = 0; i < a->len; i++) {
+        int64_t difference = (int64_t)a->words[i] - (i < b->len ? b->words[i] : 0) - borrow;
+        borrow = difference < 0;
+        a->words[i] = (uint32_t)(difference + (borrow << 32));
+    }
+
+    while (a->len > 0 && a->words[a->len - 1] == 0)
+        a->len--;
+}
+
+// shortest digits that read back as `value` (finite and positive), closest to
+// it when several do, after steele & white's free-format algorithm. the value
+// is 0.digits * 10^exponent, returns how many digits were written.
+static int32_t shortest_digits(double value, char* digits, int32_t* exponent)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    uint64_t mantissa = bits & ((1ULL << 52) - 1);
+    int32_t biased = (int32_t)(bits >> 52) & 0x7ff;
+
+    uint64_t f = biased ? mantissa | (1ULL << 52) : mantissa;
+    int32_t e = biased ? biased - 1075 : -1074;
+
+    // the halfway points to the neighbours, r / s is the value and
+    // (r - m_minus) / s, (r + m_plus) / s are the bounds. the gap below a power
+    // of two is half the one above.
+    big_t r, s, m_plus, m_minus;
+    int lower_gap = mantissa == 0 && biased > 1;
+
+    big_from_u64(&r, f);
+    big_from_u64(&s, 1);
+    big_from_u64(&m_plus, 1);
+    big_from_u64(&m_minus, 1);
+
+    if (e >= 0) {
+        big_shift_left(&r, e + 1 + lower_gap);
+        big_shift_left(&s, 1 + lower_gap);
+        big_shift_left(&m_plus, e + lower_gap);
+        big_shift_left(&m_minus, e);
+    } else {
+        big_shift_left(&r, 1 + lower_gap);
+        big_shift_left(&s, 1 - e + lower_gap);
+        big_shift_left(&m_plus, lower_gap);
+    }
+
+    // values with an even mantissa round to themselves from the bounds.
+    int inclusive = (f & 1) == 0;
+
+    // ceil(log10(value)), or one less.
+    int32_t bit_len = 64 - __builtin_clzll(f);
+    int32_t k = (int32_t)ceil((e + bit_len - 1) * 0.30102999566398114 - 1e-10);
+
+    if (k >= 0) {
+        big_mul_pow10(&s, k);
+    } else {
+        big_mul_pow10(&r, -k);
+        big_mul_pow10(&m_plus, -k);
+        big_mul_pow10(&m_minus, -k);
+    }
+
+    big_t high;
+    big_add(&high, &r, &m_plus);
+
+    int compared = big_compare(&high, &s);
+
+    if (inclusive ? compared >= 0 : compared > 0) {
+        big_mul_small(&s, 10);
+        k++;
+    }
+
+    *exponent = k;
+
+    int32_t len = 0;
+
+    for (;;) {
+        big_mul_small(&r, 10);
+        big_mul_small(&m_plus, 10);
+        big_mul_small(&m_minus, 10);
+
+        int digit = 0;
+
+        while (big_compare(&r, &s) >= 0) {
+            big_sub(&r, &s);
+            digit++;
+        }
+
+        big_add(&high, &r, &m_plus);
+
+        int low_compared = big_compare(&r, &m_minus);
+        int high_compared = big_compare(&high, &s);
+
+        int low = inclusive ? low_compared <= 0 : low_compared < 0;
+        int up = inclusive ? high_compared >= 0 : high_compared > 0;
+
+        if (!low && !up) {
+            digits[len++] = '0' + digit;
+            continue;
+        }
+
+        // both neighbours read back, take the closer one, ties to even.
+        if (low && up) {
+            big_t twice = r;
+            big_shift_left(&twice, 1);
+
+            int half = big_compare(&twice, &s);
+            up = half > 0 || (half == 0 && digit % 2 == 1);
+        }
+
+        digits[len++] = '0' + digit + up;
+        return len;
+    }
+}
+
+// shortest text that reads back as the same double, laid out like %g with as
+// many significant digits as needed but at least 15.
+static int32_t format_double(char* dst, double value)
+{
+    if (isnan(value)) {
+        memcpy(dst, "nan", 3);
+        return 3;
+    }
+
+    if (isinf(value)) {
+        memcpy(dst, value < 0 ? "-inf" : "inf", value < 0 ? 4 : 3);
+        return value < 0 ? 4 : 3;
+    }
+
+    // integral values are exact in int64, they print with a trailing ".0".
+    if (fabs(value) < 1e15 && value == (double)(int64_t)value) {
+        int32_t len = 0;
+
+        if (value == 0 && signbit(value))
+            dst[len++] = '-';
+
+        len += format_int(dst + len, (int64_t)value);
+        dst[len++] = '.';
+        dst[len++] = '0';
+
+        return len;
+    }
+
+    char digits[20];
+    int32_t exponent;
+    int32_t digits_len = shortest_digits(fabs(value), digits, &exponent);
+
+    int32_t len = 0;
+
+    if (value < 0)
+        dst[len++] = '-';
+
+    // position of the first digit, as in d.ddd * 10^point.
+    int32_t point = exponent - 1;
+    int32_t precision = digits_len > 15 ? digits_len : 15;
+
+    if (point < -4 || point >= precision) {
+        dst[len++] = digits[0];
+
+        if (digits_len > 1) {
+            dst[len++] = '.';
+            memcpy(dst + len, digits + 1, digits_len - 1);
+            len += digits_len - 1;
+        }
+
+        dst[len++] = 'e';
+        dst[len++] = point < 0 ? '-' : '+';
+
+        int32_t magnitude = point < 0 ? -point : point;
+
+        if (magnitude < 10)
+            dst[len++] = '0';
+
+        return len + format_int(dst + len, magnitude);
+    }
+
+    if (point < 0) {
+        dst[len++] = '0';
+        dst[len++] = '.';
+
+        for (int32_t i = -1; i > point; i--)
+            dst[len++] = '0';
+
+        memcpy(dst + len, digits, digits_len);
+        return len + digits_len;
+    }
+
+    for (int32_t i = 0; i <= point; i++)
+        dst[len++] = i < digits_len ? digits[i] : '0';
+
+    // integral ones keep the ".0" that tells them apart from ints.
+    dst[len++] = '.';
+
+    if (digits_len > point + 1) {
+        memcpy(dst + len, digits + point + 1, digits_len - point - 1);
+        len += digits_len - point - 1;
+    } else {
+        dst[len++] = '0';
+    }
+
+    return len;
+}
+
+static void output_write(noutput_t* out, const void* data, int32_t len)
+{
+    if (out->buffer_len + len > OUTPUT_BUFFER_CAP)
+        noutput_flush(out);
+
+    memcpy(out->buffer + out->buffer_len, data, len);
+    out->buffer_len += len;
+}
+
+void noutput_value(noutput_t* out, value_t value)
+{
+    if (out->mode == OUTPUT_BINARY) {
+        switch (value_get_type(value)) {
+            case VAL_DOUBLE: {
+                double d = value_as_double(value);
+                output_write(out, "d", 1);
+                output_write(out, &d, sizeof(d));
+            } break;
+            case VAL_INT: {
+                int32_t i = value_as_int(value);
+                output_write(out, "i", 1);
+                output_write(out, &i, sizeof(i));
+            } break;
+            case VAL_ARRAY:
+            case VAL_UNKNOWN:
+                break;
+        }
+
+        return;
+    }
+
+    char text[VALUE_TEXT_CAP];
+    int32_t len = 0;
+
+    switch (value_get_type(value)) {
+        case VAL_DOUBLE:
+            len = format_double(text, value_as_double(value));
+            text[len++] = '\n';
+            break;
+        case VAL_INT:
+            len = format_int(text, value_as_int(value));
+            text[len++] = '\n';
+            break;
+        case VAL_ARRAY:
+            len = sprintf(text, "array@%d\n", value_as_array(value));
+            break;
+        case VAL_UNKNOWN:
+            len = sprintf(text, "unknown value ;(");
+            break;
+    }
+
+    output_write(out, text, len);
+}
@@ -3,11 +3,14 @@
 
 #define IS_DOUBLE(v)    ((v & NANISH) != NANISH)
 #define IS_INT(v)       ((v & INT_MASK) == INT_MASK)
+#define IS_ARRAY(v)     ((v & NANISH) == ARRAY_TAG)
 
 value_kind_t value_get_type(value_t value)
 {
     if (IS_INT(value)) {
         return VAL_INT;
+    } else if (IS_ARRAY(value)) {
+        return VAL_ARRAY;
     } else if (IS_DOUBLE(value)) {
         return VAL_DOUBLE;
     } else {
@@ -25,6 +28,11 @@ value_t value_from_int(int32_t value)
     return value | INT_MASK;
 }
 
+value_t value_from_array(int32_t handle)
+{
+    return (uint32_t)handle | ARRAY_TAG;
+}
+
 double value_as_double(value_t value)
 {
     assert(IS_DOUBLE(value));
@@ -36,3 +44,9 @@ int32_t value_as_int(value_t value)
     assert(IS_INT(value));
     return (int32_t)(value & NAN_PAYLOAD);
 }
+
+int32_t value_as_array(value_t value)
+{
+    assert(IS_ARRAY(value));
+    return (int32_t)(value & NAN_PAYLOAD);
+}
@@ -1,9 +1,11 @@
 #include "vm.h"
 
+#include <math.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 
 // offset by 12 to prevent program overflow.
 #define RESIZE_IF_NEEDED()                                          \
@@ -14,6 +16,24 @@
         }                                                           \
     }                                                               \
 
+// RESIZE_IF_NEEDED for instructions of variable size.
+static void reserve(npb_t* pb, int32_t size)
+{
+    if (pb->program_len + size < pb->program_cap)
+        return;
+
+    while (pb->program_len + size >= pb->program_cap)
+        pb->program_cap *= 2;
+
+    pb->program = realloc(pb->program, pb->program_cap);
+}
+
+static void emit_int32(npb_t* pb, int32_t value)
+{
+    memcpy(pb->program + pb->program_len, &value, sizeof(value));
+    pb->program_len += sizeof(value);
+}
+
 void npb_init(npb_t* pb)
 {
     pb->program_cap = 1024;
@@ -117,6 +137,48 @@ void npb_idiv(npb_t* pb)
     pb->program[pb->program_len++] = INS_IDIV;
 }
 
+void npb_imod(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_IMOD;
+}
+
+void npb_iand(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_IAND;
+}
+
+void npb_ior(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_IOR;
+}
+
+void npb_ixor(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_IXOR;
+}
+
+void npb_ishl(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ISHL;
+}
+
+void npb_ishr(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ISHR;
+}
+
 void npb_ieq(npb_t* pb)
 {
     RESIZE_IF_NEEDED();
@@ -249,6 +311,36 @@ void npb_brit(npb_t* pb, int32_t addr)
     pb->program_len += sizeof(addr);
 }
 
+void npb_brif(npb_t* pb, int32_t addr)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_BRIF;
+
+    memcpy(pb->program + pb->program_len, &addr, sizeof(addr));
+    pb->program_len += sizeof(addr);
+}
+
+void npb_memoenter(npb_t* pb, int32_t index)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_MEMOENTER;
+
+    memcpy(pb->program + pb->program_len, &index, sizeof(index));
+    pb->program_len += sizeof(index);
+}
+
+void npb_memoret(npb_t* pb, int32_t index)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_MEMORET;
+
+    memcpy(pb->program + pb->program_len, &index, sizeof(index));
+    pb->program_len += sizeof(index);
+}
+
 void npb_call(npb_t* pb, int32_t addr, int32_t num_args)
 {
     RESIZE_IF_NEEDED();
@@ -286,248 +378,1060 @@ void npb_loadarg(npb_t* pb, int32_t n)
     pb->program_len += sizeof(n);
 }
 
-#define FETCH(__type)                                           \
-    ({                                                          \
-        __type value = 0;                                       \
-        memcpy(&value, vm->program + vm->ip, sizeof(__type));   \
-        vm->ip += sizeof(__type);                               \
-        value;                                                  \
-    })                                                          \
-
-#define INTEGER_BINOP(__op)                                     \
-    {                                                           \
-        if (vm->sp < 1)                                         \
-            return TRAP_STACK_UNDERFLOW;                        \
-        int32_t b = value_as_int(pop(vm));                      \
-        int32_t a = value_as_int(pop(vm));                      \
-        int32_t result = a __op  b;                             \
-        push(vm, value_from_int(result));                       \
-        return TRAP_OK;                                         \
-    }                                                           \
-
-#define DOUBLE_COMP(__op)                                       \
-    {                                                           \
-        if (vm->sp < 1)                                         \
-            return TRAP_STACK_UNDERFLOW;                        \
-        double b = value_as_double(pop(vm));                    \
-        double a = value_as_double(pop(vm));                    \
-        int32_t result = a __op  b;                             \
-        push(vm, value_from_int(result));                       \
-        return TRAP_OK;                                         \
-    }                                                           \
+void npb_setarg(npb_t* pb, int32_t n)
+{
+    RESIZE_IF_NEEDED();
 
-#define DOUBLE_BINOP(__op)                                      \
-    {                                                           \
-        if (vm->sp < 1)                                         \
-            return TRAP_STACK_UNDERFLOW;                        \
-        double b = value_as_double(pop(vm));                    \
-        double a = value_as_double(pop(vm));                    \
-        double result = a __op  b;                              \
-        push(vm, value_from_double(result));                    \
-        return TRAP_OK;                                         \
-    }                                                           \
+    pb->program[pb->program_len++] = INS_SETARG;
 
+    memcpy(pb->program + pb->program_len, &n, sizeof(n));
+    pb->program_len += sizeof(n);
+}
 
-void noice_init(noice_t* vm)
+void npb_spawn(npb_t* pb, int32_t addr, int32_t num_args)
 {
-    vm->program = NULL;
-    vm->program_len = 0;
+    RESIZE_IF_NEEDED();
 
-    vm->ip = 0;
+    pb->program[pb->program_len++] = INS_SPAWN;
 
-    vm->sp = -1;
-    vm->fp = -1;
+    memcpy(pb->program + pb->program_len, &addr, sizeof(addr));
+    pb->program_len += sizeof(addr);
+
+    memcpy(pb->program + pb->program_len, &num_args, sizeof(num_args));
+    pb->program_len += sizeof(num_args);
 }
 
-void noice_load_program(noice_t* vm, uint8_t* program, int32_t program_len, int32_t program_start)
+void npb_await(npb_t* pb, int32_t index, int32_t num_args)
 {
-    vm->program = program;
-    vm->program_len = program_len;
+    RESIZE_IF_NEEDED();
 
-    vm->ip = program_start;
+    pb->program[pb->program_len++] = INS_AWAIT;
+
+    memcpy(pb->program + pb->program_len, &index, sizeof(index));
+    pb->program_len += sizeof(index);
+
+    memcpy(pb->program + pb->program_len, &num_args, sizeof(num_args));
+    pb->program_len += sizeof(num_args);
 }
 
-static ntrap_t evaluate(noice_t* vm);
+void npb_callnative(npb_t* pb, int32_t index, int32_t num_args)
+{
+    RESIZE_IF_NEEDED();
 
-static void push(noice_t* vm, value_t value);
-static value_t pop(noice_t* vm);
+    pb->program[pb->program_len++] = INS_CALLNATIVE;
 
-static void print_value(value_t value);
-
-void noice_run(noice_t* vm)
-{
-    while (true) {
-        switch (evaluate(vm)) {
-            case TRAP_UNKNOWN_OPCODE:
-                fprintf(stderr, "ERROR: unknown opcode: 0x%X\n", vm->program[vm->ip - 1]);
-                return;
-            case TRAP_HALT:
-                return;
-            case TRAP_OK:
-                break;
-            case TRAP_STACK_OVERFLOW:
-                fprintf(stderr, "ERROR: stack overflow\n");
-                return;
-            case TRAP_STACK_UNDERFLOW:
-                fprintf(stderr, "ERROR: stack underflow\n");
-                return;
-        }
-    }
+    memcpy(pb->program + pb->program_len, &index, sizeof(index));
+    pb->program_len += sizeof(index);
+
+    memcpy(pb->program + pb->program_len, &num_args, sizeof(num_args));
+    pb->program_len += sizeof(num_args);
 }
 
-ntrap_t evaluate(noice_t* vm)
+void npb_callstub(npb_t* pb, int32_t index, int32_t num_args)
 {
-    const uint8_t instruction = FETCH(uint8_t);
+    RESIZE_IF_NEEDED();
 
-    switch (instruction) {
-        case INS_HALT: return TRAP_HALT;
-        case INS_IPUSH: {
-            if (vm->sp >= STACK_CAP)
-                return TRAP_STACK_OVERFLOW;
+    pb->program[pb->program_len++] = INS_CALLSTUB;
 
-            value_t value = value_from_int(FETCH(int32_t));
-            push(vm, value);
-            return TRAP_OK;
-        }
-        case INS_DPUSH: {
-            if (vm->sp >= STACK_CAP)
-                return TRAP_STACK_OVERFLOW;
+    memcpy(pb->program + pb->program_len, &index, sizeof(index));
+    pb->program_len += sizeof(index);
 
-            value_t value = value_from_double(FETCH(double));
-            push(vm, value);
-            return TRAP_OK;
-        }
-        case INS_POP: {
-            if (vm->sp < 0)
-                return TRAP_STACK_UNDERFLOW;
+    memcpy(pb->program + pb->program_len, &num_args, sizeof(num_args));
+    pb->program_len += sizeof(num_args);
+}
 
-            pop(vm);
-            return TRAP_OK;
-        }
-        case INS_DUP: {
-            if (vm->sp >= STACK_CAP)
-                return TRAP_STACK_OVERFLOW;
+void npb_spawnstub(npb_t* pb, int32_t index, int32_t num_args)
+{
+    RESIZE_IF_NEEDED();
 
-            int32_t offset = FETCH(int32_t);
+    pb->program[pb->program_len++] = INS_SPAWNSTUB;
 
-            push(vm, vm->stack[offset]);
-            return TRAP_OK;
-        }
-        case INS_SET: {
-            if (vm->sp < 0)
-                return TRAP_STACK_UNDERFLOW;
+    memcpy(pb->program + pb->program_len, &index, sizeof(index));
+    pb->program_len += sizeof(index);
 
-            int32_t offset = FETCH(int32_t);
-            vm->stack[offset] = pop(vm);
+    memcpy(pb->program + pb->program_len, &num_args, sizeof(num_args));
+    pb->program_len += sizeof(num_args);
+}
 
-            return TRAP_OK;
-        }
-        case INS_PRINT: {
-            if (vm->sp < 0)
-                return TRAP_STACK_UNDERFLOW;
+void npb_i2d(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            print_value(pop(vm));
-            return TRAP_OK;
-        }
-        case INS_IADD: INTEGER_BINOP(+);
-        case INS_ISUB: INTEGER_BINOP(-);
-        case INS_IMUL: INTEGER_BINOP(*);
-        case INS_IDIV: INTEGER_BINOP(/);
-        case INS_IEQ:  INTEGER_BINOP(==);
-        case INS_INEQ: INTEGER_BINOP(!=);
-        case INS_ILT:  INTEGER_BINOP(<);
-        case INS_IGT:  INTEGER_BINOP(>);
-        case INS_ILTE: INTEGER_BINOP(<=);
-        case INS_IGTE: INTEGER_BINOP(>=);
-        case INS_DADD: DOUBLE_BINOP(+);
-        case INS_DSUB: DOUBLE_BINOP(-);
-        case INS_DMUL: DOUBLE_BINOP(*);
-        case INS_DDIV: DOUBLE_BINOP(/);
-        case INS_DEQ:  DOUBLE_COMP(==);
-        case INS_DNEQ: DOUBLE_COMP(!=);
-        case INS_DLT:  DOUBLE_COMP(<);
-        case INS_DGT:  DOUBLE_COMP(>);
-        case INS_DLTE: DOUBLE_COMP(<=);
-        case INS_DGTE: DOUBLE_COMP(>=);
-        case INS_BR: {
-            int32_t addr = FETCH(int32_t);
-            vm->ip = addr;
-            return TRAP_OK;
-        }
-        case INS_BRIT: {
-            if (vm->sp < 0)
-                return TRAP_STACK_UNDERFLOW;
+    pb->program[pb->program_len++] = INS_I2D;
+}
 
-            int32_t addr = FETCH(int32_t);
+void npb_d2i(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            if (value_as_int(pop(vm)))
-                vm->ip = addr;
+    pb->program[pb->program_len++] = INS_D2I;
+}
 
-            return TRAP_OK;
-        }
-        case INS_CALL: {
-            if (vm->sp + 3 >= STACK_CAP)
-                return TRAP_STACK_OVERFLOW;
+void npb_dsqrt(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            int32_t addr = FETCH(int32_t);
-            int32_t num_args = FETCH(int32_t);
+    pb->program[pb->program_len++] = INS_DSQRT;
+}
 
-            push(vm, value_from_int(num_args));
-            push(vm, value_from_int(vm->fp));
-            push(vm, value_from_int(vm->ip));
+void npb_dabs(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            vm->fp = vm->sp;
-            vm->ip = addr;
+    pb->program[pb->program_len++] = INS_DABS;
+}
 
-            return TRAP_OK;
-        }
-        case INS_RET: {
-            if (vm->sp - 3 < 0)
-                return TRAP_STACK_UNDERFLOW;
+void npb_iabs(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            value_t ret_val = vm->stack[vm->sp];
+    pb->program[pb->program_len++] = INS_IABS;
+}
 
-            vm->sp = vm->fp;
+void npb_dfloor(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            vm->ip = value_as_int(pop(vm));
-            vm->fp = value_as_int(pop(vm));
+    pb->program[pb->program_len++] = INS_DFLOOR;
+}
 
-            int32_t num_args = value_as_int(pop(vm));
+void npb_dceil(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
 
-            for (int32_t i = 0; i < num_args; i++)
-                pop(vm);
+    pb->program[pb->program_len++] = INS_DCEIL;
+}
 
-            push(vm, ret_val);
+void npb_imin(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_IMIN;
+}
+
+void npb_imax(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_IMAX;
+}
+
+void npb_dmin(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_DMIN;
+}
+
+void npb_dmax(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_DMAX;
+}
+
+void npb_dfma(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_DFMA;
+}
+
+void npb_tableswitch(npb_t* pb, int32_t low, int32_t count, int32_t default_addr, const int32_t* addrs)
+{
+    reserve(pb, 1 + sizeof(int32_t) * (3 + count));
+
+    pb->program[pb->program_len++] = INS_TABLESWITCH;
+
+    emit_int32(pb, low);
+    emit_int32(pb, count);
+    emit_int32(pb, default_addr);
+
+    for (int32_t i = 0; i < count; i++)
+        emit_int32(pb, addrs[i]);
+}
+
+void npb_lookupswitch(npb_t* pb, int32_t count, int32_t default_addr, const int32_t* keys, const int32_t* addrs)
+{
+    reserve(pb, 1 + sizeof(int32_t) * (2 + count * 2));
+
+    pb->program[pb->program_len++] = INS_LOOKUPSWITCH;
+
+    emit_int32(pb, count);
+    emit_int32(pb, default_addr);
+
+    for (int32_t i = 0; i < count; i++) {
+        emit_int32(pb, keys[i]);
+        emit_int32(pb, addrs[i]);
+    }
+}
+
+void npb_anew(npb_t* pb, value_kind_t kind)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ANEW;
+
+    int32_t operand = kind;
+    memcpy(pb->program + pb->program_len, &operand, sizeof(operand));
+    pb->program_len += sizeof(operand);
+}
+
+void npb_aload(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ALOAD;
+}
+
+void npb_astore(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ASTORE;
+}
+
+void npb_aloadu(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ALOADU;
+}
+
+void npb_astoreu(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ASTOREU;
+}
+
+void npb_alen(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_ALEN;
+}
+
+void npb_yield(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_YIELD;
+}
+
+void npb_resume(npb_t* pb)
+{
+    RESIZE_IF_NEEDED();
+
+    pb->program[pb->program_len++] = INS_RESUME;
+}
+
+#define FETCH(__type)                                           \
+    ({                                                          \
+        __type value = 0;                                       \
+        memcpy(&value, vm->program + vm->ip, sizeof(__type));   \
+        vm->ip += sizeof(__type);                               \
+        value;                                                  \
+    })                                                          \
+
+#define INTEGER_BINOP(__op)                                     \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        int32_t b = value_as_int(pop(vm));                      \
+        int32_t a = value_as_int(pop(vm));                      \
+        int32_t result = a __op  b;                             \
+        push(vm, value_from_int(result));                       \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+// division and remainder, dividing by -1 is special cased since
+// INT32_MIN / -1 faults on x86.
+#define INTEGER_DIVOP(__op, __by_minus_one)                     \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        int32_t b = value_as_int(pop(vm));                      \
+        int32_t a = value_as_int(pop(vm));                      \
+        if (b == 0)                                             \
+            return TRAP_DIVISION_BY_ZERO;                       \
+        int32_t result = b == -1 ? __by_minus_one : a __op b;   \
+        push(vm, value_from_int(result));                       \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+// shift counts are taken modulo 32.
+#define INTEGER_SHIFT(__expr)                                   \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        int32_t b = value_as_int(pop(vm)) & 31;                 \
+        int32_t a = value_as_int(pop(vm));                      \
+        push(vm, value_from_int(__expr));                       \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+#define DOUBLE_COMP(__op)                                       \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        double b = value_as_double(pop(vm));                    \
+        double a = value_as_double(pop(vm));                    \
+        int32_t result = a __op  b;                             \
+        push(vm, value_from_int(result));                       \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+// min/max, picks `a` when `a __op b` holds.
+#define INTEGER_PICK(__op)                                      \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        int32_t b = value_as_int(pop(vm));                      \
+        int32_t a = value_as_int(pop(vm));                      \
+        push(vm, value_from_int(a __op b ? a : b));             \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+#define DOUBLE_PICK(__op)                                       \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        double b = value_as_double(pop(vm));                    \
+        double a = value_as_double(pop(vm));                    \
+        push(vm, value_from_double(a __op b ? a : b));          \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+#define DOUBLE_UNOP(__expr)                                     \
+    {                                                           \
+        if (vm->sp < 0)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        double a = value_as_double(pop(vm));                    \
+        push(vm, value_from_double(__expr));                    \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+#define DOUBLE_BINOP(__op)                                      \
+    {                                                           \
+        if (vm->sp < 1)                                         \
+            return TRAP_STACK_UNDERFLOW;                        \
+        double b = value_as_double(pop(vm));                    \
+        double a = value_as_double(pop(vm));                    \
+        double result = a __op  b;                              \
+        push(vm, value_from_double(result));                    \
+        return TRAP_OK;                                         \
+    }                                                           \
+
+
+void noice_init(noice_t* vm)
+{
+    vm->program = NULL;
+    vm->program_len = 0;
+
+    vm->ip = 0;
+
+    vm->sp = -1;
+    vm->fp = -1;
+
+    vm->coroutines_cap = 8;
+    vm->coroutines_len = 1;
+    vm->coroutines = malloc(sizeof(*vm->coroutines) * vm->coroutines_cap);
+    vm->current = 0;
+    vm->free = -1;
+
+    vm->coroutines[0] = (ncoroutine_t) {
+        .state = CO_READY,
+        .generation = 0,
+        .ip = 0,
+        .sp = -1,
+        .fp = -1,
+        .stack = malloc(sizeof(value_t) * STACK_CAP),
+        .stack_cap = STACK_CAP,
+        .next = 0,
+        .prev = 0,
+    };
+
+    vm->stack = vm->coroutines[0].stack;
+    vm->stack_cap = STACK_CAP;
+
+    vm->asyncs = NULL;
+    vm->asyncs_len = 0;
+    vm->asyncs_cap = 0;
+
+    vm->heap = NULL;
+    vm->heap_len = 0;
+    vm->heap_cap = 0;
+    vm->heap_free = -1;
+    vm->heap_bytes = 0;
+    vm->heap_limit = HEAP_LIMIT;
+
+    vm->natives = NULL;
+    vm->natives_len = 0;
+
+    vm->memos = NULL;
+    vm->memos_len = 0;
+    vm->memo_cap = MEMO_CAP;
+
+    noutput_init_fd(&vm->output, STDOUT_FILENO);
+
+    vm->park_fd = -1;
+    vm->park_events = 0;
+    vm->park_next = NULL;
+
+    vm->trap = TRAP_OK;
+
+    vm->profile = NULL;
+
+    vm->compile = NULL;
+    vm->compile_userdata = NULL;
+}
+
+void noice_free(noice_t* vm)
+{
+    for (int32_t i = 0; i < vm->coroutines_len; i++)
+        free(vm->coroutines[i].stack);
+
+    free(vm->coroutines);
+
+    vm->coroutines = NULL;
+    vm->coroutines_len = 0;
+    vm->coroutines_cap = 0;
+    vm->stack = NULL;
+    vm->stack_cap = 0;
+
+    for (int32_t i = 0; i < vm->heap_len; i++)
+        free(vm->heap[i].data);
+
+    free(vm->heap);
+
+    vm->heap = NULL;
+    vm->heap_len = 0;
+    vm->heap_cap = 0;
+    vm->heap_free = -1;
+    vm->heap_bytes = 0;
+    vm->heap_limit = HEAP_LIMIT;
+
+    for (int32_t i = 0; i < vm->memos_len; i++) {
+        free(vm->memos[i].keys);
+        free(vm->memos[i].results);
+        free(vm->memos[i].used);
+    }
+
+    free(vm->memos);
+
+    vm->memos = NULL;
+    vm->memos_len = 0;
+
+    free(vm->asyncs);
+    noutput_free(&vm->output);
+
+    vm->asyncs = NULL;
+    vm->asyncs_len = 0;
+    vm->asyncs_cap = 0;
+
+    if (vm->profile) {
+        free(vm->profile->calls);
+        free(vm->profile->branches);
+        free(vm->profile->taken);
+        free(vm->profile);
+
+        vm->profile = NULL;
+    }
+}
+
+void noice_load_program(noice_t* vm, uint8_t* program, int32_t program_len, int32_t program_start)
+{
+    vm->program = program;
+    vm->program_len = program_len;
+
+    vm->ip = program_start;
+}
+
+void noice_enable_profile(noice_t* vm)
+{
+    vm->profile = malloc(sizeof(*vm->profile));
+
+    vm->profile->calls = calloc(vm->program_len, sizeof(int64_t));
+    vm->profile->branches = calloc(vm->program_len, sizeof(int64_t));
+    vm->profile->taken = calloc(vm->program_len, sizeof(int64_t));
+}
+
+void noice_register_natives(noice_t* vm, const nnative_t* natives, int32_t natives_len)
+{
+    vm->natives = natives;
+    vm->natives_len = natives_len;
+}
+
+void noice_register_compiler(noice_t* vm, ncompile_fn_t compile, void* userdata)
+{
+    vm->compile = compile;
+    vm->compile_userdata = userdata;
+}
+
+int32_t noice_register_async(noice_t* vm, nasync_fn_t fn, void* userdata)
+{
+    if (vm->asyncs_len >= vm->asyncs_cap) {
+        vm->asyncs_cap = vm->asyncs_cap ? vm->asyncs_cap * 2 : 8;
+        vm->asyncs = realloc(vm->asyncs, sizeof(*vm->asyncs) * vm->asyncs_cap);
+    }
+
+    vm->asyncs[vm->asyncs_len] = (nasync_t) { .fn = fn, .userdata = userdata };
+
+    return vm->asyncs_len++;
+}
+
+static ntrap_t evaluate(noice_t* vm);
+
+static void push(noice_t* vm, value_t value);
+static value_t pop(noice_t* vm);
+
+static int32_t array_new(noice_t* vm, value_kind_t kind, int32_t len);
+static ntrap_t array_load(noice_t* vm, int checked);
+static ntrap_t array_store(noice_t* vm, int checked);
+
+static void switch_to(noice_t* vm, int32_t index);
+static ntrap_t spawn(noice_t* vm, int32_t addr, int32_t num_args);
+static int32_t coroutine_handle(int32_t index, const ncoroutine_t* co);
+static ntrap_t finish_coroutine(noice_t* vm);
+static ntrap_t return_value(noice_t* vm, value_t ret_val);
+static nmemo_t* memo_get(noice_t* vm, int32_t index);
+static int memo_lookup(nmemo_t* memo, const value_t* args, value_t* result);
+static void memo_insert(noice_t* vm, nmemo_t* memo, const value_t* args, value_t result);
+
+ntrap_t noice_run(noice_t* vm)
+{
+    ntrap_t trap;
+
+    while ((trap = evaluate(vm)) == TRAP_OK)
+        ;
+
+    // a parked vm runs again, the failure is reported once it stops.
+    if (!noutput_flush(&vm->output) && trap != TRAP_PARK)
+        fprintf(stderr, "ERROR: failed to write output: %s\n", strerror(vm->output.error));
+
+    switch (trap) {
+        case TRAP_UNKNOWN_OPCODE:
+            fprintf(stderr, "ERROR: unknown opcode: 0x%X\n", vm->program[vm->ip - 1]);
+            break;
+        case TRAP_OK:
+        case TRAP_HALT:
+        case TRAP_PARK:
+        case TRAP_WAIT_FAILED: // only set by nloop_t, which reports it
+            break;
+        case TRAP_STACK_OVERFLOW:
+            fprintf(stderr, "ERROR: stack overflow\n");
+            break;
+        case TRAP_STACK_UNDERFLOW:
+            fprintf(stderr, "ERROR: stack underflow\n");
+            break;
+        case TRAP_INVALID_COROUTINE:
+            fprintf(stderr, "ERROR: invalid coroutine\n");
+            break;
+        case TRAP_INVALID_ASYNC:
+            fprintf(stderr, "ERROR: invalid async operation\n");
+            break;
+        case TRAP_INVALID_NATIVE:
+            fprintf(stderr, "ERROR: invalid native function\n");
+            break;
+        case TRAP_OUT_OF_BOUNDS:
+            fprintf(stderr, "ERROR: array index out of bounds\n");
+            break;
+        case TRAP_NEGATIVE_LENGTH:
+            fprintf(stderr, "ERROR: negative array length\n");
+            break;
+        case TRAP_INVALID_MEMO:
+            fprintf(stderr, "ERROR: memo cache used with different argument counts\n");
+            break;
+        case TRAP_DIVISION_BY_ZERO:
+            fprintf(stderr, "ERROR: division by zero\n");
+            break;
+        case TRAP_OUT_OF_BUDGET:
+            fprintf(stderr, "ERROR: instruction budget exhausted\n");
+            break;
+        case TRAP_INVALID_STUB:
+            fprintf(stderr, "ERROR: no compiler for a function stub\n");
+            break;
+        case TRAP_OUT_OF_MEMORY:
+            fprintf(stderr, "ERROR: out of memory\n");
+            break;
+    }
+
+    vm->trap = trap;
+    return trap;
+}
+
+ntrap_t noice_run_budget(noice_t* vm, int64_t budget)
+{
+    ntrap_t trap = TRAP_OK;
+
+    while (budget-- > 0 && (trap = evaluate(vm)) == TRAP_OK)
+        ;
+
+    noutput_flush(&vm->output);
+
+    vm->trap = trap == TRAP_OK ? TRAP_OUT_OF_BUDGET : trap;
+    return vm->trap;
+}
+
+ntrap_t evaluate(noice_t* vm)
+{
+    const uint8_t instruction = FETCH(uint8_t);
+
+    switch (instruction) {
+        case INS_HALT: return TRAP_HALT;
+        case INS_IPUSH: {
+            if (vm->sp + 1 >= vm->stack_cap)
+                return TRAP_STACK_OVERFLOW;
+
+            value_t value = value_from_int(FETCH(int32_t));
+            push(vm, value);
+            return TRAP_OK;
+        }
+        case INS_DPUSH: {
+            if (vm->sp + 1 >= vm->stack_cap)
+                return TRAP_STACK_OVERFLOW;
+
+            value_t value = value_from_double(FETCH(double));
+            push(vm, value);
+            return TRAP_OK;
+        }
+        case INS_POP: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            pop(vm);
+            return TRAP_OK;
+        }
+        case INS_DUP: {
+            if (vm->sp + 1 >= vm->stack_cap)
+                return TRAP_STACK_OVERFLOW;
+
+            int32_t offset = FETCH(int32_t);
+
+            push(vm, vm->stack[vm->fp + 1 + offset]);
+            return TRAP_OK;
+        }
+        case INS_SET: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t offset = FETCH(int32_t);
+            vm->stack[vm->fp + 1 + offset] = pop(vm);
+
+            return TRAP_OK;
+        }
+        case INS_PRINT: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            noutput_value(&vm->output, pop(vm));
+            return TRAP_OK;
+        }
+        case INS_IADD: INTEGER_BINOP(+);
+        case INS_ISUB: INTEGER_BINOP(-);
+        case INS_IMUL: INTEGER_BINOP(*);
+        case INS_IDIV: INTEGER_DIVOP(/, (int32_t)(0u - (uint32_t)a));
+        case INS_IMOD: INTEGER_DIVOP(%, 0);
+        case INS_IAND: INTEGER_BINOP(&);
+        case INS_IOR:  INTEGER_BINOP(|);
+        case INS_IXOR: INTEGER_BINOP(^);
+        case INS_ISHL: INTEGER_SHIFT((int32_t)((uint32_t)a << b));
+        case INS_ISHR: INTEGER_SHIFT(a >> b);
+        case INS_IEQ:  INTEGER_BINOP(==);
+        case INS_INEQ: INTEGER_BINOP(!=);
+        case INS_ILT:  INTEGER_BINOP(<);
+        case INS_IGT:  INTEGER_BINOP(>);
+        case INS_ILTE: INTEGER_BINOP(<=);
+        case INS_IGTE: INTEGER_BINOP(>=);
+        case INS_DADD: DOUBLE_BINOP(+);
+        case INS_DSUB: DOUBLE_BINOP(-);
+        case INS_DMUL: DOUBLE_BINOP(*);
+        case INS_DDIV: DOUBLE_BINOP(/);
+        case INS_DEQ:  DOUBLE_COMP(==);
+        case INS_DNEQ: DOUBLE_COMP(!=);
+        case INS_DLT:  DOUBLE_COMP(<);
+        case INS_DGT:  DOUBLE_COMP(>);
+        case INS_DLTE: DOUBLE_COMP(<=);
+        case INS_DGTE: DOUBLE_COMP(>=);
+        case INS_BR: {
+            int32_t addr = FETCH(int32_t);
+            vm->ip = addr;
+            return TRAP_OK;
+        }
+        case INS_BRIT: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t at = vm->ip - 1;
+            int32_t addr = FETCH(int32_t);
+            int taken = value_as_int(pop(vm)) != 0;
+
+            if (vm->profile) {
+                vm->profile->branches[at]++;
+                vm->profile->taken[at] += taken;
+            }
+
+            if (taken)
+                vm->ip = addr;
+
+            return TRAP_OK;
+        }
+        case INS_MEMOENTER: {
+            if (vm->fp < 2)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t index = FETCH(int32_t);
+            nmemo_t* memo = memo_get(vm, index);
+            int32_t num_args = value_as_int(vm->stack[vm->fp - 2]);
+
+            if (memo->cap && memo->num_args != num_args)
+                return TRAP_INVALID_MEMO;
+
+            memo->num_args = num_args;
+
+            value_t result;
+            if (memo_lookup(memo, vm->stack + vm->fp - 2 - num_args, &result))
+                return return_value(vm, result);
+
+            return TRAP_OK;
+        }
+        case INS_MEMORET: {
+            if (vm->sp - 3 < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t index = FETCH(int32_t);
+            nmemo_t* memo = memo_get(vm, index);
+            int32_t num_args = value_as_int(vm->stack[vm->fp - 2]);
+
+            if (memo->cap && memo->num_args != num_args)
+                return TRAP_INVALID_MEMO;
+
+            memo->num_args = num_args;
+            memo_insert(vm, memo, vm->stack + vm->fp - 2 - num_args, vm->stack[vm->sp]);
+
+            return return_value(vm, vm->stack[vm->sp]);
+        }
+        case INS_BRIF: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t at = vm->ip - 1;
+            int32_t addr = FETCH(int32_t);
+            int taken = value_as_int(pop(vm)) == 0;
+
+            if (vm->profile) {
+                vm->profile->branches[at]++;
+                vm->profile->taken[at] += taken;
+            }
+
+            if (taken)
+                vm->ip = addr;
+
+            return TRAP_OK;
+        }
+        case INS_CALL: {
+            if (vm->sp + 3 >= vm->stack_cap)
+                return TRAP_STACK_OVERFLOW;
+
+            int32_t addr = FETCH(int32_t);
+            int32_t num_args = FETCH(int32_t);
+
+            if (vm->profile)
+                vm->profile->calls[addr]++;
+
+            push(vm, value_from_int(num_args));
+            push(vm, value_from_int(vm->fp));
+            push(vm, value_from_int(vm->ip));
+
+            vm->fp = vm->sp;
+            vm->ip = addr;
+
+            return TRAP_OK;
+        }
+        case INS_RET: {
+            if (vm->sp - 3 < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            return return_value(vm, vm->stack[vm->sp]);
+        }
+        case INS_RETVOID: {
+            if (vm->sp - 3 < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            vm->sp = vm->fp;
+
+            vm->ip = value_as_int(pop(vm));
+            vm->fp = value_as_int(pop(vm));
+
+            int32_t num_args = value_as_int(pop(vm));
+
+            for (int32_t i = 0; i < num_args; i++)
+                pop(vm);
+
+            if (vm->ip < 0)
+                return finish_coroutine(vm);
+
+            return TRAP_OK;
+        }
+        case INS_LOADARG: {
+            if (vm->sp + 1 >= vm->stack_cap)
+                return TRAP_STACK_OVERFLOW;
+
+            int32_t n = FETCH(int32_t);
+            int32_t num_args = vm->stack[vm->fp - 2];
+
+            push(vm, vm->stack[vm->fp - 2 - num_args + n]);
 
             return TRAP_OK;
         }
-        case INS_RETVOID: {
-            if (vm->sp - 3 < 0)
+        case INS_SETARG: {
+            if (vm->sp < 0)
                 return TRAP_STACK_UNDERFLOW;
 
-            vm->sp = vm->fp;
+            int32_t n = FETCH(int32_t);
+            int32_t num_args = vm->stack[vm->fp - 2];
 
-            vm->ip = value_as_int(pop(vm));
-            vm->fp = value_as_int(pop(vm));
+            vm->stack[vm->fp - 2 - num_args + n] = pop(vm);
 
-            int32_t num_args = value_as_int(pop(vm));
+            return TRAP_OK;
+        }
+        case INS_SPAWN: {
+            int32_t addr = FETCH(int32_t);
+            int32_t num_args = FETCH(int32_t);
 
-            for (int32_t i = 0; i < num_args; i++)
-                pop(vm);
+            if (vm->profile)
+                vm->profile->calls[addr]++;
+
+            return spawn(vm, addr, num_args);
+        }
+        case INS_CALLSTUB:
+        case INS_SPAWNSTUB: {
+            int32_t at = vm->ip - 1;
+            int32_t index = FETCH(int32_t);
+
+            if (!vm->compile)
+                return TRAP_INVALID_STUB;
+
+            int32_t addr = vm->compile(vm, index, vm->compile_userdata);
+
+            // the stub is patched into the real instruction, which runs next.
+            vm->program[at] = vm->program[at] == INS_CALLSTUB ? INS_CALL : INS_SPAWN;
+            memcpy(vm->program + at + 1, &addr, sizeof(addr));
+
+            vm->ip = at;
 
             return TRAP_OK;
         }
-        case INS_LOADARG: {
-            if (vm->sp >= STACK_CAP)
+        case INS_YIELD: {
+            int32_t next = vm->coroutines[vm->current].next;
+
+            if (next != vm->current)
+                switch_to(vm, next);
+
+            return TRAP_OK;
+        }
+        case INS_RESUME: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t handle = value_as_int(pop(vm));
+            int32_t index = handle & ((1 << COROUTINE_INDEX_BITS) - 1);
+
+            if (handle < 0 || index >= vm->coroutines_len)
+                return TRAP_INVALID_COROUTINE;
+
+            // resuming a finished coroutine is a no-op, even once its slot
+            // runs another one.
+            ncoroutine_t* co = &vm->coroutines[index];
+
+            if (index != vm->current && co->state == CO_READY && coroutine_handle(index, co) == handle)
+                switch_to(vm, index);
+
+            return TRAP_OK;
+        }
+        case INS_AWAIT: {
+            int32_t start = vm->ip - 1;
+            int32_t index = FETCH(int32_t);
+            int32_t num_args = FETCH(int32_t);
+
+            if (index < 0 || index >= vm->asyncs_len)
+                return TRAP_INVALID_ASYNC;
+
+            if (vm->sp + 1 < num_args)
+                return TRAP_STACK_UNDERFLOW;
+
+            if (num_args == 0 && vm->sp + 1 >= vm->stack_cap)
                 return TRAP_STACK_OVERFLOW;
 
-            int32_t n = FETCH(int32_t);
-            int32_t num_args = vm->stack[vm->fp - 2];
+            nasync_t* async = &vm->asyncs[index];
+            value_t* args = vm->stack + vm->sp + 1 - num_args;
+            value_t result = value_from_int(0);
 
-            push(vm, vm->stack[vm->fp - 2 - num_args + n]);
+            // arguments stay on the stack so the operation can be retried.
+            if (async->fn(args, num_args, &result, &vm->park_fd, &vm->park_events, async->userdata) == ASYNC_PENDING) {
+                vm->ip = start;
+                return TRAP_PARK;
+            }
+
+            vm->sp -= num_args;
+            push(vm, result);
+
+            return TRAP_OK;
+        }
+        case INS_CALLNATIVE: {
+            int32_t index = FETCH(int32_t);
+            int32_t num_args = FETCH(int32_t);
+
+            if (index < 0 || index >= vm->natives_len)
+                return TRAP_INVALID_NATIVE;
+
+            if (vm->sp + 1 < num_args)
+                return TRAP_STACK_UNDERFLOW;
+
+            if (num_args == 0 && vm->sp + 1 >= vm->stack_cap)
+                return TRAP_STACK_OVERFLOW;
+
+            vm->sp -= num_args;
+            vm->sp += vm->natives[index].fn(vm->stack + vm->sp + 1, num_args);
+
+            return TRAP_OK;
+        }
+        case INS_I2D: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            push(vm, value_from_double(value_as_int(pop(vm))));
+            return TRAP_OK;
+        }
+        case INS_D2I: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            // truncates toward zero, saturates out of range values and maps nan to 0.
+            double a = value_as_double(pop(vm));
+            int32_t result = 0;
+
+            if (a >= 2147483647.0)
+                result = INT32_MAX;
+            else if (a <= -2147483648.0)
+                result = INT32_MIN;
+            else if (a == a)
+                result = (int32_t)a;
+
+            push(vm, value_from_int(result));
+            return TRAP_OK;
+        }
+        case INS_DSQRT:  DOUBLE_UNOP(sqrt(a));
+        case INS_DABS:   DOUBLE_UNOP(fabs(a));
+        case INS_DFLOOR: DOUBLE_UNOP(floor(a));
+        case INS_DCEIL:  DOUBLE_UNOP(ceil(a));
+        case INS_IABS: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t a = value_as_int(pop(vm));
+            uint32_t result = a < 0 ? 0u - (uint32_t)a : (uint32_t)a;
+
+            push(vm, value_from_int((int32_t)result));
+            return TRAP_OK;
+        }
+        case INS_IMIN: INTEGER_PICK(<);
+        case INS_IMAX: INTEGER_PICK(>);
+        case INS_DMIN: DOUBLE_PICK(<);
+        case INS_DMAX: DOUBLE_PICK(>);
+        case INS_DFMA: {
+            if (vm->sp < 2)
+                return TRAP_STACK_UNDERFLOW;
+
+            double c = value_as_double(pop(vm));
+            double b = value_as_double(pop(vm));
+            double a = value_as_double(pop(vm));
+
+            push(vm, value_from_double(fma(a, b, c)));
+            return TRAP_OK;
+        }
+        case INS_TABLESWITCH: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t low = FETCH(int32_t);
+            int32_t count = FETCH(int32_t);
+            int32_t default_addr = FETCH(int32_t);
+
+            uint32_t offset = (uint32_t)value_as_int(pop(vm)) - (uint32_t)low;
+
+            if (offset < (uint32_t)count) {
+                memcpy(&vm->ip, vm->program + vm->ip + offset * sizeof(int32_t), sizeof(int32_t));
+            } else {
+                vm->ip = default_addr;
+            }
+
+            return TRAP_OK;
+        }
+        case INS_LOOKUPSWITCH: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            int32_t count = FETCH(int32_t);
+            int32_t default_addr = FETCH(int32_t);
+
+            int32_t key = value_as_int(pop(vm));
+            const uint8_t* pairs = vm->program + vm->ip;
+
+            vm->ip = default_addr;
+
+            int32_t lo = 0;
+            int32_t hi = count - 1;
+
+            while (lo <= hi) {
+                int32_t mid = lo + (hi - lo) / 2;
+                int32_t pair[2];
+                memcpy(pair, pairs + mid * sizeof(pair), sizeof(pair));
+
+                if (pair[0] == key) {
+                    vm->ip = pair[1];
+                    break;
+                } else if (pair[0] < key) {
+                    lo = mid + 1;
+                } else {
+                    hi = mid - 1;
+                }
+            }
 
             return TRAP_OK;
         }
+        case INS_ANEW: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            value_kind_t kind = FETCH(int32_t);
+            int32_t len = value_as_int(pop(vm));
+
+            if (len < 0)
+                return TRAP_NEGATIVE_LENGTH;
+
+            int32_t handle = array_new(vm, kind, len);
+
+            if (handle == -1)
+                return TRAP_OUT_OF_MEMORY;
+
+            push(vm, value_from_array(handle));
+            return TRAP_OK;
+        }
+        case INS_ALOAD:   return array_load(vm, 1);
+        case INS_ALOADU:  return array_load(vm, 0);
+        case INS_ASTORE:  return array_store(vm, 1);
+        case INS_ASTOREU: return array_store(vm, 0);
+        case INS_ALEN: {
+            if (vm->sp < 0)
+                return TRAP_STACK_UNDERFLOW;
+
+            narray_t* array = &vm->heap[value_as_array(pop(vm))];
+
+            push(vm, value_from_int(array->len));
+            return TRAP_OK;
+        }
         default: {
             return TRAP_UNKNOWN_OPCODE;
         }
@@ -544,17 +1448,407 @@ static value_t pop(noice_t* vm)
     return vm->stack[vm->sp--];
 }
 
-static void print_value(value_t value)
+static void heap_mark(noice_t* vm, const value_t* values, int32_t values_len)
 {
-    switch (value_get_type(value)) {
-        case VAL_DOUBLE:
-            printf("%lf\n", value_as_double(value));
-            break;
-        case VAL_INT:
-            printf("%d\n", value_as_int(value));
-            break;
-        case VAL_UNKNOWN:
-            printf("unknown value ;(");
-            break;
+    for (int32_t i = 0; i < values_len; i++) {
+        if (value_get_type(values[i]) != VAL_ARRAY)
+            continue;
+
+        int32_t handle = value_as_array(values[i]);
+
+        if (handle >= 0 && handle < vm->heap_len)
+            vm->heap[handle].marked = 1;
+    }
+}
+
+// arrays hold no references, so the live ones are those on a coroutine stack
+// or in a memo cache.
+static void heap_collect(noice_t* vm)
+{
+    for (int32_t i = 0; i < vm->coroutines_len; i++) {
+        ncoroutine_t* co = &vm->coroutines[i];
+
+        if (i == vm->current) {
+            heap_mark(vm, vm->stack, vm->sp + 1);
+        } else if (co->state == CO_READY) {
+            heap_mark(vm, co->stack, co->sp + 1);
+        }
+    }
+
+    for (int32_t i = 0; i < vm->memos_len; i++) {
+        nmemo_t* memo = &vm->memos[i];
+
+        for (int32_t j = 0; j < memo->cap; j++) {
+            if (!memo->used[j])
+                continue;
+
+            heap_mark(vm, memo->keys + j * memo->num_args, memo->num_args);
+            heap_mark(vm, memo->results + j, 1);
+        }
+    }
+
+    for (int32_t i = 0; i < vm->heap_len; i++) {
+        narray_t* array = &vm->heap[i];
+
+        if (array->data && !array->marked) {
+            size_t element_size = array->kind == VAL_DOUBLE ? sizeof(double) : sizeof(int32_t);
+            vm->heap_bytes -= sizeof(narray_t) + (array->len ? array->len : 1) * element_size;
+
+            free(array->data);
+            array->data = NULL;
+            array->next = vm->heap_free;
+            vm->heap_free = i;
+        }
+
+        array->marked = 0;
+    }
+}
+
+// returns -1 when out of memory.
+static int32_t array_new(noice_t* vm, value_kind_t kind, int32_t len)
+{
+    size_t element_size = kind == VAL_DOUBLE ? sizeof(double) : sizeof(int32_t);
+    size_t size = sizeof(narray_t) + (size_t)(len ? len : 1) * element_size;
+
+    if (vm->heap_bytes + size > vm->heap_limit) {
+        heap_collect(vm);
+
+        if ((vm->heap_bytes + size) * 2 > vm->heap_limit)
+            vm->heap_limit = (vm->heap_bytes + size) * 2;
+    }
+
+    void* data = calloc(len ? len : 1, element_size);
+
+    if (!data) {
+        heap_collect(vm);
+        data = calloc(len ? len : 1, element_size);
+
+        if (!data)
+            return -1;
+    }
+
+    int32_t handle = vm->heap_free;
+
+    if (handle != -1) {
+        vm->heap_free = vm->heap[handle].next;
+    } else {
+        if (vm->heap_len >= vm->heap_cap) {
+            int32_t cap = vm->heap_cap ? vm->heap_cap * 2 : 64;
+            narray_t* heap = realloc(vm->heap, sizeof(*vm->heap) * cap);
+
+            if (!heap) {
+                free(data);
+                return -1;
+            }
+
+            vm->heap = heap;
+            vm->heap_cap = cap;
+        }
+
+        handle = vm->heap_len++;
+    }
+
+    vm->heap[handle] = (narray_t) {
+        .kind = kind,
+        .len = len,
+        .data = data,
+        .next = -1,
+        .marked = 0,
+    };
+
+    vm->heap_bytes += size;
+
+    return handle;
+}
+
+static ntrap_t array_load(noice_t* vm, int checked)
+{
+    if (vm->sp < 1)
+        return TRAP_STACK_UNDERFLOW;
+
+    int32_t index = value_as_int(pop(vm));
+    narray_t* array = &vm->heap[value_as_array(pop(vm))];
+
+    if (checked && (uint32_t)index >= (uint32_t)array->len)
+        return TRAP_OUT_OF_BOUNDS;
+
+    if (array->kind == VAL_DOUBLE) {
+        push(vm, value_from_double(((double*)array->data)[index]));
+    } else {
+        push(vm, value_from_int(((int32_t*)array->data)[index]));
+    }
+
+    return TRAP_OK;
+}
+
+static ntrap_t array_store(noice_t* vm, int checked)
+{
+    if (vm->sp < 2)
+        return TRAP_STACK_UNDERFLOW;
+
+    value_t value = pop(vm);
+    int32_t index = value_as_int(pop(vm));
+    narray_t* array = &vm->heap[value_as_array(pop(vm))];
+
+    if (checked && (uint32_t)index >= (uint32_t)array->len)
+        return TRAP_OUT_OF_BOUNDS;
+
+    if (array->kind == VAL_DOUBLE) {
+        ((double*)array->data)[index] = value_as_double(value);
+    } else {
+        ((int32_t*)array->data)[index] = value_as_int(value);
+    }
+
+    return TRAP_OK;
+}
+
+static void switch_to(noice_t* vm, int32_t index)
+{
+    ncoroutine_t* from = &vm->coroutines[vm->current];
+    from->ip = vm->ip;
+    from->sp = vm->sp;
+    from->fp = vm->fp;
+
+    ncoroutine_t* to = &vm->coroutines[index];
+    vm->ip = to->ip;
+    vm->sp = to->sp;
+    vm->fp = to->fp;
+    vm->stack = to->stack;
+    vm->stack_cap = to->stack_cap;
+
+    vm->current = index;
+}
+
+// the index of the coroutine with its generation above.
+static int32_t coroutine_handle(int32_t index, const ncoroutine_t* co)
+{
+    return co->generation << COROUTINE_INDEX_BITS | index;
+}
+
+static ntrap_t spawn(noice_t* vm, int32_t addr, int32_t num_args)
+{
+    if (vm->sp + 1 < num_args)
+        return TRAP_STACK_UNDERFLOW;
+
+    if (num_args + 3 >= COROUTINE_STACK_CAP)
+        return TRAP_STACK_OVERFLOW;
+
+    if (vm->sp + 1 >= vm->stack_cap)
+        return TRAP_STACK_OVERFLOW;
+
+    int32_t index = vm->free;
+
+    if (index != -1) {
+        vm->free = vm->coroutines[index].next;
+    } else {
+        if (vm->coroutines_len == 1 << COROUTINE_INDEX_BITS)
+            return TRAP_OUT_OF_MEMORY;
+
+        if (vm->coroutines_len >= vm->coroutines_cap) {
+            vm->coroutines_cap *= 2;
+            vm->coroutines = realloc(vm->coroutines, sizeof(*vm->coroutines) * vm->coroutines_cap);
+        }
+
+        index = vm->coroutines_len++;
+        vm->coroutines[index].stack = malloc(sizeof(value_t) * COROUTINE_STACK_CAP);
+        vm->coroutines[index].stack_cap = COROUTINE_STACK_CAP;
+        vm->coroutines[index].generation = 0;
+    }
+
+    ncoroutine_t* co = &vm->coroutines[index];
+    co->state = CO_READY;
+
+    // move the arguments over and build the entry frame, the -1 return
+    // address marks the end of the coroutine.
+    vm->sp -= num_args;
+    memcpy(co->stack, vm->stack + vm->sp + 1, sizeof(value_t) * num_args);
+
+    co->sp = num_args - 1;
+    co->stack[++co->sp] = value_from_int(num_args);
+    co->stack[++co->sp] = value_from_int(-1);
+    co->stack[++co->sp] = value_from_int(-1);
+    co->fp = co->sp;
+    co->ip = addr;
+
+    // link it right before the running coroutine so it runs at the end of
+    // the current round.
+    ncoroutine_t* running = &vm->coroutines[vm->current];
+    co->next = vm->current;
+    co->prev = running->prev;
+    vm->coroutines[running->prev].next = index;
+    running->prev = index;
+
+    push(vm, value_from_int(coroutine_handle(index, co)));
+
+    return TRAP_OK;
+}
+
+static ntrap_t finish_coroutine(noice_t* vm)
+{
+    int32_t index = vm->current;
+    ncoroutine_t* co = &vm->coroutines[index];
+
+    if (co->next == index)
+        return TRAP_HALT;
+
+    int32_t next = co->next;
+    vm->coroutines[co->prev].next = co->next;
+    vm->coroutines[co->next].prev = co->prev;
+
+    co->state = CO_FREE;
+    // wraps around before the handle would turn negative.
+    co->generation = (co->generation + 1) & ((1 << (31 - COROUTINE_INDEX_BITS)) - 1);
+    co->next = vm->free;
+    vm->free = index;
+
+    ncoroutine_t* to = &vm->coroutines[next];
+    vm->ip = to->ip;
+    vm->sp = to->sp;
+    vm->fp = to->fp;
+    vm->stack = to->stack;
+    vm->stack_cap = to->stack_cap;
+
+    vm->current = next;
+
+    return TRAP_OK;
+}
+
+static ntrap_t return_value(noice_t* vm, value_t ret_val)
+{
+    vm->sp = vm->fp;
+
+    vm->ip = value_as_int(pop(vm));
+    vm->fp = value_as_int(pop(vm));
+
+    int32_t num_args = value_as_int(pop(vm));
+
+    for (int32_t i = 0; i < num_args; i++)
+        pop(vm);
+
+    // returned from the entry function of a coroutine.
+    if (vm->ip < 0)
+        return finish_coroutine(vm);
+
+    push(vm, ret_val);
+
+    return TRAP_OK;
+}
+
+// a lookup gives up after this many slots, past it an insert evicts the
+// entry in the home slot.
+#define MEMO_PROBES 8
+
+static nmemo_t* memo_get(noice_t* vm, int32_t index)
+{
+    if (index >= vm->memos_len) {
+        vm->memos = realloc(vm->memos, sizeof(*vm->memos) * (index + 1));
+        memset(vm->memos + vm->memos_len, 0, sizeof(*vm->memos) * (index + 1 - vm->memos_len));
+        vm->memos_len = index + 1;
+    }
+
+    return &vm->memos[index];
+}
+
+static uint64_t memo_hash(const value_t* args, int32_t num_args)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15ull;
+
+    for (int32_t i = 0; i < num_args; i++) {
+        hash ^= args[i];
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+    }
+
+    return hash;
+}
+
+// slot holding `args`, or the first free one on its probe sequence with
+// `found` cleared, -1 when the sequence is full.
+static int32_t memo_find(nmemo_t* memo, const value_t* args, int* found)
+{
+    uint32_t mask = memo->cap - 1;
+    uint32_t slot = memo_hash(args, memo->num_args) & mask;
+
+    *found = 0;
+
+    for (int32_t i = 0; i < MEMO_PROBES && i < memo->cap; i++, slot = (slot + 1) & mask) {
+        if (!memo->used[slot])
+            return slot;
+
+        if (memcmp(memo->keys + (size_t)slot * memo->num_args, args, sizeof(value_t) * memo->num_args) == 0) {
+            *found = 1;
+            return slot;
+        }
+    }
+
+    return -1;
+}
+
+static int memo_lookup(nmemo_t* memo, const value_t* args, value_t* result)
+{
+    if (!memo->cap)
+        return 0;
+
+    int found;
+    int32_t slot = memo_find(memo, args, &found);
+
+    if (!found)
+        return 0;
+
+    *result = memo->results[slot];
+    return 1;
+}
+
+static void memo_put(nmemo_t* memo, const value_t* args, value_t result)
+{
+    int found;
+    int32_t slot = memo_find(memo, args, &found);
+
+    if (slot == -1) {
+        slot = memo_hash(args, memo->num_args) & (memo->cap - 1);
+    } else if (!found) {
+        memo->used[slot] = 1;
+        memo->len++;
+    }
+
+    memcpy(memo->keys + (size_t)slot * memo->num_args, args, sizeof(value_t) * memo->num_args);
+    memo->results[slot] = result;
+}
+
+static void memo_resize(nmemo_t* memo, int32_t cap)
+{
+    nmemo_t old = *memo;
+
+    memo->cap = cap;
+    memo->len = 0;
+    memo->keys = malloc(sizeof(value_t) * (size_t)cap * (memo->num_args ? memo->num_args : 1));
+    memo->results = malloc(sizeof(value_t) * cap);
+    memo->used = calloc(cap, 1);
+
+    for (int32_t i = 0; i < old.cap; i++) {
+        if (old.used[i])
+            memo_put(memo, old.keys + (size_t)i * old.num_args, old.results[i]);
     }
+
+    free(old.keys);
+    free(old.results);
+    free(old.used);
+}
+
+static void memo_insert(noice_t* vm, nmemo_t* memo, const value_t* args, value_t result)
+{
+    if (vm->memo_cap <= 0)
+        return;
+
+    if (!memo->cap) {
+        int32_t cap = 1;
+        while (cap < 16 && cap * 2 <= vm->memo_cap)
+            cap *= 2;
+
+        memo_resize(memo, cap);
+    } else if ((memo->len + 1) * 4 > memo->cap * 3 && memo->cap * 2 <= vm->memo_cap) {
+        memo_resize(memo, memo->cap * 2);
+    }
+
+    memo_put(memo, args, result);
 }
@@ -0,0 +1,424 @@
+#include "loop.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// event loop tests over pipes and socketpairs, exits with the number of
+// failed checks.
+
+static int failures = 0;
+
+#define CHECK(__cond)                                                   \
+    do {                                                                \
+        if (!(__cond)) {                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,      \
+                __LINE__, #__cond);                                     \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+enum {
+    ASYNC_READ,
+    ASYNC_WRITE,
+    ASYNC_NEVER,
+};
+
+// read_byte(fd), the byte read or -1 at the end of the stream.
+static nasync_status_t read_byte(value_t* args, int32_t num_args, value_t* result, int* fd, int* events, void* userdata)
+{
+    (void)num_args;
+    (void)userdata;
+
+    unsigned char byte;
+    ssize_t n = read(value_as_int(args[0]), &byte, 1);
+
+    if (n < 0 && errno == EAGAIN) {
+        *fd = value_as_int(args[0]);
+        *events = NOICE_WAIT_READ;
+        return ASYNC_PENDING;
+    }
+
+    *result = value_from_int(n == 1 ? byte : -1);
+    return ASYNC_DONE;
+}
+
+// write_byte(fd, byte), 1 once written.
+static nasync_status_t write_byte(value_t* args, int32_t num_args, value_t* result, int* fd, int* events, void* userdata)
+{
+    (void)num_args;
+    (void)userdata;
+
+    unsigned char byte = value_as_int(args[1]);
+    ssize_t n = write(value_as_int(args[0]), &byte, 1);
+
+    if (n < 0 && errno == EAGAIN) {
+        *fd = value_as_int(args[0]);
+        *events = NOICE_WAIT_WRITE;
+        return ASYNC_PENDING;
+    }
+
+    *result = value_from_int(n == 1);
+    return ASYNC_DONE;
+}
+
+// never_ready(fd), waits on whatever fd it's given.
+static nasync_status_t never_ready(value_t* args, int32_t num_args, value_t* result, int* fd, int* events, void* userdata)
+{
+    (void)num_args;
+    (void)result;
+    (void)userdata;
+
+    *fd = value_as_int(args[0]);
+    *events = NOICE_WAIT_READ;
+    return ASYNC_PENDING;
+}
+
+static void emit_read(npb_t* pb, int fd)
+{
+    npb_ipush(pb, fd);
+    npb_await(pb, ASYNC_READ, 1);
+}
+
+static void emit_write(npb_t* pb, int fd, int32_t byte)
+{
+    npb_ipush(pb, fd);
+    npb_ipush(pb, byte);
+    npb_await(pb, ASYNC_WRITE, 2);
+    npb_pop(pb);
+}
+
+// writes `count` zero bytes.
+static void emit_write_many(npb_t* pb, int fd, int32_t count)
+{
+    npb_ipush(pb, 0);
+
+    int32_t loop = pb->program_len;
+    npb_dup(pb, 0);
+    npb_ipush(pb, count);
+    npb_ilt(pb);
+
+    int32_t exit_patch = pb->program_len;
+    npb_brif(pb, -1);
+
+    npb_ipush(pb, fd);
+    npb_ipush(pb, 0);
+    npb_await(pb, ASYNC_WRITE, 2);
+    npb_pop(pb);
+
+    npb_dup(pb, 0);
+    npb_ipush(pb, 1);
+    npb_iadd(pb);
+    npb_set(pb, 0);
+    npb_br(pb, loop);
+
+    int32_t exit = pb->program_len;
+    memcpy(pb->program + exit_patch + 1, &exit, sizeof(exit));
+
+    npb_pop(pb);
+}
+
+// reads `count` bytes.
+static void emit_read_many(npb_t* pb, int fd, int32_t count)
+{
+    npb_ipush(pb, 0);
+
+    int32_t loop = pb->program_len;
+    npb_dup(pb, 0);
+    npb_ipush(pb, count);
+    npb_ilt(pb);
+
+    int32_t exit_patch = pb->program_len;
+    npb_brif(pb, -1);
+
+    emit_read(pb, fd);
+    npb_pop(pb);
+
+    npb_dup(pb, 0);
+    npb_ipush(pb, 1);
+    npb_iadd(pb);
+    npb_set(pb, 0);
+    npb_br(pb, loop);
+
+    int32_t exit = pb->program_len;
+    memcpy(pb->program + exit_patch + 1, &exit, sizeof(exit));
+
+    npb_pop(pb);
+}
+
+typedef struct {
+    npb_t pb;
+    noice_t vm;
+} test_vm_t;
+
+static void vm_begin(test_vm_t* t)
+{
+    npb_init(&t->pb);
+}
+
+static void vm_load(test_vm_t* t)
+{
+    noice_init(&t->vm);
+    noice_register_async(&t->vm, read_byte, NULL);
+    noice_register_async(&t->vm, write_byte, NULL);
+    noice_register_async(&t->vm, never_ready, NULL);
+
+    noutput_free(&t->vm.output);
+    noutput_init_memory(&t->vm.output);
+
+    noice_load_program(&t->vm, t->pb.program, t->pb.program_len, 0);
+}
+
+static int vm_output_is(test_vm_t* t, const char* expected)
+{
+    int32_t len = strlen(expected);
+    return t->vm.output.memory_len == len && memcmp(t->vm.output.memory, expected, len) == 0;
+}
+
+static void vm_end(test_vm_t* t)
+{
+    noice_free(&t->vm);
+    npb_free(&t->pb);
+}
+
+static void set_nonblocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// two readers parked on the same pipe, both are woken once it's written.
+static void test_pipe_shared_fd(void)
+{
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    set_nonblocking(fds[0]);
+    set_nonblocking(fds[1]);
+
+    test_vm_t readers[2];
+    test_vm_t writer;
+
+    nloop_t loop;
+    CHECK(nloop_init(&loop) == 0);
+
+    for (int i = 0; i < 2; i++) {
+        vm_begin(&readers[i]);
+        emit_read(&readers[i].pb, fds[0]);
+        npb_print(&readers[i].pb);
+        npb_halt(&readers[i].pb);
+        vm_load(&readers[i]);
+
+        nloop_add(&loop, &readers[i].vm);
+    }
+
+    CHECK(loop.running == 2);
+
+    vm_begin(&writer);
+    emit_write(&writer.pb, fds[1], 7);
+    emit_write(&writer.pb, fds[1], 8);
+    npb_halt(&writer.pb);
+    vm_load(&writer);
+
+    nloop_add(&loop, &writer.vm);
+    nloop_run(&loop);
+
+    CHECK(loop.running == 0);
+    CHECK((vm_output_is(&readers[0], "7\n") && vm_output_is(&readers[1], "8\n"))
+        || (vm_output_is(&readers[0], "8\n") && vm_output_is(&readers[1], "7\n")));
+
+    for (int i = 0; i < 2; i++) {
+        CHECK(readers[i].vm.trap == TRAP_HALT);
+        vm_end(&readers[i]);
+    }
+
+    vm_end(&writer);
+    nloop_free(&loop);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// request and reply over a socketpair, each side parks on its end again and
+// again.
+static void test_socketpair_echo(void)
+{
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    set_nonblocking(fds[0]);
+    set_nonblocking(fds[1]);
+
+    nloop_t loop;
+    CHECK(nloop_init(&loop) == 0);
+
+    test_vm_t echo;
+    vm_begin(&echo);
+
+    // the byte read plus one, written from slot 0.
+    for (int i = 0; i < 3; i++) {
+        emit_read(&echo.pb, fds[1]);
+        npb_ipush(&echo.pb, 1);
+        npb_iadd(&echo.pb);
+        npb_ipush(&echo.pb, fds[1]);
+        npb_dup(&echo.pb, 0);
+        npb_await(&echo.pb, ASYNC_WRITE, 2);
+        npb_pop(&echo.pb);
+        npb_pop(&echo.pb);
+    }
+
+    npb_halt(&echo.pb);
+    vm_load(&echo);
+    nloop_add(&loop, &echo.vm);
+
+    test_vm_t client;
+    vm_begin(&client);
+
+    for (int i = 0; i < 3; i++) {
+        emit_write(&client.pb, fds[0], i * 10);
+        emit_read(&client.pb, fds[0]);
+        npb_print(&client.pb);
+    }
+
+    npb_halt(&client.pb);
+    vm_load(&client);
+    nloop_add(&loop, &client.vm);
+
+    nloop_run(&loop);
+
+    CHECK(loop.running == 0);
+    CHECK(vm_output_is(&client, "1\n11\n21\n"));
+    CHECK(echo.vm.trap == TRAP_HALT);
+    CHECK(client.vm.trap == TRAP_HALT);
+
+    vm_end(&echo);
+    vm_end(&client);
+    nloop_free(&loop);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// a writer blocked on a full socket and a reader share one end, the other end
+// drains it then answers.
+static void test_socketpair_read_write_same_fd(void)
+{
+    int fds[2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    set_nonblocking(fds[0]);
+    set_nonblocking(fds[1]);
+
+    int size = 4096;
+    setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    setsockopt(fds[1], SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    const int32_t count = 1 << 16;
+
+    nloop_t loop;
+    CHECK(nloop_init(&loop) == 0);
+
+    test_vm_t writer, reader, drain;
+
+    vm_begin(&writer);
+    emit_write_many(&writer.pb, fds[0], count);
+    npb_halt(&writer.pb);
+    vm_load(&writer);
+    nloop_add(&loop, &writer.vm);
+
+    vm_begin(&reader);
+    emit_read(&reader.pb, fds[0]);
+    npb_print(&reader.pb);
+    npb_halt(&reader.pb);
+    vm_load(&reader);
+    nloop_add(&loop, &reader.vm);
+
+    CHECK(loop.running == 2);
+
+    vm_begin(&drain);
+    emit_read_many(&drain.pb, fds[1], count);
+    emit_write(&drain.pb, fds[1], 42);
+    npb_halt(&drain.pb);
+    vm_load(&drain);
+    nloop_add(&loop, &drain.vm);
+
+    nloop_run(&loop);
+
+    CHECK(loop.running == 0);
+    CHECK(vm_output_is(&reader, "42\n"));
+    CHECK(writer.vm.trap == TRAP_HALT);
+    CHECK(drain.vm.trap == TRAP_HALT);
+
+    vm_end(&writer);
+    vm_end(&reader);
+    vm_end(&drain);
+    nloop_free(&loop);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// a vm parked on a closed fd stops with a trap, the others still run.
+static void test_wait_failed(void)
+{
+    int fds[2];
+    CHECK(pipe(fds) == 0);
+    set_nonblocking(fds[0]);
+    set_nonblocking(fds[1]);
+
+    nloop_t loop;
+    CHECK(nloop_init(&loop) == 0);
+
+    int closed = dup(fds[0]);
+    close(closed);
+
+    test_vm_t broken, reader, writer;
+
+    vm_begin(&broken);
+    npb_ipush(&broken.pb, closed);
+    npb_await(&broken.pb, ASYNC_NEVER, 1);
+    npb_halt(&broken.pb);
+    vm_load(&broken);
+    nloop_add(&loop, &broken.vm);
+
+    CHECK(broken.vm.trap == TRAP_WAIT_FAILED);
+    CHECK(loop.running == 0);
+
+    vm_begin(&reader);
+    emit_read(&reader.pb, fds[0]);
+    npb_print(&reader.pb);
+    npb_halt(&reader.pb);
+    vm_load(&reader);
+    nloop_add(&loop, &reader.vm);
+
+    vm_begin(&writer);
+    emit_write(&writer.pb, fds[1], 5);
+    npb_halt(&writer.pb);
+    vm_load(&writer);
+    nloop_add(&loop, &writer.vm);
+
+    nloop_run(&loop);
+
+    CHECK(vm_output_is(&reader, "5\n"));
+
+    vm_end(&broken);
+    vm_end(&reader);
+    vm_end(&writer);
+    nloop_free(&loop);
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main()
+{
+    test_pipe_shared_fd();
+    test_socketpair_echo();
+    test_socketpair_read_write_same_fd();
+    test_wait_failed();
+
+    if (failures == 0)
+        printf("loop tests passed\n");
+
+    return failures;
+}
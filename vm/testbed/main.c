@@ -19,6 +19,7 @@ int main()
     noice_init(&vm);
     noice_load_program(&vm, pb.program, pb.program_len, start);
     noice_run(&vm);
+    noice_free(&vm);
 
     npb_free(&pb);
 }